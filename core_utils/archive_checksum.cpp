@@ -0,0 +1,198 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "archive_checksum.h"
+
+#include <array>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define FRACTALUTILS_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+// reflected Castagnoli polynomial
+constexpr uint32_t crc32c_poly = 0x82F63B78;
+
+// slicing-by-8 tables, table[0] is the classic byte-wise table
+using slice_tables_t = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr slice_tables_t make_slice_tables() noexcept {
+  slice_tables_t tables{};
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = n;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc & 1) ? (crc >> 1) ^ crc32c_poly : crc >> 1;
+    }
+    tables[0][n] = crc;
+  }
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t crc = tables[0][n];
+    for (size_t k = 1; k < 8; k++) {
+      crc = tables[0][crc & 0xFF] ^ (crc >> 8);
+      tables[k][n] = crc;
+    }
+  }
+  return tables;
+}
+
+constexpr slice_tables_t slice_tables = make_slice_tables();
+
+// crc is not inverted here, the caller does it
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len) noexcept {
+  const auto &t = slice_tables;
+  while (len > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+    crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    data++;
+    len--;
+  }
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    word ^= crc;
+    crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^
+          t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+          t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+          t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+    data += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    data++;
+    len--;
+  }
+  return crc;
+}
+
+#ifdef FRACTALUTILS_CRC32C_SSE42
+
+// The crc32 instruction has a latency of 3 cycles but a throughput of 1, so
+// three independent lanes are computed together and combined afterwards.
+constexpr size_t lane_bytes = 8192;
+
+// Appending lane_bytes zero bytes to the data is a linear map on the crc
+// state, stored as 4 tables indexed by the bytes of the state.
+struct lane_shift_table {
+  uint32_t table[4][256];
+
+  lane_shift_table() noexcept {
+    uint32_t images[32];
+    for (int bit = 0; bit < 32; bit++) {
+      uint32_t crc = uint32_t(1) << bit;
+      for (size_t i = 0; i < lane_bytes; i++) {
+        crc = slice_tables[0][crc & 0xFF] ^ (crc >> 8);
+      }
+      images[bit] = crc;
+    }
+    for (int b = 0; b < 4; b++) {
+      for (uint32_t v = 0; v < 256; v++) {
+        uint32_t img = 0;
+        for (int bit = 0; bit < 8; bit++) {
+          if ((v >> bit) & 1) {
+            img ^= images[b * 8 + bit];
+          }
+        }
+        this->table[b][v] = img;
+      }
+    }
+  }
+
+  [[nodiscard]] uint32_t shift(uint32_t crc) const noexcept {
+    return this->table[0][crc & 0xFF] ^ this->table[1][(crc >> 8) & 0xFF] ^
+           this->table[2][(crc >> 16) & 0xFF] ^ this->table[3][crc >> 24];
+  }
+};
+
+__attribute__((target("sse4.2"))) uint32_t crc32c_hw(uint32_t crc,
+                                                      const uint8_t *data,
+                                                      size_t len) noexcept {
+  static const lane_shift_table shift_table;
+
+  while (len > 0 && (reinterpret_cast<uintptr_t>(data) & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *data);
+    data++;
+    len--;
+  }
+#ifdef __x86_64__
+  while (len >= 3 * lane_bytes) {
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (size_t i = 0; i < lane_bytes; i += 8) {
+      uint64_t w0, w1, w2;
+      memcpy(&w0, data + i, 8);
+      memcpy(&w1, data + lane_bytes + i, 8);
+      memcpy(&w2, data + 2 * lane_bytes + i, 8);
+      crc0 = _mm_crc32_u64(crc0, w0);
+      crc1 = _mm_crc32_u64(crc1, w1);
+      crc2 = _mm_crc32_u64(crc2, w2);
+    }
+    crc = shift_table.shift(uint32_t(crc0)) ^ uint32_t(crc1);
+    crc = shift_table.shift(crc) ^ uint32_t(crc2);
+    data += 3 * lane_bytes;
+    len -= 3 * lane_bytes;
+  }
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = uint32_t(_mm_crc32_u64(crc, word));
+    data += 8;
+    len -= 8;
+  }
+#else
+  while (len >= 4) {
+    uint32_t word;
+    memcpy(&word, data, 4);
+    crc = _mm_crc32_u32(crc, word);
+    data += 4;
+    len -= 4;
+  }
+#endif
+  while (len > 0) {
+    crc = _mm_crc32_u8(crc, *data);
+    data++;
+    len--;
+  }
+  return crc;
+}
+
+bool cpu_has_sse42() noexcept {
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+}
+#endif
+
+}  // namespace
+
+uint32_t fractal_utils::internal::crc32c(uint32_t crc,
+                                         std::span<const uint8_t> src) noexcept {
+  crc = ~crc;
+#ifdef FRACTALUTILS_CRC32C_SSE42
+  if (cpu_has_sse42()) {
+    return ~crc32c_hw(crc, src.data(), src.size());
+  }
+#endif
+  return ~crc32c_sw(crc, src.data(), src.size());
+}
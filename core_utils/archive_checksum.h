@@ -0,0 +1,39 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_PRIVATE_ARCHIVE_CHECKSUM_H
+#define FRACTALUTILS_PRIVATE_ARCHIVE_CHECKSUM_H
+
+#include <span>
+#include <stdint.h>
+
+namespace fractal_utils {
+namespace internal {
+
+// CRC-32C (Castagnoli) of src, continued from crc. Pass 0 to start, and the
+// previous result to checksum data that arrives in pieces. Uses the SSE4.2
+// crc32 instruction when the CPU has it.
+uint32_t crc32c(uint32_t crc, std::span<const uint8_t> src) noexcept;
+
+}  // namespace internal
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_PRIVATE_ARCHIVE_CHECKSUM_H
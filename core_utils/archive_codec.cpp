@@ -0,0 +1,452 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "archive_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+#include <memory>
+#include <vector>
+
+#ifdef FRACTALUTILS_COREUTILS_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+
+#ifdef FRACTALUTILS_COREUTILS_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+using namespace fractal_utils;
+using namespace fractal_utils::internal;
+
+bool fractal_utils::is_codec_supported(segment_codec codec) noexcept {
+  switch (codec) {
+    case segment_codec::identity:
+      return true;
+    case segment_codec::deflate:
+#ifdef FRACTALUTILS_COREUTILS_ZLIB_SUPPORT
+      return true;
+#else
+      return false;
+#endif
+    case segment_codec::zstd:
+#ifdef FRACTALUTILS_COREUTILS_ZSTD_SUPPORT
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+namespace {
+
+bool is_valid_delta_width(uint8_t w) noexcept {
+  return w == 0 || w == 1 || w == 2 || w == 4 || w == 8;
+}
+
+// Stores the difference of each element to the previous one. prev carries the
+// last element between chunks. Trailing bytes that don't form a whole element
+// are copied unchanged.
+template <typename T>
+void delta_encode(const uint8_t *src, uint8_t *dst, size_t bytes,
+                  T &prev) noexcept {
+  const size_t n = bytes / sizeof(T);
+  for (size_t i = 0; i < n; i++) {
+    T cur;
+    memcpy(&cur, src + i * sizeof(T), sizeof(T));
+    const T diff = T(cur - prev);
+    memcpy(dst + i * sizeof(T), &diff, sizeof(T));
+    prev = cur;
+  }
+  memcpy(dst + n * sizeof(T), src + n * sizeof(T), bytes - n * sizeof(T));
+}
+
+template <typename T>
+void delta_decode(uint8_t *data, size_t bytes) noexcept {
+  const size_t n = bytes / sizeof(T);
+  T prev{0};
+  for (size_t i = 0; i < n; i++) {
+    T cur;
+    memcpy(&cur, data + i * sizeof(T), sizeof(T));
+    prev = T(prev + cur);
+    memcpy(data + i * sizeof(T), &prev, sizeof(T));
+  }
+}
+
+class delta_transformer {
+ private:
+  uint8_t m_width;
+  uint64_t m_prev{0};
+
+  template <typename T>
+  void impl_encode(const uint8_t *src, uint8_t *dst, size_t bytes) noexcept {
+    T prev = T(this->m_prev);
+    delta_encode<T>(src, dst, bytes, prev);
+    this->m_prev = prev;
+  }
+
+ public:
+  explicit delta_transformer(uint8_t width) : m_width{width} {}
+
+  // bytes must be a multiple of width except for the last chunk
+  void encode(const uint8_t *src, uint8_t *dst, size_t bytes) noexcept {
+    switch (this->m_width) {
+      case 1:
+        this->impl_encode<uint8_t>(src, dst, bytes);
+        return;
+      case 2:
+        this->impl_encode<uint16_t>(src, dst, bytes);
+        return;
+      case 4:
+        this->impl_encode<uint32_t>(src, dst, bytes);
+        return;
+      case 8:
+        this->impl_encode<uint64_t>(src, dst, bytes);
+        return;
+      default:
+        memcpy(dst, src, bytes);
+    }
+  }
+
+  void decode(uint8_t *data, size_t bytes) const noexcept {
+    switch (this->m_width) {
+      case 1:
+        delta_decode<uint8_t>(data, bytes);
+        return;
+      case 2:
+        delta_decode<uint16_t>(data, bytes);
+        return;
+      case 4:
+        delta_decode<uint32_t>(data, bytes);
+        return;
+      case 8:
+        delta_decode<uint64_t>(data, bytes);
+        return;
+      default:
+        return;
+    }
+  }
+};
+
+// Feeds src to fun chunk by chunk, with the delta transform applied if
+// required.
+std::string for_each_transformed_chunk(
+    const segment_encoding &encoding, std::span<const uint8_t> src,
+    const std::function<std::string(std::span<const uint8_t>, bool)>
+        &fun) noexcept {
+  if (encoding.delta_width == 0) {
+    return fun(src, true);
+  }
+
+  std::unique_ptr<uint8_t[]> scratch{new (std::nothrow)
+                                         uint8_t[codec_chunk_bytes]};
+  if (scratch == nullptr) {
+    return "Failed to allocate memory for encoding";
+  }
+  delta_transformer dt{encoding.delta_width};
+  size_t offset = 0;
+  do {
+    const size_t len = std::min(codec_chunk_bytes, src.size() - offset);
+    dt.encode(src.data() + offset, scratch.get(), len);
+    offset += len;
+    auto err = fun({scratch.get(), len}, offset >= src.size());
+    if (!err.empty()) {
+      return err;
+    }
+  } while (offset < src.size());
+  return {};
+}
+
+#ifdef FRACTALUTILS_COREUTILS_ZLIB_SUPPORT
+std::string deflate_encode(const segment_encoding &encoding,
+                           std::span<const uint8_t> src,
+                           const codec_sink_t &sink) noexcept {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  const int level = encoding.level == 0 ? Z_DEFAULT_COMPRESSION
+                                        : std::clamp<int>(encoding.level, 1, 9);
+  if (deflateInit(&zs, level) != Z_OK) {
+    return "deflateInit failed";
+  }
+  std::unique_ptr<z_stream, decltype(&deflateEnd)> guard{&zs, deflateEnd};
+
+  std::vector<uint8_t> out;
+  out.resize(codec_chunk_bytes);
+
+  return for_each_transformed_chunk(
+      encoding, src,
+      [&zs, &out, &sink](std::span<const uint8_t> chunk,
+                         bool is_last) -> std::string {
+        // zlib takes 32-bit lengths
+        size_t consumed = 0;
+        do {
+          const size_t feed =
+              std::min<size_t>(chunk.size() - consumed, size_t(1) << 30);
+          zs.next_in = const_cast<Bytef *>(chunk.data() + consumed);
+          zs.avail_in = uInt(feed);
+          consumed += feed;
+          const int flush =
+              (is_last && consumed >= chunk.size()) ? Z_FINISH : Z_NO_FLUSH;
+          int ret;
+          do {
+            zs.next_out = out.data();
+            zs.avail_out = uInt(out.size());
+            ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+              return "deflate failed";
+            }
+            const size_t produced = out.size() - zs.avail_out;
+            if (produced > 0 && !sink({out.data(), produced})) {
+              return "Failed to write encoded data";
+            }
+          } while (zs.avail_out == 0 ||
+                   (flush == Z_FINISH && ret != Z_STREAM_END));
+        } while (consumed < chunk.size());
+        return {};
+      });
+}
+
+std::string deflate_decode(uint64_t stored_bytes, const codec_source_t &source,
+                           std::span<uint8_t> dst) noexcept {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    return "inflateInit failed";
+  }
+  std::unique_ptr<z_stream, decltype(&inflateEnd)> guard{&zs, inflateEnd};
+
+  std::vector<uint8_t> in;
+  in.resize(std::min<uint64_t>(codec_chunk_bytes, stored_bytes));
+
+  uint64_t remaining = stored_bytes;
+  size_t written = 0;
+  int ret = Z_OK;
+  while (remaining > 0 && ret != Z_STREAM_END) {
+    const size_t len = std::min<uint64_t>(in.size(), remaining);
+    if (!source({in.data(), len})) {
+      return "Failed to read encoded data";
+    }
+    remaining -= len;
+    zs.next_in = in.data();
+    zs.avail_in = uInt(len);
+    do {
+      const size_t space =
+          std::min<size_t>(dst.size() - written, size_t(1) << 30);
+      zs.next_out = dst.data() + written;
+      zs.avail_out = uInt(space);
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+        return fmt::format("inflate failed with error code {}", ret);
+      }
+      written += space - zs.avail_out;
+      if (ret == Z_BUF_ERROR) {
+        if (zs.avail_in > 0) {
+          return "Decoded data is larger than expected";
+        }
+        // needs more input
+        break;
+      }
+    } while (ret != Z_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+  }
+
+  if (ret != Z_STREAM_END || remaining != 0 || written != dst.size()) {
+    return "Encoded data is incomplete or corrupted";
+  }
+  return {};
+}
+#endif
+
+#ifdef FRACTALUTILS_COREUTILS_ZSTD_SUPPORT
+std::string zstd_encode(const segment_encoding &encoding,
+                        std::span<const uint8_t> src,
+                        const codec_sink_t &sink) noexcept {
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx{ZSTD_createCCtx(),
+                                                           ZSTD_freeCCtx};
+  if (ctx == nullptr) {
+    return "ZSTD_createCCtx failed";
+  }
+  if (encoding.level != 0) {
+    ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, encoding.level);
+  }
+  ZSTD_CCtx_setPledgedSrcSize(ctx.get(), src.size());
+
+  std::vector<uint8_t> out;
+  out.resize(ZSTD_CStreamOutSize());
+
+  return for_each_transformed_chunk(
+      encoding, src,
+      [&ctx, &out, &sink](std::span<const uint8_t> chunk,
+                          bool is_last) -> std::string {
+        ZSTD_inBuffer input{chunk.data(), chunk.size(), 0};
+        const ZSTD_EndDirective mode = is_last ? ZSTD_e_end : ZSTD_e_continue;
+        bool finished = false;
+        while (!finished) {
+          ZSTD_outBuffer output{out.data(), out.size(), 0};
+          const size_t remaining =
+              ZSTD_compressStream2(ctx.get(), &output, &input, mode);
+          if (ZSTD_isError(remaining)) {
+            return fmt::format("zstd failed to compress: {}",
+                               ZSTD_getErrorName(remaining));
+          }
+          if (output.pos > 0 && !sink({out.data(), output.pos})) {
+            return "Failed to write encoded data";
+          }
+          finished = is_last ? (remaining == 0) : (input.pos == input.size);
+        }
+        return {};
+      });
+}
+
+std::string zstd_decode(uint64_t stored_bytes, const codec_source_t &source,
+                        std::span<uint8_t> dst) noexcept {
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx{ZSTD_createDCtx(),
+                                                           ZSTD_freeDCtx};
+  if (ctx == nullptr) {
+    return "ZSTD_createDCtx failed";
+  }
+
+  std::vector<uint8_t> in;
+  in.resize(std::min<uint64_t>(ZSTD_DStreamInSize(), stored_bytes));
+
+  ZSTD_outBuffer output{dst.data(), dst.size(), 0};
+  uint64_t remaining = stored_bytes;
+  size_t last_ret = 1;
+  while (remaining > 0) {
+    const size_t len = std::min<uint64_t>(in.size(), remaining);
+    if (!source({in.data(), len})) {
+      return "Failed to read encoded data";
+    }
+    remaining -= len;
+    ZSTD_inBuffer input{in.data(), len, 0};
+    while (input.pos < input.size) {
+      const size_t old_pos = output.pos;
+      last_ret = ZSTD_decompressStream(ctx.get(), &output, &input);
+      if (ZSTD_isError(last_ret)) {
+        return fmt::format("zstd failed to decompress: {}",
+                           ZSTD_getErrorName(last_ret));
+      }
+      if (output.pos == output.size && output.pos == old_pos &&
+          input.pos < input.size) {
+        return "Decoded data is larger than expected";
+      }
+    }
+  }
+
+  if (last_ret != 0 || output.pos != dst.size()) {
+    return "Encoded data is incomplete or corrupted";
+  }
+  return {};
+}
+#endif
+
+}  // namespace
+
+std::string fractal_utils::internal::encode_segment(
+    const segment_encoding &encoding, std::span<const uint8_t> src,
+    const codec_sink_t &sink) noexcept {
+  if (!is_valid_delta_width(encoding.delta_width)) {
+    return fmt::format("Invalid delta width {}", encoding.delta_width);
+  }
+  switch (encoding.codec) {
+    case segment_codec::identity:
+      return for_each_transformed_chunk(
+          encoding, src,
+          [&sink](std::span<const uint8_t> chunk, bool) -> std::string {
+            if (!sink(chunk)) {
+              return "Failed to write encoded data";
+            }
+            return {};
+          });
+#ifdef FRACTALUTILS_COREUTILS_ZLIB_SUPPORT
+    case segment_codec::deflate:
+      return deflate_encode(encoding, src, sink);
+#endif
+#ifdef FRACTALUTILS_COREUTILS_ZSTD_SUPPORT
+    case segment_codec::zstd:
+      return zstd_encode(encoding, src, sink);
+#endif
+    default:
+      return fmt::format("Codec {} is not supported by this build",
+                         int(encoding.codec));
+  }
+}
+
+uint64_t fractal_utils::internal::max_decoded_bytes(
+    const segment_encoding &encoding, uint64_t stored_bytes) noexcept {
+  // deflate expands at most 1032 times; a 4 byte zstd RLE block expands to
+  // a whole 128 KiB block. Slack covers stream headers.
+  auto bound = [stored_bytes](uint64_t ratio, uint64_t slack) {
+    if (stored_bytes > (UINT64_MAX - slack) / ratio) {
+      return UINT64_MAX;
+    }
+    return stored_bytes * ratio + slack;
+  };
+  switch (encoding.codec) {
+    case segment_codec::identity:
+      return stored_bytes;
+    case segment_codec::deflate:
+      return bound(1032, 1024);
+    case segment_codec::zstd:
+      return bound(uint64_t(1) << 15, uint64_t(1) << 17);
+  }
+  return stored_bytes;
+}
+
+std::string fractal_utils::internal::decode_segment(
+    const segment_encoding &encoding, uint64_t stored_bytes,
+    const codec_source_t &source, std::span<uint8_t> dst) noexcept {
+  if (!is_valid_delta_width(encoding.delta_width)) {
+    return fmt::format("Invalid delta width {}", encoding.delta_width);
+  }
+
+  std::string err;
+  switch (encoding.codec) {
+    case segment_codec::identity:
+      if (stored_bytes != dst.size()) {
+        return "Size of encoded data mismatch";
+      }
+      if (!source(dst)) {
+        return "Failed to read encoded data";
+      }
+      break;
+#ifdef FRACTALUTILS_COREUTILS_ZLIB_SUPPORT
+    case segment_codec::deflate:
+      err = deflate_decode(stored_bytes, source, dst);
+      break;
+#endif
+#ifdef FRACTALUTILS_COREUTILS_ZSTD_SUPPORT
+    case segment_codec::zstd:
+      err = zstd_decode(stored_bytes, source, dst);
+      break;
+#endif
+    default:
+      return fmt::format("Codec {} is not supported by this build",
+                         int(encoding.codec));
+  }
+  if (!err.empty()) {
+    return err;
+  }
+
+  delta_transformer{encoding.delta_width}.decode(dst.data(), dst.size());
+  return {};
+}
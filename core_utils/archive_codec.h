@@ -0,0 +1,64 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_PRIVATE_ARCHIVE_CODEC_H
+#define FRACTALUTILS_PRIVATE_ARCHIVE_CODEC_H
+
+#include <functional>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "binary_archive.h"
+
+namespace fractal_utils {
+namespace internal {
+
+// encoders and decoders work on chunks of this size, so no segment is ever
+// copied as a whole
+constexpr size_t codec_chunk_bytes = size_t(1) << 18;
+
+// receives encoded bytes, returns false to abort
+using codec_sink_t = std::function<bool(std::span<const uint8_t>)>;
+// fills the whole span with encoded bytes, returns false on failure
+using codec_source_t = std::function<bool(std::span<uint8_t>)>;
+
+// A generous upper bound of the decoded size of stored_bytes encoded bytes,
+// used to reject corrupted sizes before allocating for them.
+uint64_t max_decoded_bytes(const segment_encoding &encoding,
+                           uint64_t stored_bytes) noexcept;
+
+// Encode src and push the result to sink chunk by chunk.
+std::string encode_segment(const segment_encoding &encoding,
+                           std::span<const uint8_t> src,
+                           const codec_sink_t &sink) noexcept;
+
+// Decode exactly stored_bytes bytes pulled from source into dst. The size of
+// dst must be the decoded size of the segment.
+std::string decode_segment(const segment_encoding &encoding,
+                           uint64_t stored_bytes, const codec_source_t &source,
+                           std::span<uint8_t> dst) noexcept;
+
+}  // namespace internal
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_PRIVATE_ARCHIVE_CODEC_H
@@ -20,12 +20,30 @@ This file is part of FractalUtils.
 */
 
 #include "binary_archive.h"
+#include "archive_codec.h"
+#include "archive_checksum.h"
+#include "mapped_file.h"
+#include "segment_pool.h"
 #include <assert.h>
+#include <bit>
 #include <fmt/format.h>
 #include <fstream>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <string>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#endif
+
 fractal_utils::data_segment::data_segment(int64_t tag, const variant_t &var)
     : m_tag(tag), m_variant(var) {}
 fractal_utils::data_segment::data_segment(int64_t tag, variant_t &&var)
@@ -89,64 +107,305 @@ bool read_val_check(std::istream &is, T &t) noexcept {
   return read_size_correct(is, reinterpret_cast<char *>(&t), sizeof(T));
 }
 
+namespace {
+constexpr uint8_t descriptor_has_checksum = 1;
+// descriptors without a checksum stop after raw_bytes
+constexpr uint64_t min_descriptor_bytes = 16;
+
+// data of a segment_descriptor record
+struct segment_descriptor_data {
+  uint8_t codec;
+  uint8_t delta_width;
+  uint8_t flags;
+  uint8_t reserved[5];
+  // bytes of decoded data
+  uint64_t raw_bytes;
+  // crc32c of the stored bytes, if flags has descriptor_has_checksum
+  uint32_t checksum;
+  uint32_t reserved2;
+
+  [[nodiscard]] bool has_checksum() const noexcept {
+    return this->flags & descriptor_has_checksum;
+  }
+  [[nodiscard]] uint64_t bytes_in_file() const noexcept {
+    return this->has_checksum() ? sizeof(segment_descriptor_data)
+                                : min_descriptor_bytes;
+  }
+};
+static_assert(sizeof(segment_descriptor_data) == 24);
+
+constexpr uint64_t record_header_bytes = sizeof(int64_t) + sizeof(uint64_t);
+
+fractal_utils::segment_encoding encoding_of(
+    const segment_descriptor_data &desc) noexcept {
+  fractal_utils::segment_encoding enc;
+  enc.codec = fractal_utils::segment_codec(desc.codec);
+  enc.delta_width = desc.delta_width;
+  return enc;
+}
+
+segment_descriptor_data descriptor_of(const fractal_utils::segment_encoding &enc,
+                                      uint64_t raw_bytes,
+                                      bool checksum) noexcept {
+  segment_descriptor_data desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.codec = uint8_t(enc.codec);
+  desc.delta_width = enc.delta_width;
+  desc.flags = checksum ? descriptor_has_checksum : 0;
+  desc.raw_bytes = raw_bytes;
+  return desc;
+}
+
+// Fills desc from the data of a descriptor record of the given size. Fields
+// missing in older descriptors are zero.
+bool descriptor_from_bytes(std::span<const uint8_t> bytes,
+                           segment_descriptor_data &desc) noexcept {
+  if (bytes.size() < min_descriptor_bytes) {
+    return false;
+  }
+  memset(&desc, 0, sizeof(desc));
+  memcpy(&desc, bytes.data(), std::min(bytes.size(), sizeof(desc)));
+  return bytes.size() >= desc.bytes_in_file();
+}
+
+// the encoding actually used when saving a segment
+fractal_utils::segment_encoding saved_encoding_of(
+    const fractal_utils::data_segment &ds) noexcept {
+  fractal_utils::segment_encoding enc = ds.encoding();
+  if (!fractal_utils::is_codec_supported(enc.codec)) {
+    enc.codec = fractal_utils::segment_codec::identity;
+  }
+  return enc;
+}
+}  // namespace
+
 std::optional<fractal_utils::data_segment> fractal_utils::read_segment_data(
     std::istream &is) noexcept {
   return read_segment_data(is, {}, nullptr);
 }
 
-std::optional<fractal_utils::data_segment> fractal_utils::read_segment_data(
-    std::istream &is, std::span<uint8_t> buffer,
-    size_t *used_bytes_dest) noexcept {
+namespace {
+struct stream_reader {
+  std::istream &is;
+
+  bool read(void *dst, size_t bytes) noexcept {
+    return read_size_correct(this->is, reinterpret_cast<char *>(dst), bytes);
+  }
+  void skip(uint64_t bytes) noexcept { this->is.ignore(bytes); }
+  // the size of a stream is unknown, a short stream fails when read
+  bool has_left(uint64_t) const noexcept { return true; }
+  bool at_end() noexcept { return this->is.eof() || this->is.peek() == EOF; }
+  const char *failure() const noexcept {
+    if (this->is.fail()) {
+      return "The input stream failed (is.fail() == true)";
+    }
+    if (this->is.bad()) {
+      return "The input stream is bad (is.bad() == true)";
+    }
+    return nullptr;
+  }
+};
+
+// Where read_segment_record puts segment data. get returns nullptr if it
+// can't provide the memory, then the segment gets a vector of its own.
+struct no_buffer {
+  uint8_t *get(uint64_t) noexcept { return nullptr; }
+};
+
+struct span_buffer {
+  uint8_t *cur;
+  uint8_t *const end;
+
+  uint8_t *get(uint64_t bytes) noexcept {
+    if (bytes > uint64_t(this->end - this->cur)) {
+      return nullptr;
+    }
+    uint8_t *ret = this->cur;
+    this->cur += bytes;
+    return ret;
+  }
+};
+
+struct pool_buffer {
+  fractal_utils::segment_pool &pool;
+
+  uint8_t *get(uint64_t bytes) noexcept {
+    if (bytes > SIZE_MAX) {
+      return nullptr;
+    }
+    return this->pool.allocate(bytes).data();
+  }
+};
+
+template <class reader_t, typename T>
+bool read_val(reader_t &reader, T &t) noexcept {
+  return reader.read(&t, sizeof(T));
+}
+
+template <class reader_t>
+bool read_descriptor(reader_t &reader, uint64_t bytes,
+                     segment_descriptor_data &desc) noexcept {
+  uint8_t known[sizeof(segment_descriptor_data)];
+  const uint64_t known_bytes = std::min<uint64_t>(bytes, sizeof(known));
+  if (!reader.read(known, known_bytes)) {
+    return false;
+  }
+  // newer versions may append fields
+  reader.skip(bytes - known_bytes);
+  return descriptor_from_bytes({known, known_bytes}, desc);
+}
+}  // namespace
+
+// Reads a segment and the descriptor before it, if any. record_bytes_dest
+// receives the bytes occupied in file. Data of metadata records never goes to
+// the buffer.
+template <class reader_t, class buffer_t>
+std::optional<fractal_utils::data_segment> read_segment_record(
+    reader_t &reader, buffer_t &buffer, uint64_t *record_bytes_dest) noexcept {
+  using namespace fractal_utils;
   fractal_utils::data_segment ret;
   int64_t tag;
-  if (!read_val_check(is, tag)) {
+  if (!read_val(reader, tag)) {
     return std::nullopt;
   }
 
   uint64_t bytes{0};
-  if (!read_val_check(is, bytes)) {
+  // a length beyond the end of file must not reach the buffer
+  if (!read_val(reader, bytes) || !reader.has_left(bytes)) {
     return std::nullopt;
   }
+
+  uint64_t record_bytes = record_header_bytes + bytes;
+  std::optional<segment_descriptor_data> desc{std::nullopt};
+  if (tag == archive_tags::segment_descriptor) {
+    desc.emplace();
+    if (!read_descriptor(reader, bytes, desc.value())) {
+      return std::nullopt;
+    }
+
+    if (!read_val(reader, tag) || !read_val(reader, bytes) ||
+        archive_tags::is_reserved(tag) || !reader.has_left(bytes)) {
+      return std::nullopt;
+    }
+    record_bytes += record_header_bytes + bytes;
+  }
   ret.set_tag(tag);
 
-  bool use_buffer{false};
+  const uint64_t stored_bytes = bytes;
+  const uint64_t raw_bytes =
+      desc.has_value() ? desc.value().raw_bytes : stored_bytes;
+  if (desc.has_value() &&
+      raw_bytes > internal::max_decoded_bytes(encoding_of(desc.value()),
+                                              stored_bytes)) {
+    return std::nullopt;
+  }
 
-  const uint64_t bytes_required = bytes;
-  if (bytes_required > buffer.size_bytes()) {
-    use_buffer = false;
-  } else {
-    use_buffer = true;
+  uint8_t *data_ptr{nullptr};
+  if (!archive_tags::is_reserved(tag)) {
+    data_ptr = buffer.get(raw_bytes);
   }
+  const bool use_buffer = (data_ptr != nullptr);
 
   // this vector is used when buffer is not enough
   std::vector<uint8_t> vec_may_use;
-  uint8_t *data_ptr{nullptr};
-
-  if (use_buffer) {
-    data_ptr = buffer.data();
-  } else {
-    vec_may_use.resize(bytes);
+  if (!use_buffer) {
+    try {
+      vec_may_use.resize(raw_bytes);
+    } catch (...) {
+      return std::nullopt;
+    }
     data_ptr = vec_may_use.data();
   }
 
-  if (!read_size_correct(is, reinterpret_cast<char *>(data_ptr), bytes)) {
-    return std::nullopt;
+  if (!desc.has_value()) {
+    if (!reader.read(data_ptr, bytes)) {
+      return std::nullopt;
+    }
+  } else {
+    ret.set_encoding(encoding_of(desc.value()));
+    uint32_t crc{0};
+    auto err = internal::decode_segment(
+        ret.encoding(), stored_bytes,
+        [&reader, &crc](std::span<uint8_t> dst) {
+          if (!reader.read(dst.data(), dst.size())) {
+            return false;
+          }
+          crc = internal::crc32c(crc, dst);
+          return true;
+        },
+        {data_ptr, raw_bytes});
+    if (!err.empty()) {
+      return std::nullopt;
+    }
+    if (desc.value().has_checksum() && crc != desc.value().checksum) {
+      return std::nullopt;
+    }
   }
 
   if (use_buffer) {
-    ret.set_variant(std::span<uint8_t>(data_ptr, bytes));
+    ret.set_variant(std::span<uint8_t>(data_ptr, raw_bytes));
   } else {
     ret.set_variant(std::move(vec_may_use));
   }
 
-  if (used_bytes_dest != nullptr) {
-    if (use_buffer) {
-      *used_bytes_dest = bytes;
-    } else {
-      *used_bytes_dest = 0;
+  if (record_bytes_dest != nullptr) {
+    *record_bytes_dest = record_bytes;
+  }
+
+  return ret;
+}
+
+// Reads records until the end of input, the header must have been read.
+template <class reader_t, class buffer_t>
+std::string read_all_records(
+    reader_t &reader, buffer_t &buffer,
+    std::vector<fractal_utils::data_segment> &segments) noexcept {
+  using namespace fractal_utils;
+  uint64_t offset = sizeof(file_header);
+
+  while (true) {
+    if (reader.at_end()) {
+      break;
+    }
+    if (const char *failure = reader.failure(); failure != nullptr) {
+      return failure;
+    }
+
+    uint64_t record_bytes{0};
+    auto seg_opt = read_segment_record(reader, buffer, &record_bytes);
+
+    if (!seg_opt.has_value()) {
+      return fmt::format(
+          "Block {} can not be read. Input may be incomplete, corrupted or "
+          "encoded by an unsupported codec.",
+          segments.size());
+    }
+
+    seg_opt.value().set_offset(offset);
+    offset += record_bytes;
+
+    if (archive_tags::is_reserved(seg_opt.value().tag())) {
+      // metadata records are not segments
+      continue;
+    }
+    try {
+      segments.emplace_back(std::move(seg_opt.value()));
+    } catch (...) {
+      return "Failed to allocate memory";
     }
   }
+  return {};
+}
 
+std::optional<fractal_utils::data_segment> fractal_utils::read_segment_data(
+    std::istream &is, std::span<uint8_t> buffer,
+    size_t *used_bytes_dest) noexcept {
+  stream_reader reader{is};
+  span_buffer buf{buffer.data(), buffer.data() + buffer.size()};
+  auto ret = read_segment_record(reader, buf, nullptr);
+  if (used_bytes_dest != nullptr) {
+    *used_bytes_dest = buf.cur - buffer.data();
+  }
   return ret;
 }
 
@@ -157,64 +416,43 @@ std::string fractal_utils::binary_archive::load(std::istream &is) noexcept {
 std::string fractal_utils::binary_archive::load(
     std::istream &is, std::span<uint8_t> buffer,
     size_t *used_bytes_dest) noexcept {
-  this->m_segments.clear();
+  this->clear_for_loading();
 
   if (!read_val_check(is, this->m_header)) {
     return "Failed to read the header";
   }
 
-  const bool has_buffer = (buffer.size() > 0);
-
-  uint8_t *const buffer_beg = buffer.data();
-  uint8_t *const buffer_end = buffer.data() + buffer.size();
-
-  uint8_t *buffer_cur = buffer_beg;
-
-  // size_t offset = sizeof(this->m_header);
-
-  while (true) {
-    if (is.eof() || is.peek() == EOF) {
-      break;
-    }
-
-    if (is.fail()) {
-      return "The input stream failed (is.fail() == true)";
-    }
-    if (is.bad()) {
-      return "The input stream is bad (is.bad() == true)";
-    }
+  stream_reader reader{is};
+  span_buffer buf{buffer.data(), buffer.data() + buffer.size()};
+  auto err = read_all_records(reader, buf, this->m_segments);
+  if (!err.empty()) {
+    return err;
+  }
 
-    std::optional<fractal_utils::data_segment> seg_opt{std::nullopt};
+  this->build_tag_index();
 
-    if (has_buffer) {
-      size_t used_this_time{0};
-      seg_opt =
-          read_segment_data(is, {buffer_cur, buffer_end}, &used_this_time);
-      buffer_cur += used_this_time;
+  if (used_bytes_dest != nullptr) {
+    *used_bytes_dest = buf.cur - buffer.data();
+  }
 
-    } else {
-      seg_opt = read_segment_data(is);
-    }
+  return {};
+}
 
-    if (!seg_opt.has_value()) {
-      return fmt::format("Block {} can not be read. Input may be incomplete.",
-                         this->m_segments.size());
-    }
+std::string fractal_utils::binary_archive::load(std::istream &is,
+                                                segment_pool &pool) noexcept {
+  this->clear_for_loading();
 
-    // offset += sizeof(int64_t) + sizeof(uint64_t);
-    //  seg_opt.value().set_offset(offset);
-    // offset += seg_opt.value().bytes();
-    this->m_segments.emplace_back(std::move(seg_opt.value()));
+  if (!read_val_check(is, this->m_header)) {
+    return "Failed to read the header";
   }
 
-  if (used_bytes_dest != nullptr) {
-    if (has_buffer) {
-      *used_bytes_dest = buffer_cur - buffer_beg;
-    } else {
-      *used_bytes_dest = 0;
-    }
+  stream_reader reader{is};
+  pool_buffer buf{pool};
+  auto err = read_all_records(reader, buf, this->m_segments);
+  if (!err.empty()) {
+    return err;
   }
-
+  this->build_tag_index();
   return {};
 }
 
@@ -244,6 +482,135 @@ std::string fractal_utils::binary_archive::load(
   return ret;
 }
 
+template <typename T>
+bool read_val_from_memory(const uint8_t *&cur, const uint8_t *end,
+                          T &t) noexcept {
+  if (size_t(end - cur) < sizeof(T)) {
+    return false;
+  }
+  memcpy(&t, cur, sizeof(T));
+  cur += sizeof(T);
+  return true;
+}
+
+std::string fractal_utils::binary_archive::load_from_memory(
+    std::span<const uint8_t> src) noexcept {
+  this->clear_for_loading();
+
+  const uint8_t *cur = src.data();
+  const uint8_t *const end = src.data() + src.size();
+
+  if (!read_val_from_memory(cur, end, this->m_header)) {
+    return "Failed to read the header";
+  }
+
+  while (cur < end) {
+    const uint64_t offset = cur - src.data();
+    int64_t tag;
+    uint64_t bytes{0};
+    if (!read_val_from_memory(cur, end, tag) ||
+        !read_val_from_memory(cur, end, bytes) ||
+        bytes > uint64_t(end - cur)) {
+      return fmt::format("Block {} can not be read. Input may be incomplete.",
+                         this->m_segments.size());
+    }
+
+    if (tag != archive_tags::segment_descriptor) {
+      if (!archive_tags::is_reserved(tag)) {
+        this->m_segments.emplace_back(tag,
+                                      std::span<const uint8_t>(cur, bytes));
+        this->m_segments.back().set_offset(offset);
+      }
+      cur += bytes;
+      continue;
+    }
+
+    segment_descriptor_data desc;
+    if (!descriptor_from_bytes({cur, bytes}, desc)) {
+      return fmt::format("Descriptor of block {} is broken.",
+                         this->m_segments.size());
+    }
+    cur += bytes;
+    if (!read_val_from_memory(cur, end, tag) ||
+        !read_val_from_memory(cur, end, bytes) ||
+        bytes > uint64_t(end - cur) || archive_tags::is_reserved(tag)) {
+      return fmt::format("Block {} can not be read. Input may be incomplete.",
+                         this->m_segments.size());
+    }
+
+    const auto enc = encoding_of(desc);
+    if (enc.is_plain() && bytes == desc.raw_bytes) {
+      // only checksummed, view it in place without checking
+      this->m_segments.emplace_back(tag, std::span<const uint8_t>(cur, bytes));
+      this->m_segments.back().set_offset(offset);
+      cur += bytes;
+      continue;
+    }
+
+    // encoded segments can't be viewed in place, decode them
+    if (desc.has_checksum() &&
+        internal::crc32c(0, {cur, bytes}) != desc.checksum) {
+      return fmt::format("Checksum mismatch in block {}",
+                         this->m_segments.size());
+    }
+    if (desc.raw_bytes > internal::max_decoded_bytes(enc, bytes)) {
+      return fmt::format(
+          "Descriptor of block {} is broken, {} bytes can not decode to {} "
+          "bytes",
+          this->m_segments.size(), bytes, desc.raw_bytes);
+    }
+    std::vector<uint8_t> decoded;
+    try {
+      decoded.resize(desc.raw_bytes);
+    } catch (...) {
+      return fmt::format("Failed to allocate {} bytes for block {}",
+                         desc.raw_bytes, this->m_segments.size());
+    }
+    const uint8_t *encoded = cur;
+    auto err = internal::decode_segment(
+        enc, bytes,
+        [&encoded](std::span<uint8_t> dst) {
+          memcpy(dst.data(), encoded, dst.size());
+          encoded += dst.size();
+          return true;
+        },
+        decoded);
+    if (!err.empty()) {
+      return fmt::format("Failed to decode block {}, detail: {}",
+                         this->m_segments.size(), err);
+    }
+    cur += bytes;
+
+    this->m_segments.emplace_back(tag, std::move(decoded));
+    this->m_segments.back().set_offset(offset);
+    this->m_segments.back().set_encoding(enc);
+  }
+
+  this->build_tag_index();
+  return {};
+}
+
+std::string fractal_utils::binary_archive::load_mapped(
+    std::string_view filename) noexcept {
+  auto mapping = std::make_shared<mapped_file>();
+  {
+    auto err = mapping->open(filename);
+    if (!err.empty()) {
+      this->clear_for_loading();
+      return err;
+    }
+  }
+
+  auto err = this->load_from_memory(mapping->bytes());
+  if (!err.empty()) {
+    // segments parsed so far refer to the mapping that is going to be closed
+    this->clear_for_loading();
+    return err;
+  }
+  this->m_mapping = std::move(mapping);
+  return {};
+}
+
 bool write_size_correct(std::ostream &os, const char *data,
                         size_t bytes) noexcept {
   try {
@@ -259,55 +626,960 @@ bool write_val_correct(std::ostream &os, const T &t) noexcept {
   return write_size_correct(os, reinterpret_cast<const char *>(&t), sizeof(T));
 }
 
-bool fractal_utils::write_segment_data(std::ostream &os,
-                                       const data_segment &ds) noexcept {
+// Writes a segment and its descriptor if it's encoded or checksummed.
+// record_bytes_dest receives the bytes written.
+bool write_segment_record(std::ostream &os,
+                          const fractal_utils::data_segment &ds, bool checksum,
+                          uint64_t *record_bytes_dest) noexcept {
+  using namespace fractal_utils;
   if (!ds.has_data()) {
     return false;
   }
 
-  if (!write_val_correct(os, ds.tag())) {
-    return false;
+  const segment_encoding enc = saved_encoding_of(ds);
+
+  if (enc.is_plain() && !checksum) {
+    if (!write_val_correct(os, ds.tag())) {
+      return false;
+    }
+
+    if (!write_val_correct(os, ds.bytes())) {
+      return false;
+    }
+
+    if (!write_size_correct(os, reinterpret_cast<const char *>(ds.data()),
+                            ds.bytes())) {
+      return false;
+    }
+    if (record_bytes_dest != nullptr) {
+      *record_bytes_dest = record_header_bytes + ds.bytes();
+    }
+    return true;
   }
 
-  if (!write_val_correct(os, ds.bytes())) {
+  segment_descriptor_data desc = descriptor_of(enc, ds.bytes(), checksum);
+  const uint64_t desc_bytes = desc.bytes_in_file();
+
+  const std::span<const uint8_t> src{
+      reinterpret_cast<const uint8_t *>(ds.data()), ds.bytes()};
+  const auto desc_pos = os.tellp();
+  // if seekable, encoded data is streamed out and the descriptor and length
+  // are written again afterwards. Otherwise it's encoded into memory first.
+  const bool streaming =
+      !enc.is_plain() && desc_pos != std::ostream::pos_type(-1);
+
+  std::vector<uint8_t> encoded_data;
+  std::span<const uint8_t> payload;
+  if (enc.is_plain()) {
+    payload = src;
+  } else if (!streaming) {
+    auto err = internal::encode_segment(
+        enc, src, [&encoded_data](std::span<const uint8_t> encoded) {
+          try {
+            encoded_data.insert(encoded_data.end(), encoded.begin(),
+                                encoded.end());
+          } catch (...) {
+            return false;
+          }
+          return true;
+        });
+    if (!err.empty()) {
+      return false;
+    }
+    payload = encoded_data;
+  }
+  if (checksum && !streaming) {
+    desc.checksum = internal::crc32c(0, payload);
+  }
+
+  uint64_t stored_bytes = payload.size();
+  if (!write_val_correct(os, archive_tags::segment_descriptor) ||
+      !write_val_correct(os, desc_bytes) ||
+      !write_size_correct(os, reinterpret_cast<const char *>(&desc),
+                          desc_bytes) ||
+      !write_val_correct(os, ds.tag()) ||
+      !write_val_correct(os, stored_bytes)) {
     return false;
   }
 
-  if (!write_size_correct(os, reinterpret_cast<const char *>(ds.data()),
-                          ds.bytes())) {
+  if (!streaming) {
+    if (!write_size_correct(os, reinterpret_cast<const char *>(payload.data()),
+                            payload.size())) {
+      return false;
+    }
+  } else {
+    uint32_t crc{0};
+    auto err = internal::encode_segment(
+        enc, src, [&os, &stored_bytes, &crc](std::span<const uint8_t> encoded) {
+          stored_bytes += encoded.size();
+          crc = internal::crc32c(crc, encoded);
+          return write_size_correct(
+                     os, reinterpret_cast<const char *>(encoded.data()),
+                     encoded.size()) &&
+                 os.good();
+        });
+    if (!err.empty()) {
+      return false;
+    }
+    desc.checksum = checksum ? crc : 0;
+
+    const auto end_pos = os.tellp();
+    os.seekp(desc_pos + std::streamoff(record_header_bytes));
+    if (!write_size_correct(os, reinterpret_cast<const char *>(&desc),
+                            desc_bytes)) {
+      return false;
+    }
+    os.seekp(desc_pos + std::streamoff(record_header_bytes + desc_bytes +
+                                       sizeof(int64_t)));
+    if (!write_val_correct(os, stored_bytes)) {
+      return false;
+    }
+    os.seekp(end_pos);
+  }
+
+  if (!os.good()) {
     return false;
   }
+  if (record_bytes_dest != nullptr) {
+    *record_bytes_dest = 2 * record_header_bytes + desc_bytes + stored_bytes;
+  }
+  return true;
+}
+
+bool fractal_utils::write_segment_data(std::ostream &os,
+                                       const data_segment &ds) noexcept {
+  return write_segment_record(os, ds, false, nullptr);
+}
+
+namespace {
+struct index_entry {
+  int64_t tag;
+  // offset of the record in file
+  uint64_t offset;
+  // bytes of the whole record, including tag and length
+  uint64_t record_bytes;
+  // bytes of segment data
+  uint64_t data_bytes;
+};
+
+struct index_trailer {
+  uint64_t footer_offset;
+  uint64_t magic;
+};
+
+// "FUARCIDX" in little endian
+constexpr uint64_t index_magic = 0x5844494352415546ULL;
+}  // namespace
+
+#ifndef _WIN32
+namespace {
+bool pread_all(int fd, void *dst, size_t bytes, uint64_t offset) noexcept {
+  uint8_t *cur = reinterpret_cast<uint8_t *>(dst);
+  while (bytes > 0) {
+    const ssize_t got =
+        ::pread(fd, cur, std::min<size_t>(bytes, size_t(1) << 30), offset);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    cur += got;
+    bytes -= got;
+    offset += got;
+  }
+  return true;
+}
+
+bool pwrite_all(int fd, const void *src, size_t bytes,
+                uint64_t offset) noexcept {
+  const uint8_t *cur = reinterpret_cast<const uint8_t *>(src);
+  while (bytes > 0) {
+    const ssize_t put =
+        ::pwrite(fd, cur, std::min<size_t>(bytes, size_t(1) << 30), offset);
+    if (put < 0 && errno == EINTR) {
+      continue;
+    }
+    if (put <= 0) {
+      return false;
+    }
+    cur += put;
+    bytes -= put;
+    offset += put;
+  }
   return true;
 }
 
+// reads through pread, so any number of readers can share one descriptor
+struct fd_reader {
+  int fd;
+  uint64_t pos;
+  // size of the file
+  uint64_t size;
+
+  bool read(void *dst, size_t bytes) noexcept {
+    if (!pread_all(this->fd, dst, bytes, this->pos)) {
+      return false;
+    }
+    this->pos += bytes;
+    return true;
+  }
+  void skip(uint64_t bytes) noexcept { this->pos += bytes; }
+  bool has_left(uint64_t bytes) const noexcept {
+    return this->pos <= this->size && bytes <= this->size - this->pos;
+  }
+  bool at_end() const noexcept { return this->pos >= this->size; }
+  const char *failure() const noexcept { return nullptr; }
+};
+
+// Run task(0), ..., task(task_num - 1) on at most `threads` threads, the
+// calling thread included. Returns false if any task returned false; the
+// remaining tasks are skipped then.
+template <class task_t>
+bool run_in_parallel(int threads, size_t task_num,
+                     const task_t &task) noexcept {
+  std::atomic<size_t> next{0};
+  std::atomic<bool> ok{true};
+  auto worker = [&]() {
+    while (ok.load(std::memory_order_relaxed)) {
+      const size_t idx = next.fetch_add(1);
+      if (idx >= task_num) {
+        return;
+      }
+      if (!task(idx)) {
+        ok = false;
+      }
+    }
+  };
+
+  const size_t thread_num =
+      std::min<size_t>(std::max(threads, 1), std::max<size_t>(task_num, 1));
+  std::vector<std::thread> pool;
+  try {
+    pool.reserve(thread_num - 1);
+    for (size_t t = 1; t < thread_num; t++) {
+      pool.emplace_back(worker);
+    }
+  } catch (...) {
+    // run with the threads we got
+  }
+  worker();
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  return ok;
+}
+}  // namespace
+#endif
+
+struct fractal_utils::internal::archive_source {
+  std::mutex lock;
+  std::ifstream ifs;
+#ifndef _WIN32
+  // segments are read with pread, without taking the lock
+  int fd{-1};
+  uint64_t file_size{0};
+
+  ~archive_source() {
+    if (this->fd >= 0) {
+      ::close(this->fd);
+    }
+  }
+#endif
+};
+
+std::string fractal_utils::binary_archive::load(std::string_view filename,
+                                                segment_pool &pool) noexcept {
+#ifndef _WIN32
+  // plain descriptor I/O, an ifstream would allocate its own buffer
+  this->clear_for_loading();
+  const int fd = ::open(std::string{filename}.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return fmt::format("Failed to get the size of {}", filename);
+  }
+
+  fd_reader reader{fd, 0, uint64_t(st.st_size)};
+  std::string err;
+  if (!read_val(reader, this->m_header)) {
+    err = "Failed to read the header";
+  } else {
+    pool_buffer buf{pool};
+    err = read_all_records(reader, buf, this->m_segments);
+  }
+  ::close(fd);
+  if (!err.empty()) {
+    return err;
+  }
+  this->build_tag_index();
+  return {};
+#else
+  std::ifstream ifs{std::string{filename}, std::ios::binary};
+  if (!ifs) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+  return this->load(ifs, pool);
+#endif
+}
+
+void fractal_utils::binary_archive::clear_for_loading() noexcept {
+  this->m_segments.clear();
+  this->m_mapping.reset();
+  this->m_source.reset();
+  this->m_tag_index.clear();
+  this->m_tag_index_valid = false;
+}
+
 std::string fractal_utils::binary_archive::save(
     std::ostream &os) const noexcept {
+  return this->save(os, archive_save_options{});
+}
+
+std::string fractal_utils::binary_archive::save(
+    std::ostream &os, const archive_save_options &opt) const noexcept {
   if (!write_val_correct(os, this->m_header)) {
     return "Failed to write header";
   }
 
+  std::vector<index_entry> entries;
+  if (opt.write_index) {
+    entries.reserve(this->m_segments.size());
+  }
+  uint64_t offset = sizeof(this->m_header);
+
   for (size_t idx = 0; idx < this->m_segments.size(); idx++) {
-    if (!write_segment_data(os, this->m_segments[idx])) {
+    const auto &seg = this->m_segments[idx];
+    if (archive_tags::is_reserved(seg.tag())) {
+      return fmt::format("Tag {} of segment {} is reserved by the format.",
+                         seg.tag(), idx);
+    }
+    uint64_t record_bytes{0};
+    if (!write_segment_record(os, seg, opt.write_checksum, &record_bytes)) {
       return fmt::format("Failed to write segment {}", idx);
     }
+    if (opt.write_index) {
+      entries.emplace_back(
+          index_entry{seg.tag(), offset, record_bytes, seg.bytes()});
+    }
+    offset += record_bytes;
+  }
+
+  if (!opt.write_index) {
+    return {};
+  }
+
+  const uint64_t entry_count = entries.size();
+  const uint64_t footer_bytes = sizeof(entry_count) +
+                                entry_count * sizeof(index_entry) +
+                                sizeof(index_trailer);
+  const index_trailer trailer{offset, index_magic};
+  if (!write_val_correct(os, archive_tags::index_footer) ||
+      !write_val_correct(os, footer_bytes) ||
+      !write_val_correct(os, entry_count) ||
+      !write_size_correct(os, reinterpret_cast<const char *>(entries.data()),
+                          entry_count * sizeof(index_entry)) ||
+      !write_val_correct(os, trailer)) {
+    return "Failed to write index footer";
   }
   return {};
 }
 
 std::string fractal_utils::binary_archive::save(
     std::string_view filename) const noexcept {
+  return this->save(filename, archive_save_options{});
+}
+
+std::string fractal_utils::binary_archive::save(
+    std::string_view filename,
+    const archive_save_options &opt) const noexcept {
+#ifndef _WIN32
+  if (opt.threads > 1) {
+    return this->impl_save_parallel(filename, opt);
+  }
+#endif
   std::ofstream ofs{filename.data(), std::ios::binary};
 
   if (!ofs) {
     return fmt::format("Failed to open or create {}.", filename);
   }
-  auto ret = this->save(ofs);
+  auto ret = this->save(ofs, opt);
   ofs.close();
   return ret;
 }
 
+// Try to read the index footer. Returns false if the file doesn't have a valid
+// one, and the caller should walk the records instead.
+bool read_index_footer(std::istream &is, uint64_t file_size,
+                       std::vector<index_entry> &entries) noexcept {
+  constexpr uint64_t min_footer_record =
+      record_header_bytes + sizeof(uint64_t) + sizeof(index_trailer);
+  if (file_size < sizeof(fractal_utils::file_header) + min_footer_record) {
+    return false;
+  }
+
+  index_trailer trailer;
+  is.seekg(file_size - sizeof(index_trailer));
+  if (!read_val_check(is, trailer) || trailer.magic != index_magic) {
+    is.clear();
+    return false;
+  }
+  if (trailer.footer_offset < sizeof(fractal_utils::file_header) ||
+      trailer.footer_offset + min_footer_record > file_size) {
+    return false;
+  }
+
+  int64_t tag;
+  uint64_t footer_bytes;
+  uint64_t entry_count;
+  is.seekg(trailer.footer_offset);
+  if (!read_val_check(is, tag) || !read_val_check(is, footer_bytes) ||
+      !read_val_check(is, entry_count)) {
+    is.clear();
+    return false;
+  }
+  if (tag != fractal_utils::archive_tags::index_footer ||
+      trailer.footer_offset + record_header_bytes + footer_bytes !=
+          file_size ||
+      entry_count > footer_bytes / sizeof(index_entry) ||
+      footer_bytes != sizeof(entry_count) + entry_count * sizeof(index_entry) +
+                          sizeof(index_trailer)) {
+    return false;
+  }
+
+  entries.resize(entry_count);
+  if (!read_size_correct(is, reinterpret_cast<char *>(entries.data()),
+                         entry_count * sizeof(index_entry))) {
+    is.clear();
+    return false;
+  }
+
+  for (const auto &entry : entries) {
+    if (entry.offset < sizeof(fractal_utils::file_header) ||
+        entry.record_bytes < record_header_bytes ||
+        entry.offset + entry.record_bytes > trailer.footer_offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string fractal_utils::binary_archive::open_indexed(
+    std::string_view filename) noexcept {
+  this->clear_for_loading();
+
+  auto src = std::make_shared<internal::archive_source>();
+  auto &ifs = src->ifs;
+  ifs.open(std::string{filename}, std::ios::binary);
+  if (!ifs) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+#ifndef _WIN32
+  src->fd = ::open(std::string{filename}.c_str(), O_RDONLY);
+  if (src->fd < 0) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+#endif
+
+  if (!read_val_check(ifs, this->m_header)) {
+    return "Failed to read the header";
+  }
+
+  ifs.seekg(0, std::ios::end);
+  const uint64_t file_size = ifs.tellg();
+#ifndef _WIN32
+  src->file_size = file_size;
+#endif
+
+  std::vector<index_entry> entries;
+  if (read_index_footer(ifs, file_size, entries)) {
+    this->m_segments.reserve(entries.size());
+    for (const auto &entry : entries) {
+      this->m_segments.emplace_back(
+          entry.tag, data_segment::segment_length{entry.data_bytes});
+      this->m_segments.back().set_offset(entry.offset);
+    }
+  } else {
+    // no index, walk the record headers and skip all data
+    uint64_t offset = sizeof(this->m_header);
+    while (offset < file_size) {
+      int64_t tag;
+      uint64_t bytes;
+      uint64_t record_end;
+      std::optional<segment_descriptor_data> desc{std::nullopt};
+      ifs.seekg(offset);
+      bool ok = read_val_check(ifs, tag) && read_val_check(ifs, bytes) &&
+                bytes <= file_size - offset - record_header_bytes;
+      record_end = offset + record_header_bytes + bytes;
+      if (ok && tag == archive_tags::segment_descriptor) {
+        desc.emplace();
+        stream_reader reader{ifs};
+        ok = read_descriptor(reader, bytes, desc.value());
+        ifs.seekg(record_end);
+        ok = ok && read_val_check(ifs, tag) && read_val_check(ifs, bytes) &&
+             !archive_tags::is_reserved(tag) &&
+             bytes <= file_size - record_end - record_header_bytes;
+        record_end += record_header_bytes + bytes;
+      }
+      if (!ok) {
+        this->clear_for_loading();
+        return fmt::format(
+            "Block {} can not be read. Input may be incomplete.",
+            this->m_segments.size());
+      }
+      if (!archive_tags::is_reserved(tag)) {
+        const uint64_t raw_bytes =
+            desc.has_value() ? desc.value().raw_bytes : bytes;
+        this->m_segments.emplace_back(tag,
+                                      data_segment::segment_length{raw_bytes});
+        this->m_segments.back().set_offset(offset);
+        if (desc.has_value()) {
+          this->m_segments.back().set_encoding(encoding_of(desc.value()));
+        }
+      }
+      offset = record_end;
+    }
+  }
+
+  this->m_source = std::move(src);
+  this->build_tag_index();
+  return {};
+}
+
+std::string fractal_utils::binary_archive::fetch(data_segment &seg) noexcept {
+  if (seg.has_data()) {
+    return {};
+  }
+  if (&seg < this->m_segments.data() ||
+      &seg >= this->m_segments.data() + this->m_segments.size()) {
+    return "The segment doesn't belong to this archive";
+  }
+  if (this->m_source == nullptr) {
+    return "The archive is not opened by open_indexed";
+  }
+
+  std::optional<data_segment> loaded;
+#ifndef _WIN32
+  {
+    fd_reader reader{this->m_source->fd, seg.offset(),
+                     this->m_source->file_size};
+    no_buffer buf;
+    loaded = read_segment_record(reader, buf, nullptr);
+  }
+#else
+  {
+    std::lock_guard<std::mutex> lkgd{this->m_source->lock};
+    auto &ifs = this->m_source->ifs;
+    ifs.clear();
+    ifs.seekg(seg.offset());
+    loaded = read_segment_data(ifs);
+  }
+#endif
+
+  if (!loaded.has_value() || loaded.value().tag() != seg.tag() ||
+      loaded.value().bytes() != seg.bytes()) {
+    return fmt::format(
+        "Failed to fetch segment with tag {} at offset {}. The file may be "
+        "modified or incomplete.",
+        seg.tag(), seg.offset());
+  }
+  seg.variant() = std::move(loaded.value().variant());
+  seg.set_encoding(loaded.value().encoding());
+  return {};
+}
+
+std::string fractal_utils::binary_archive::fetch_all() noexcept {
+  return this->fetch_all(1);
+}
+
+std::string fractal_utils::binary_archive::fetch_all(int threads) noexcept {
+#ifndef _WIN32
+  if (threads > 1) {
+    std::vector<std::string> errors;
+    try {
+      errors.resize(this->m_segments.size());
+    } catch (...) {
+      return "Failed to allocate memory";
+    }
+    const bool ok = run_in_parallel(
+        threads, this->m_segments.size(), [this, &errors](size_t idx) {
+          errors[idx] = this->fetch(this->m_segments[idx]);
+          return errors[idx].empty();
+        });
+    if (!ok) {
+      for (auto &err : errors) {
+        if (!err.empty()) {
+          return std::move(err);
+        }
+      }
+    }
+    return {};
+  }
+#endif
+  for (auto &seg : this->m_segments) {
+    auto err = this->fetch(seg);
+    if (!err.empty()) {
+      return err;
+    }
+  }
+  return {};
+}
+
+std::string fractal_utils::binary_archive::load_parallel(
+    std::string_view filename, int threads) noexcept {
+  auto err = this->open_indexed(filename);
+  if (!err.empty()) {
+    return err;
+  }
+  err = this->fetch_all(threads);
+  if (!err.empty()) {
+    this->clear_for_loading();
+    return err;
+  }
+  // every segment owns its data now
+  this->m_source.reset();
+  return {};
+}
+
+std::string fractal_utils::binary_archive::verify(
+    std::string_view filename) noexcept {
+  return verify(filename, nullptr);
+}
+
+std::string fractal_utils::binary_archive::verify(
+    std::string_view filename, archive_verify_stats *stats_nullable) noexcept {
+  std::ifstream ifs{std::string{filename}, std::ios::binary};
+  if (!ifs) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+  file_header header;
+  if (!read_val_check(ifs, header)) {
+    return "Failed to read the header";
+  }
+  ifs.seekg(0, std::ios::end);
+  const uint64_t file_size = ifs.tellg();
+
+  archive_verify_stats stats;
+  // checksummed data is streamed through this buffer, segments are never
+  // held in memory
+  std::vector<uint8_t> buffer;
+  uint64_t offset = sizeof(header);
+  while (offset < file_size) {
+    int64_t tag;
+    uint64_t bytes;
+    segment_descriptor_data desc;
+    bool has_desc{false};
+
+    ifs.seekg(offset);
+    bool ok = read_val_check(ifs, tag) && read_val_check(ifs, bytes) &&
+              bytes <= file_size - offset - record_header_bytes;
+    uint64_t data_offset = offset + record_header_bytes;
+    if (ok && tag == archive_tags::segment_descriptor) {
+      stream_reader reader{ifs};
+      has_desc = read_descriptor(reader, bytes, desc);
+      data_offset += bytes;
+      ifs.seekg(data_offset);
+      ok = has_desc && read_val_check(ifs, tag) &&
+           read_val_check(ifs, bytes) && !archive_tags::is_reserved(tag) &&
+           bytes <= file_size - data_offset - record_header_bytes;
+      data_offset += record_header_bytes;
+    }
+    if (!ok) {
+      return fmt::format("Block {} can not be read. Input may be incomplete.",
+                         stats.segments);
+    }
+    offset = data_offset + bytes;
+    if (archive_tags::is_reserved(tag)) {
+      continue;
+    }
+
+    if (has_desc && desc.has_checksum()) {
+      try {
+        buffer.resize(std::min<uint64_t>(bytes, internal::codec_chunk_bytes));
+      } catch (...) {
+        return "Failed to allocate memory";
+      }
+      uint32_t crc{0};
+      for (uint64_t done = 0; done < bytes;) {
+        const size_t len = std::min<uint64_t>(bytes - done, buffer.size());
+        if (!read_size_correct(ifs, reinterpret_cast<char *>(buffer.data()),
+                               len)) {
+          return fmt::format("Failed to read block {}", stats.segments);
+        }
+        crc = internal::crc32c(crc, {buffer.data(), len});
+        done += len;
+      }
+      if (crc != desc.checksum) {
+        return fmt::format("Checksum mismatch in block {} with tag {}",
+                           stats.segments, tag);
+      }
+      stats.checksummed_segments++;
+    }
+    stats.segments++;
+  }
+
+  std::vector<index_entry> entries;
+  ifs.clear();
+  stats.indexed = read_index_footer(ifs, file_size, entries) &&
+                  entries.size() == stats.segments;
+
+  if (stats_nullable != nullptr) {
+    *stats_nullable = stats;
+  }
+  return {};
+}
+
+#ifndef _WIN32
+namespace {
+// A record encoded into memory, waiting to be written at its offset.
+struct prepared_record {
+  // descriptor record if encoded, tag and length
+  std::vector<uint8_t> head;
+  std::vector<uint8_t> encoded;
+  // segment data, or encoded if the segment is encoded
+  std::span<const uint8_t> payload;
+  uint64_t offset{0};
+
+  template <typename T>
+  void append(const T &t) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&t);
+    this->head.insert(this->head.end(), p, p + sizeof(T));
+  }
+
+  [[nodiscard]] uint64_t bytes() const noexcept {
+    return this->head.size() + this->payload.size();
+  }
+};
+
+// Lays out the same bytes as write_segment_record.
+bool prepare_record(const fractal_utils::data_segment &ds, bool checksum,
+                    prepared_record &rec) noexcept {
+  using namespace fractal_utils;
+  if (!ds.has_data()) {
+    return false;
+  }
+  const segment_encoding enc = saved_encoding_of(ds);
+  const std::span<const uint8_t> src{
+      reinterpret_cast<const uint8_t *>(ds.data()), ds.bytes()};
+
+  try {
+    if (enc.is_plain() && !checksum) {
+      rec.append(ds.tag());
+      rec.append(ds.bytes());
+      rec.payload = src;
+      return true;
+    }
+
+    if (enc.is_plain()) {
+      rec.payload = src;
+    } else {
+      auto err = internal::encode_segment(
+          enc, src, [&rec](std::span<const uint8_t> encoded) {
+            try {
+              rec.encoded.insert(rec.encoded.end(), encoded.begin(),
+                                 encoded.end());
+            } catch (...) {
+              return false;
+            }
+            return true;
+          });
+      if (!err.empty()) {
+        return false;
+      }
+      rec.payload = rec.encoded;
+    }
+
+    segment_descriptor_data desc = descriptor_of(enc, ds.bytes(), checksum);
+    if (checksum) {
+      desc.checksum = internal::crc32c(0, rec.payload);
+    }
+    const uint64_t desc_bytes = desc.bytes_in_file();
+    rec.append(archive_tags::segment_descriptor);
+    rec.append(desc_bytes);
+    const uint8_t *desc_ptr = reinterpret_cast<const uint8_t *>(&desc);
+    rec.head.insert(rec.head.end(), desc_ptr, desc_ptr + desc_bytes);
+    rec.append(ds.tag());
+    rec.append(uint64_t(rec.payload.size()));
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+std::string fractal_utils::binary_archive::impl_save_parallel(
+    std::string_view filename, const archive_save_options &opt) const noexcept {
+  const size_t seg_num = this->m_segments.size();
+  for (size_t idx = 0; idx < seg_num; idx++) {
+    const auto &seg = this->m_segments[idx];
+    if (archive_tags::is_reserved(seg.tag())) {
+      return fmt::format("Tag {} of segment {} is reserved by the format.",
+                         seg.tag(), idx);
+    }
+    if (!seg.has_data()) {
+      return fmt::format("Failed to write segment {}", idx);
+    }
+  }
+
+  std::vector<prepared_record> records;
+  std::vector<index_entry> entries;
+  std::vector<uint8_t> footer;
+  // pieces of the file written by workers, large payloads are split up
+  std::vector<std::pair<uint64_t, std::span<const uint8_t>>> pieces;
+  constexpr size_t piece_bytes = size_t(1) << 24;
+
+  try {
+    records.resize(seg_num);
+    // encode concurrently, the offsets depend on the encoded lengths
+    if (!run_in_parallel(
+            opt.threads, seg_num, [this, &opt, &records](size_t idx) {
+              return prepare_record(this->m_segments[idx], opt.write_checksum,
+                                    records[idx]);
+            })) {
+      return "Failed to encode segments";
+    }
+
+    uint64_t offset = sizeof(this->m_header);
+    pieces.emplace_back(
+        0, std::span<const uint8_t>{
+               reinterpret_cast<const uint8_t *>(&this->m_header),
+               sizeof(this->m_header)});
+    for (size_t idx = 0; idx < seg_num; idx++) {
+      auto &rec = records[idx];
+      rec.offset = offset;
+      pieces.emplace_back(offset, rec.head);
+      for (size_t p = 0; p < rec.payload.size(); p += piece_bytes) {
+        pieces.emplace_back(
+            offset + rec.head.size() + p,
+            rec.payload.subspan(
+                p, std::min(piece_bytes, rec.payload.size() - p)));
+      }
+      if (opt.write_index) {
+        const auto &seg = this->m_segments[idx];
+        entries.emplace_back(
+            index_entry{seg.tag(), offset, rec.bytes(), seg.bytes()});
+      }
+      offset += rec.bytes();
+    }
+
+    if (opt.write_index) {
+      const uint64_t entry_count = entries.size();
+      const uint64_t footer_bytes = sizeof(entry_count) +
+                                    entry_count * sizeof(index_entry) +
+                                    sizeof(index_trailer);
+      const index_trailer trailer{offset, index_magic};
+      prepared_record footer_rec;
+      footer_rec.append(archive_tags::index_footer);
+      footer_rec.append(footer_bytes);
+      footer_rec.append(entry_count);
+      const uint8_t *entry_ptr =
+          reinterpret_cast<const uint8_t *>(entries.data());
+      footer_rec.head.insert(footer_rec.head.end(), entry_ptr,
+                             entry_ptr + entry_count * sizeof(index_entry));
+      footer_rec.append(trailer);
+      footer = std::move(footer_rec.head);
+      pieces.emplace_back(offset, footer);
+    }
+  } catch (...) {
+    return "Failed to allocate memory";
+  }
+
+  const int fd = ::open(std::string{filename}.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    return fmt::format("Failed to open or create {}.", filename);
+  }
+
+  const bool write_ok =
+      run_in_parallel(opt.threads, pieces.size(), [fd, &pieces](size_t idx) {
+        const auto &[offset, bytes] = pieces[idx];
+        return pwrite_all(fd, bytes.data(), bytes.size(), offset);
+      });
+  const bool close_ok = (::close(fd) == 0);
+  if (!write_ok || !close_ok) {
+    return fmt::format("Failed to write {}", filename);
+  }
+  return {};
+}
+#endif
+
+namespace {
+// slot_count is a power of 2
+inline size_t tag_slot_of(int64_t tag, size_t slot_count) noexcept {
+  // fibonacci hashing, consecutive tags spread over the table
+  return size_t((uint64_t(tag) * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (slot_count - 1);
+}
+}  // namespace
+
+void fractal_utils::binary_archive::build_tag_index() noexcept {
+  this->m_tag_index_valid = false;
+  // at most half full
+  const size_t slot_count =
+      std::bit_ceil(std::max<size_t>(2 * this->m_segments.size(), 8));
+  try {
+    this->m_tag_index.assign(slot_count, tag_index_slot{0, 0, 0, false});
+  } catch (...) {
+    // lookups fall back to linear search
+    this->m_tag_index.clear();
+    return;
+  }
+
+  for (size_t i = 0; i < this->m_segments.size(); i++) {
+    const int64_t tag = this->m_segments[i].tag();
+    size_t slot = tag_slot_of(tag, slot_count);
+    while (this->m_tag_index[slot].used && this->m_tag_index[slot].tag != tag) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    auto &entry = this->m_tag_index[slot];
+    if (entry.used) {
+      entry.last = i;
+    } else {
+      entry = tag_index_slot{tag, i, i, true};
+    }
+  }
+  this->m_tag_index_segments = this->m_segments.size();
+  this->m_tag_index_valid = true;
+}
+
+bool fractal_utils::binary_archive::tag_index_usable() const noexcept {
+  // segments may have been added or removed through a reference returned by
+  // segments() before this lookup
+  return this->m_tag_index_valid &&
+         this->m_tag_index_segments == this->m_segments.size();
+}
+
+const fractal_utils::binary_archive::tag_index_slot *
+fractal_utils::binary_archive::find_tag_slot(int64_t tag) const noexcept {
+  const size_t slot_count = this->m_tag_index.size();
+  size_t slot = tag_slot_of(tag, slot_count);
+  while (this->m_tag_index[slot].used) {
+    if (this->m_tag_index[slot].tag == tag) {
+      return &this->m_tag_index[slot];
+    }
+    slot = (slot + 1) & (slot_count - 1);
+  }
+  return nullptr;
+}
+
 std::optional<size_t> fractal_utils::binary_archive::impl_find_first_of(
     int64_t tag) const noexcept {
+  if (this->tag_index_usable()) {
+    const auto *slot = this->find_tag_slot(tag);
+    if (slot == nullptr) {
+      return std::nullopt;
+    }
+    const size_t idx = slot->first;
+    if (idx < this->m_segments.size() &&
+        this->m_segments[idx].tag() == tag) {
+      return idx;
+    }
+    // a segment was retagged since the index was built
+  }
+
   for (size_t i = 0; i < this->m_segments.size(); i++) {
     if (this->m_segments[i].tag() == tag) {
       return i;
@@ -318,6 +1590,19 @@ std::optional<size_t> fractal_utils::binary_archive::impl_find_first_of(
 
 std::optional<size_t> fractal_utils::binary_archive::impl_find_last_of(
     int64_t tag) const noexcept {
+  if (this->tag_index_usable()) {
+    const auto *slot = this->find_tag_slot(tag);
+    if (slot == nullptr) {
+      return std::nullopt;
+    }
+    const size_t idx = slot->last;
+    if (idx < this->m_segments.size() &&
+        this->m_segments[idx].tag() == tag) {
+      return idx;
+    }
+    // a segment was retagged since the index was built
+  }
+
   for (ptrdiff_t i = this->m_segments.size() - 1; i >= 0; i--) {
     if (this->m_segments[i].tag() == tag) {
       return i;
@@ -328,6 +1613,9 @@ std::optional<size_t> fractal_utils::binary_archive::impl_find_last_of(
 
 fractal_utils::data_segment *fractal_utils::binary_archive::find_first_of(
     int64_t tag) noexcept {
+  if (!this->tag_index_usable()) {
+    this->build_tag_index();
+  }
   auto opt = this->impl_find_first_of(tag);
   if (opt.has_value()) {
     return &this->m_segments[opt.value()];
@@ -345,6 +1633,9 @@ const fractal_utils::data_segment *fractal_utils::binary_archive::find_first_of(
 
 fractal_utils::data_segment *fractal_utils::binary_archive::find_last_of(
     int64_t tag) noexcept {
+  if (!this->tag_index_usable()) {
+    this->build_tag_index();
+  }
   auto opt = this->impl_find_last_of(tag);
   if (opt.has_value()) {
     return &this->m_segments[opt.value()];
@@ -359,4 +1650,4 @@ const fractal_utils::data_segment *fractal_utils::binary_archive::find_last_of(
     return &this->m_segments[opt.value()];
   }
   return nullptr;
-}
\ No newline at end of file
+}
@@ -22,16 +22,38 @@ This file is part of FractalUtils.
 #define FRACTALUTILS_COREUTILS_BINARCHIVE_H
 
 #include <istream>
+#include <memory>
 #include <optional>
 #include <ostream>
 #include <span>
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 namespace fractal_utils {
 
+class mapped_file;
+class segment_pool;
+
+// Tags in [INT64_MIN, INT64_MIN + 255] are reserved for metadata records of
+// the archive format itself. They are never exposed as segments.
+namespace archive_tags {
+constexpr int64_t reserved_min = INT64_MIN;
+constexpr int64_t reserved_max = INT64_MIN + 255;
+
+// index footer, see binary_archive::save
+constexpr int64_t index_footer = reserved_min;
+// describes how the following segment is encoded
+constexpr int64_t segment_descriptor = reserved_min + 1;
+
+constexpr bool is_reserved(int64_t tag) noexcept {
+  return tag >= reserved_min && tag <= reserved_max;
+}
+}  // namespace archive_tags
+
 struct file_header {
   file_header();
 
@@ -45,6 +67,30 @@ struct file_header {
   bool is_valid() const noexcept;
 };
 
+enum class segment_codec : uint8_t {
+  identity = 0,
+  deflate = 1,
+  zstd = 2,
+};
+
+// Whether the codec is compiled into this build. Saving with an unsupported
+// codec falls back to identity, loading such a segment fails.
+bool is_codec_supported(segment_codec codec) noexcept;
+
+struct segment_encoding {
+  segment_codec codec{segment_codec::identity};
+  // Store each element of this many bytes as the difference to the previous
+  // one before compressing, which suits smooth integer maps such as iteration
+  // counts. 0 disables it, otherwise it must be 1, 2, 4 or 8.
+  uint8_t delta_width{0};
+  // compression level, 0 means the default of the codec. Not saved in file.
+  int8_t level{0};
+
+  [[nodiscard]] inline bool is_plain() const noexcept {
+    return this->codec == segment_codec::identity && this->delta_width == 0;
+  }
+};
+
 class data_segment {
  public:
   struct segment_length {
@@ -56,7 +102,10 @@ class data_segment {
  private:
   int64_t m_tag{INT64_MAX};
   variant_t m_variant;
-  // uint64_t m_offset{0};
+  // offset of this record in the file, only meaningful for loaded segments
+  uint64_t m_offset{0};
+  // how the data is stored in file, the data in memory is always decoded
+  segment_encoding m_encoding;
 
  public:
   data_segment() = default;
@@ -65,9 +114,17 @@ class data_segment {
 
   inline int64_t tag() const noexcept { return this->m_tag; }
   inline void set_tag(int64_t _tag) noexcept { this->m_tag = _tag; }
-  // inline uint64_t offset() const noexcept { return this->m_offset; }
-  // inline void set_offset(uint64_t _offset) noexcept {    this->m_offset =
-  // _offset;  }
+  inline uint64_t offset() const noexcept { return this->m_offset; }
+  inline void set_offset(uint64_t _offset) noexcept {
+    this->m_offset = _offset;
+  }
+
+  inline const segment_encoding &encoding() const noexcept {
+    return this->m_encoding;
+  }
+  inline void set_encoding(const segment_encoding &enc) noexcept {
+    this->m_encoding = enc;
+  }
 
   inline const auto &variant() const noexcept { return this->m_variant; }
   inline auto &variant() noexcept { return this->m_variant; }
@@ -96,17 +153,81 @@ std::optional<data_segment> read_segment_data(std::istream &is,
 
 bool write_segment_data(std::ostream &os, const data_segment &) noexcept;
 
+struct archive_save_options {
+  // Append an index footer holding the tag, offset and length of every
+  // segment, so that binary_archive::open_indexed can locate segments without
+  // reading the whole file. Readers that don't know the footer see it as an
+  // ordinary segment with a reserved tag.
+  bool write_index{false};
+  // Threads used when saving to a file. With more than one, segments are
+  // encoded concurrently, their offsets are computed from the encoded lengths
+  // and then they are written with pwrite to one file descriptor. The file is
+  // identical to the one written by a single thread, but encoded segments are
+  // held in memory until written. Ignored when saving to a stream, or on
+  // platforms without pwrite.
+  int threads{1};
+  // Store a crc32c checksum of every segment, see binary_archive::verify.
+  // Segments are checked when they are read by load, load_parallel or fetch,
+  // except plain segments viewed in place by load_mapped.
+  bool write_checksum{false};
+};
+
+struct archive_verify_stats {
+  // segments in the archive, metadata records excluded
+  size_t segments{0};
+  // segments whose checksum has been checked
+  size_t checksummed_segments{0};
+  // The file ends with a valid index footer listing exactly this many
+  // segments. Checksums can't tell if records are missing at the end of a
+  // truncated file, the footer can.
+  bool indexed{false};
+
+  [[nodiscard]] inline bool fully_checksummed() const noexcept {
+    return this->segments == this->checksummed_segments;
+  }
+};
+
+namespace internal {
+struct archive_source;
+}
+
 class binary_archive {
  private:
   file_header m_header;
   std::vector<data_segment> m_segments;
+  // keeps the file mapped while segments refer to it
+  std::shared_ptr<const mapped_file> m_mapping{nullptr};
+  // file opened by open_indexed, segments are fetched from it on demand
+  std::shared_ptr<internal::archive_source> m_source{nullptr};
+
+  struct tag_index_slot {
+    int64_t tag;
+    // indices of the first and last segment with this tag
+    size_t first;
+    size_t last;
+    bool used;
+  };
+  // Open addressing hash table from tag to segments. It's a flat vector, so
+  // rebuilding it for the next archive loaded reuses its memory.
+  std::vector<tag_index_slot> m_tag_index;
+  bool m_tag_index_valid{false};
+  // number of segments when the index was built
+  size_t m_tag_index_segments{0};
 
  public:
   auto &header() noexcept { return this->m_header; }
   const auto &header() const noexcept { return this->m_header; }
   void set_header(const file_header &fh) noexcept { this->m_header = fh; }
 
-  auto &segments() noexcept { return this->m_segments; }
+  // Mutable access may reorder or retag segments, so it drops the tag index
+  // used by find_first_of/find_last_of. The index is rebuilt by the next
+  // non-const lookup. Lookups made while the returned reference is still
+  // used to add or remove segments are checked against the segments, and
+  // fall back to a linear search if the index is out of date.
+  auto &segments() noexcept {
+    this->m_tag_index_valid = false;
+    return this->m_segments;
+  }
   const auto &segments() const noexcept { return this->m_segments; }
 
   std::string load(std::istream &is) noexcept;
@@ -117,9 +238,62 @@ class binary_archive {
   std::string load(std::string_view filename, std::span<uint8_t> buffer,
                    size_t *used_bytes_dest) noexcept;
 
+  // Load with segment data carved from pool. Segments are views into the
+  // pool, so it must not be reset or destroyed while they are in use. Reset
+  // the pool before loading the next archive into it; once the pool and this
+  // archive have grown to fit, loading plain segments from a file allocates
+  // nothing on heap. Encoded segments still need the state of their codec.
+  std::string load(std::istream &is, segment_pool &pool) noexcept;
+  std::string load(std::string_view filename, segment_pool &pool) noexcept;
+
+  // Parse an archive that is already in memory. Segments are views into src,
+  // so src must outlive them.
+  std::string load_from_memory(std::span<const uint8_t> src) noexcept;
+  // Map the file into memory and parse it in place. Segments are read-only
+  // views into the mapping, which lives as long as this archive (or any copy
+  // of it) does. Segment data is only read from disk when touched.
+  std::string load_mapped(std::string_view filename) noexcept;
+
+  [[nodiscard]] inline bool is_mapped() const noexcept {
+    return this->m_mapping != nullptr;
+  }
+
+  // Only read the header and the segment table. If the file has an index
+  // footer, it is the only thing read; otherwise record headers are walked
+  // without reading any segment data. Segments hold their length only
+  // (has_data() == false) until they are fetched.
+  std::string open_indexed(std::string_view filename) noexcept;
+
+  // Read the data of a segment found in an archive opened by open_indexed.
+  // Segments that already have data are left untouched.
+  std::string fetch(data_segment &seg) noexcept;
+  std::string fetch_all() noexcept;
+  // Fetch segments with this many threads, each reading with pread.
+  std::string fetch_all(int threads) noexcept;
+
+  // Load the whole file with this many threads: the segment table is read as
+  // open_indexed does, then segments are read and decoded concurrently.
+  std::string load_parallel(std::string_view filename, int threads) noexcept;
+
+  // Check the structure of an archive and the checksums of its segments
+  // without loading it. Data of checksummed segments is streamed through a
+  // small buffer, other segments are skipped. Returns the first problem
+  // found, or an empty string if the file is intact as far as it can tell.
+  static std::string verify(std::string_view filename) noexcept;
+  static std::string verify(std::string_view filename,
+                            archive_verify_stats *stats_nullable) noexcept;
+
   std::string save(std::ostream &os) const noexcept;
+  std::string save(std::ostream &os,
+                   const archive_save_options &opt) const noexcept;
   std::string save(std::string_view filename) const noexcept;
+  std::string save(std::string_view filename,
+                   const archive_save_options &opt) const noexcept;
 
+  // Lookups are O(1) through a tag index. A hit is only trusted if the
+  // segment count is unchanged and the segment still has this tag. If a
+  // segment is retagged in place, call segments() to drop the index, or a
+  // lookup of its new tag may miss it.
   data_segment *find_first_of(int64_t tag) noexcept;
   const data_segment *find_first_of(int64_t tag) const noexcept;
 
@@ -129,6 +303,15 @@ class binary_archive {
  private:
   std::optional<size_t> impl_find_first_of(int64_t tag) const noexcept;
   std::optional<size_t> impl_find_last_of(int64_t tag) const noexcept;
+
+  void clear_for_loading() noexcept;
+  void build_tag_index() noexcept;
+  [[nodiscard]] bool tag_index_usable() const noexcept;
+  const tag_index_slot *find_tag_slot(int64_t tag) const noexcept;
+
+  std::string impl_save_parallel(
+      std::string_view filename,
+      const archive_save_options &opt) const noexcept;
 };
 };  // namespace fractal_utils
 
@@ -0,0 +1,465 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "color_kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define FRACTALUTILS_COLOR_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace fractal_utils;
+
+static_assert(sizeof(pixel_RGB) == 3, "pixel_RGB must be packed");
+
+namespace {
+constexpr size_t series_count = size_t(color_series::parula) + 1;
+constexpr size_t max_lut_size = size_t(1) << 24;
+
+inline pixel_ARGB pack_argb(uint32_t R, uint32_t G, uint32_t B) noexcept {
+  return (0xFFU << 24) | ((R & 0xFF) << 16) | ((G & 0xFF) << 8) | (B & 0xFF);
+}
+
+inline pixel_RGB unpack_rgb(pixel_ARGB argb) noexcept {
+  return pixel_RGB{uint8_t((argb >> 16) & 0xFF), uint8_t((argb >> 8) & 0xFF),
+                   uint8_t(argb & 0xFF)};
+}
+
+struct packed_lut {
+  std::vector<pixel_ARGB> argb;
+  std::vector<pixel_RGB> rgb;
+
+  [[nodiscard]] color_lut lut() const noexcept {
+    return color_lut{this->argb.data(), this->rgb.data(), this->argb.size()};
+  }
+};
+
+packed_lut build_lut(color_series cs, size_t size) noexcept {
+  const color_source_t src = color_source(cs);
+  packed_lut lut;
+  lut.argb.resize(size);
+  lut.rgb.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    if (size == internal::color_source_size) {
+      // the same conversions as color_u8c4
+      const uint32_t R = src[i][0] * 255;
+      const uint32_t G = src[i][1] * 255;
+      const uint32_t B = src[i][2] * 255;
+      lut.argb[i] = pack_argb(R, G, B);
+    } else {
+      const double pos = double(i) * (internal::color_source_size - 1) /
+                         double(size - 1);
+      const size_t lo = std::min<size_t>(size_t(pos),
+                                         internal::color_source_size - 2);
+      const double t = pos - double(lo);
+      uint32_t channel[3];
+      for (int c = 0; c < 3; c++) {
+        const double v = src[lo][c] * (1 - t) + src[lo + 1][c] * t;
+        channel[c] = uint32_t(std::clamp(v, 0.0, 1.0) * 255);
+      }
+      lut.argb[i] = pack_argb(channel[0], channel[1], channel[2]);
+    }
+    lut.rgb[i] = unpack_rgb(lut.argb[i]);
+  }
+  return lut;
+}
+
+// Tables of the default size are used per pixel by color_u8c3 and
+// color_u8c4, so they are built together and found without a lock.
+const std::array<packed_lut, series_count> &default_luts() noexcept {
+  static const auto luts = [] {
+    std::array<packed_lut, series_count> ret;
+    for (size_t s = 0; s < series_count; s++) {
+      ret[s] = build_lut(color_series(s), internal::color_source_size);
+    }
+    return ret;
+  }();
+  return luts;
+}
+
+inline size_t index_of(float f, float last) noexcept {
+  float x = f * last;
+  // written so that NaN goes to 0, as max_ps/min_ps do below
+  x = (x > 0.0f) ? x : 0.0f;
+  x = (x < last) ? x : last;
+  return size_t(x);
+}
+
+// a * (256 - w) + b * w in 8.8 fixed point for each channel, w in [0, 256].
+// Two channels are computed at once in the 16 bit halves of a 32 bit word.
+inline pixel_ARGB blend(pixel_ARGB a, pixel_ARGB b, uint32_t w) noexcept {
+  constexpr uint32_t mask = 0x00FF00FF;
+  constexpr uint32_t round = 0x00800080;
+  const uint32_t lo =
+      (a & mask) * (256 - w) + (b & mask) * w + round;
+  const uint32_t hi =
+      ((a >> 8) & mask) * (256 - w) + ((b >> 8) & mask) * w + round;
+  return ((lo >> 8) & mask) | (hi & ~mask);
+}
+
+// The reference of the vector kernels, every operation has a vector twin.
+template <bool linear, bool cyclic>
+inline pixel_ARGB sample_one(float f, const pixel_ARGB *table,
+                             int n) noexcept {
+  float x;
+  float hi;
+  if constexpr (cyclic) {
+    hi = float(n);
+    x = (f - std::floor(f)) * hi;
+  } else {
+    hi = float(n - 1);
+    x = f * hi;
+  }
+  x = (x > 0.0f) ? x : 0.0f;
+  x = (x < hi) ? x : hi;
+  int i = int(x);
+  if constexpr (!linear) {
+    if constexpr (cyclic) {
+      // f slightly below an integer may round to exactly n
+      i = (i == n) ? 0 : i;
+    }
+    return table[i];
+  } else {
+    const int max_i = cyclic ? n - 1 : n - 2;
+    i = (i < max_i) ? i : max_i;
+    const uint32_t w = uint32_t((x - float(i)) * 256.0f);
+    int next = i + 1;
+    if constexpr (cyclic) {
+      next = (next == n) ? 0 : next;
+    }
+    return blend(table[i], table[next], w);
+  }
+}
+
+template <bool linear, bool cyclic>
+size_t sample_scalar(const float *f, size_t begin, size_t pixel_num,
+                     const pixel_ARGB *table, int n,
+                     pixel_ARGB *dest) noexcept {
+  for (size_t i = begin; i < pixel_num; i++) {
+    dest[i] = sample_one<linear, cyclic>(f[i], table, n);
+  }
+  return pixel_num;
+}
+
+#ifdef FRACTALUTILS_COLOR_KERNELS_X86
+__attribute__((target("avx2"))) inline __m256i index_of_avx2(
+    __m256 f, __m256 last) noexcept {
+  __m256 x = _mm256_mul_ps(f, last);
+  // max_ps returns the second operand if any is NaN
+  x = _mm256_max_ps(x, _mm256_setzero_ps());
+  x = _mm256_min_ps(x, last);
+  return _mm256_cvttps_epi32(x);
+}
+
+__attribute__((target("avx2"))) size_t lookup_u8c4_avx2(
+    const float *f, size_t pixel_num, const pixel_ARGB *table,
+    size_t table_size, pixel_ARGB *dest) noexcept {
+  const __m256 last = _mm256_set1_ps(float(table_size - 1));
+  size_t i = 0;
+  for (; i + 8 <= pixel_num; i += 8) {
+    const __m256i idx = index_of_avx2(_mm256_loadu_ps(f + i), last);
+    const __m256i px = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(table), idx, 4);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), px);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t lookup_u8c3_avx2(
+    const float *f, size_t pixel_num, const pixel_ARGB *table,
+    size_t table_size, pixel_RGB *dest) noexcept {
+  const __m256 last = _mm256_set1_ps(float(table_size - 1));
+  // B, G, R, A in memory -> R, G, B of 4 pixels in the low 12 bytes
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,  //
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  uint8_t *out = reinterpret_cast<uint8_t *>(dest);
+  size_t i = 0;
+  // each 16 byte store writes 4 bytes past its 12, which are overwritten by
+  // the next one; keep 2 pixels of room for the last store
+  for (; i + 10 <= pixel_num; i += 8) {
+    const __m256i idx = index_of_avx2(_mm256_loadu_ps(f + i), last);
+    __m256i px = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(table), idx, 4);
+    px = _mm256_shuffle_epi8(px, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i),
+                     _mm256_castsi256_si128(px));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i + 12),
+                     _mm256_extracti128_si256(px, 1));
+  }
+  return i;
+}
+
+__attribute__((target("avx512f"))) size_t lookup_u8c4_avx512(
+    const float *f, size_t pixel_num, const pixel_ARGB *table,
+    size_t table_size, pixel_ARGB *dest) noexcept {
+  const __m512 last = _mm512_set1_ps(float(table_size - 1));
+  size_t i = 0;
+  for (; i + 16 <= pixel_num; i += 16) {
+    __m512 x = _mm512_mul_ps(_mm512_loadu_ps(f + i), last);
+    x = _mm512_max_ps(x, _mm512_setzero_ps());
+    x = _mm512_min_ps(x, last);
+    const __m512i idx = _mm512_cvttps_epi32(x);
+    const __m512i px = _mm512_i32gather_epi32(idx, table, 4);
+    _mm512_storeu_si512(dest + i, px);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) inline __m256i blend_avx2(
+    __m256i a, __m256i b, __m256i w) noexcept {
+  const __m256i mask = _mm256_set1_epi32(0x00FF00FF);
+  const __m256i round = _mm256_set1_epi16(128);
+  const __m256i w16 = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+  const __m256i iw16 = _mm256_sub_epi16(_mm256_set1_epi16(256), w16);
+  const __m256i lo = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(a, mask), iw16),
+                       _mm256_mullo_epi16(_mm256_and_si256(b, mask), w16)),
+      round);
+  const __m256i hi = _mm256_add_epi16(
+      _mm256_add_epi16(
+          _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+                             iw16),
+          _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(b, 8), mask),
+                             w16)),
+      round);
+  return _mm256_or_si256(_mm256_srli_epi16(lo, 8),
+                         _mm256_andnot_si256(mask, hi));
+}
+
+template <bool linear, bool cyclic>
+__attribute__((target("avx2"))) inline __m256i sample_avx2(
+    __m256 f, const pixel_ARGB *table, int n) noexcept {
+  const int *const table_i32 = reinterpret_cast<const int *>(table);
+  const __m256i n_i32 = _mm256_set1_epi32(n);
+  __m256 x;
+  __m256 hi;
+  if constexpr (cyclic) {
+    hi = _mm256_set1_ps(float(n));
+    x = _mm256_mul_ps(_mm256_sub_ps(f, _mm256_floor_ps(f)), hi);
+  } else {
+    hi = _mm256_set1_ps(float(n - 1));
+    x = _mm256_mul_ps(f, hi);
+  }
+  x = _mm256_max_ps(x, _mm256_setzero_ps());
+  x = _mm256_min_ps(x, hi);
+  __m256i i = _mm256_cvttps_epi32(x);
+  if constexpr (!linear) {
+    if constexpr (cyclic) {
+      i = _mm256_andnot_si256(_mm256_cmpeq_epi32(i, n_i32), i);
+    }
+    return _mm256_i32gather_epi32(table_i32, i, 4);
+  } else {
+    i = _mm256_min_epi32(i, _mm256_set1_epi32(cyclic ? n - 1 : n - 2));
+    const __m256i w = _mm256_cvttps_epi32(_mm256_mul_ps(
+        _mm256_sub_ps(x, _mm256_cvtepi32_ps(i)), _mm256_set1_ps(256.0f)));
+    __m256i next = _mm256_add_epi32(i, _mm256_set1_epi32(1));
+    if constexpr (cyclic) {
+      next = _mm256_andnot_si256(_mm256_cmpeq_epi32(next, n_i32), next);
+    }
+    return blend_avx2(_mm256_i32gather_epi32(table_i32, i, 4),
+                      _mm256_i32gather_epi32(table_i32, next, 4), w);
+  }
+}
+
+template <bool linear, bool cyclic>
+__attribute__((target("avx2"))) size_t sample_u8c4_avx2(
+    const float *f, size_t pixel_num, const pixel_ARGB *table, int n,
+    pixel_ARGB *dest) noexcept {
+  size_t i = 0;
+  for (; i + 8 <= pixel_num; i += 8) {
+    const __m256i px =
+        sample_avx2<linear, cyclic>(_mm256_loadu_ps(f + i), table, n);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i), px);
+  }
+  return i;
+}
+
+template <bool linear, bool cyclic>
+__attribute__((target("avx2"))) size_t sample_u8c3_avx2(
+    const float *f, size_t pixel_num, const pixel_ARGB *table, int n,
+    pixel_RGB *dest) noexcept {
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,  //
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  uint8_t *out = reinterpret_cast<uint8_t *>(dest);
+  size_t i = 0;
+  // see lookup_u8c3_avx2 for the 2 pixels of room
+  for (; i + 10 <= pixel_num; i += 8) {
+    __m256i px =
+        sample_avx2<linear, cyclic>(_mm256_loadu_ps(f + i), table, n);
+    px = _mm256_shuffle_epi8(px, pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i),
+                     _mm256_castsi256_si128(px));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i + 12),
+                     _mm256_extracti128_si256(px, 1));
+  }
+  return i;
+}
+
+bool cpu_has_avx2() noexcept {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+
+bool cpu_has_avx512() noexcept {
+  static const bool has = __builtin_cpu_supports("avx512f");
+  return has;
+}
+#endif
+
+}  // namespace
+
+color_lut fractal_utils::color_lut_of(color_series cs, size_t size) noexcept {
+  if (size_t(cs) >= series_count || size < 2 || size > max_lut_size) {
+    return {};
+  }
+  if (size == internal::color_source_size) {
+    return default_luts()[size_t(cs)].lut();
+  }
+
+  static std::mutex lock;
+  // node based, so tables never move once built
+  static std::map<std::pair<color_series, size_t>, packed_lut> cache;
+  std::lock_guard<std::mutex> lk{lock};
+  auto it = cache.find({cs, size});
+  if (it == cache.end()) {
+    it = cache.emplace(std::make_pair(cs, size), build_lut(cs, size)).first;
+  }
+  return it->second.lut();
+}
+
+void internal::lookup_u8c4(const float *f, size_t pixel_num,
+                           const pixel_ARGB *table, size_t table_size,
+                           pixel_ARGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_COLOR_KERNELS_X86
+  if (cpu_has_avx512()) {
+    i = lookup_u8c4_avx512(f, pixel_num, table, table_size, dest);
+  } else if (cpu_has_avx2()) {
+    i = lookup_u8c4_avx2(f, pixel_num, table, table_size, dest);
+  }
+#endif
+  const float last = float(table_size - 1);
+  for (; i < pixel_num; i++) {
+    dest[i] = table[index_of(f[i], last)];
+  }
+}
+
+void internal::lookup_u8c3(const float *f, size_t pixel_num,
+                           const pixel_ARGB *table, size_t table_size,
+                           pixel_RGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_COLOR_KERNELS_X86
+  // the 8-wide kernel is also used on AVX-512 cpus, since a full-width byte
+  // shuffle would need AVX-512BW
+  if (cpu_has_avx2()) {
+    i = lookup_u8c3_avx2(f, pixel_num, table, table_size, dest);
+  }
+#endif
+  const float last = float(table_size - 1);
+  for (; i < pixel_num; i++) {
+    dest[i] = unpack_rgb(table[index_of(f[i], last)]);
+  }
+}
+
+pixel_ARGB internal::sample_color(float f, const pixel_ARGB *table,
+                                  size_t table_size,
+                                  const color_sample_options &opt) noexcept {
+  const int n = int(table_size);
+  const bool linear = opt.sampling == color_sampling::linear;
+  if (linear) {
+    return opt.cyclic ? sample_one<true, true>(f, table, n)
+                      : sample_one<true, false>(f, table, n);
+  }
+  return opt.cyclic ? sample_one<false, true>(f, table, n)
+                    : sample_one<false, false>(f, table, n);
+}
+
+namespace {
+template <bool linear, bool cyclic>
+void sample_u8c4_impl(const float *f, size_t pixel_num,
+                      const pixel_ARGB *table, int n,
+                      pixel_ARGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_COLOR_KERNELS_X86
+  if (cpu_has_avx2()) {
+    i = sample_u8c4_avx2<linear, cyclic>(f, pixel_num, table, n, dest);
+  }
+#endif
+  sample_scalar<linear, cyclic>(f, i, pixel_num, table, n, dest);
+}
+
+template <bool linear, bool cyclic>
+void sample_u8c3_impl(const float *f, size_t pixel_num,
+                      const pixel_ARGB *table, int n,
+                      pixel_RGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_COLOR_KERNELS_X86
+  if (cpu_has_avx2()) {
+    i = sample_u8c3_avx2<linear, cyclic>(f, pixel_num, table, n, dest);
+  }
+#endif
+  for (; i < pixel_num; i++) {
+    dest[i] = unpack_rgb(sample_one<linear, cyclic>(f[i], table, n));
+  }
+}
+}  // namespace
+
+void internal::sample_u8c4(const float *f, size_t pixel_num,
+                           const pixel_ARGB *table, size_t table_size,
+                           const color_sample_options &opt,
+                           pixel_ARGB *dest) noexcept {
+  const int n = int(table_size);
+  if (opt.sampling == color_sampling::linear) {
+    opt.cyclic ? sample_u8c4_impl<true, true>(f, pixel_num, table, n, dest)
+               : sample_u8c4_impl<true, false>(f, pixel_num, table, n, dest);
+  } else if (opt.cyclic) {
+    sample_u8c4_impl<false, true>(f, pixel_num, table, n, dest);
+  } else {
+    lookup_u8c4(f, pixel_num, table, table_size, dest);
+  }
+}
+
+void internal::sample_u8c3(const float *f, size_t pixel_num,
+                           const pixel_ARGB *table, size_t table_size,
+                           const color_sample_options &opt,
+                           pixel_RGB *dest) noexcept {
+  const int n = int(table_size);
+  if (opt.sampling == color_sampling::linear) {
+    opt.cyclic ? sample_u8c3_impl<true, true>(f, pixel_num, table, n, dest)
+               : sample_u8c3_impl<true, false>(f, pixel_num, table, n, dest);
+  } else if (opt.cyclic) {
+    sample_u8c3_impl<false, true>(f, pixel_num, table, n, dest);
+  } else {
+    lookup_u8c3(f, pixel_num, table, table_size, dest);
+  }
+}
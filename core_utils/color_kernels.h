@@ -0,0 +1,60 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_PRIVATE_COLOR_KERNELS_H
+#define FRACTALUTILS_PRIVATE_COLOR_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fractal_colors.h"
+
+namespace fractal_utils {
+namespace internal {
+
+// Number of entries of the float tables in color_sources.cpp.
+constexpr size_t color_source_size = 512;
+
+// Batch lookups in a table of pixel_ARGB, such as color_lut::argb. The index
+// of f is the one of color_lut::index_of. Vectorised with AVX-512
+// or AVX2 gathers when the cpu supports them.
+void lookup_u8c4(const float *f, size_t pixel_num, const pixel_ARGB *table,
+                 size_t table_size, pixel_ARGB *dest) noexcept;
+// Same, but writes 3 bytes R, G, B per pixel.
+void lookup_u8c3(const float *f, size_t pixel_num, const pixel_ARGB *table,
+                 size_t table_size, pixel_RGB *dest) noexcept;
+
+// One pixel sampled as described by opt. table_size must be at least 2.
+pixel_ARGB sample_color(float f, const pixel_ARGB *table, size_t table_size,
+                        const color_sample_options &opt) noexcept;
+// Batch versions of sample_color, vectorised with AVX2. Channels are blended
+// in 8.8 fixed point, identically in the scalar and vector paths.
+void sample_u8c4(const float *f, size_t pixel_num, const pixel_ARGB *table,
+                 size_t table_size, const color_sample_options &opt,
+                 pixel_ARGB *dest) noexcept;
+void sample_u8c3(const float *f, size_t pixel_num, const pixel_ARGB *table,
+                 size_t table_size, const color_sample_options &opt,
+                 pixel_RGB *dest) noexcept;
+
+}  // namespace internal
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_PRIVATE_COLOR_KERNELS_H
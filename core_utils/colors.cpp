@@ -19,9 +19,11 @@ This file is part of FractalUtils.
     github:https://github.com/ToKiNoBug
 */
 
+#include <cstring>
 #include <memory>
 #include <string_view>
 
+#include "color_kernels.h"
 #include "color_sources.h"
 #include "fractal_colors.h"
 
@@ -122,20 +124,11 @@ fractal_utils::color_series fractal_utils::color_series_str_to_enum(
 using namespace fractal_utils;
 pixel_RGB fractal_utils::color_u8c3(const float f,
                                     const color_series cs) noexcept {
-  pixel_RGB ret;
-  const src_t src = color_source(cs);
-
-  if (src != nullptr) {
-    ret.value[0] = interpolate(f, src)[0] * 255;
-    ret.value[1] = interpolate(f, src)[1] * 255;
-    ret.value[2] = interpolate(f, src)[2] * 255;
-  } else {
-    ret.value[0] = 0;
-    ret.value[1] = 0;
-    ret.value[2] = 0;
+  const color_lut lut = color_lut_of(cs);
+  if (!lut.is_valid()) {
+    return pixel_RGB{0, 0, 0};
   }
-
-  return ret;
+  return lut.u8c3(f);
 }
 
 pixel_RGB fractal_utils::color_u8c3(const float f,
@@ -156,70 +149,79 @@ pixel_RGB fractal_utils::color_u8c3(const float f,
 using namespace fractal_utils;
 pixel_ARGB fractal_utils::color_u8c4(const float f,
                                      const color_series cs) noexcept {
-  pixel_ARGB ret;
-  const src_t src = color_source(cs);
-
-  uint32_t R, G, B;
-
-  if (src != nullptr) {
-    R = interpolate(f, src)[0] * 255;
-    G = interpolate(f, src)[1] * 255;
-    B = interpolate(f, src)[2] * 255;
-  } else {
-    R = 0;
-    G = 0;
-    B = 0;
+  const color_lut lut = color_lut_of(cs);
+  if (!lut.is_valid()) {
+    return 0xFFUL << 24;
   }
-
-  ret = (0xFFUL << 24) | ((R & 0xFF) << 16) | ((G & 0xFF) << 8) | (B & 0xFF);
-
-  return ret;
+  return lut.u8c4(f);
 }
 
 void fractal_utils::color_u8c3_many(const float *const f, const color_series cs,
                                     const size_t pixel_num,
                                     pixel_RGB *const dest) noexcept {
-  const src_t src = color_source(cs);
+  color_u8c3_many(f, color_lut_of(cs), pixel_num, dest);
+}
 
-  if (src == nullptr) {
-#ifdef __GNUC__
-    __builtin_memset(dest, 0, pixel_num * sizeof(pixel_RGB));
-#else
+void fractal_utils::color_u8c4_many(const float *const f, const color_series cs,
+                                    const size_t pixel_num,
+                                    pixel_ARGB *const dest) noexcept {
+  color_u8c4_many(f, color_lut_of(cs), pixel_num, dest);
+}
+
+void fractal_utils::color_u8c3_many(const float *const f, const color_lut &lut,
+                                    const size_t pixel_num,
+                                    pixel_RGB *const dest) noexcept {
+  if (!lut.is_valid()) {
     memset(dest, 0, pixel_num * sizeof(pixel_RGB));
-#endif
     return;
   }
-
-  for (size_t pidx = 0; pidx < pixel_num; pidx++) {
-    dest[pidx].value[0] = interpolate(f[pidx], src)[0] * 255;
-    dest[pidx].value[1] = interpolate(f[pidx], src)[1] * 255;
-    dest[pidx].value[2] = interpolate(f[pidx], src)[2] * 255;
-  }
+  internal::lookup_u8c3(f, pixel_num, lut.argb, lut.size, dest);
 }
 
-void fractal_utils::color_u8c4_many(const float *const f, const color_series cs,
+void fractal_utils::color_u8c4_many(const float *const f, const color_lut &lut,
                                     const size_t pixel_num,
                                     pixel_ARGB *const dest) noexcept {
-  const src_t src = color_source(cs);
-
-  if (src == nullptr) {
-#ifdef __GNUC__
-    __builtin_memset(dest, 0, pixel_num * sizeof(pixel_ARGB));
-#else
+  if (!lut.is_valid()) {
     memset(dest, 0, pixel_num * sizeof(pixel_ARGB));
-#endif
     return;
   }
+  internal::lookup_u8c4(f, pixel_num, lut.argb, lut.size, dest);
+}
+
+pixel_RGB fractal_utils::color_u8c3(const float f, const color_lut &lut,
+                                    const color_sample_options &opt) noexcept {
+  if (!lut.is_valid()) {
+    return pixel_RGB{0, 0, 0};
+  }
+  return pixel_RGB{internal::sample_color(f, lut.argb, lut.size, opt)};
+}
+
+pixel_ARGB fractal_utils::color_u8c4(const float f, const color_lut &lut,
+                                     const color_sample_options &opt) noexcept {
+  if (!lut.is_valid()) {
+    return 0xFFUL << 24;
+  }
+  return internal::sample_color(f, lut.argb, lut.size, opt);
+}
 
-  for (size_t pidx = 0; pidx < pixel_num; pidx++) {
-    uint32_t R, G, B;
-    R = interpolate(f[pidx], src)[0] * 255;
-    G = interpolate(f[pidx], src)[1] * 255;
-    B = interpolate(f[pidx], src)[2] * 255;
-    R = R & 0xFF;
-    G = G & 0xFF;
-    B = B & 0xFF;
+void fractal_utils::color_u8c3_many(const float *const f, const color_lut &lut,
+                                    const color_sample_options &opt,
+                                    const size_t pixel_num,
+                                    pixel_RGB *const dest) noexcept {
+  if (!lut.is_valid()) {
+    memset(dest, 0, pixel_num * sizeof(pixel_RGB));
+    return;
+  }
+  internal::sample_u8c3(f, pixel_num, lut.argb, lut.size, opt, dest);
+}
 
-    dest[pidx] = (0xFF << 24) | (R << 16) | (G << 8) | (B);
+void fractal_utils::color_u8c4_many(const float *const f, const color_lut &lut,
+                                    const color_sample_options &opt,
+                                    const size_t pixel_num,
+                                    pixel_ARGB *const dest) noexcept {
+  if (!lut.is_valid()) {
+    memset(dest, 0, pixel_num * sizeof(pixel_ARGB));
+    return;
   }
-}
\ No newline at end of file
+  internal::sample_u8c4(f, pixel_num, lut.argb, lut.size, opt, dest);
+}
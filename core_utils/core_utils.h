@@ -26,7 +26,16 @@ This file is part of FractalUtils.
 #include "fractal_binfile.h"
 #include "fractal_colors.h"
 #include "fractal_map.h"
+#include "gradient_palette.h"
 #include "hex_convert.h"
+#include "map_algorithms.h"
+#include "map_allocator.h"
+#include "map_histogram.h"
+#include "mapped_file.h"
+#include "multi_channel_map.h"
+#include "segment_pool.h"
+#include "tiled_map.h"
+#include "typed_map.h"
 #include "unique_map.h"
 
 #endif  // FRACTAL_UTILS_CORE_UTILS_H
\ No newline at end of file
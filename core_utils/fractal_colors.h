@@ -57,7 +57,7 @@ struct pixel_RGB {
   inline pixel_RGB(uint32_t ARGB) {
     value[0] = (ARGB & 0x00FF0000U) >> 16;
     value[1] = (ARGB & 0x0000FF00U) >> 8;
-    value[1] = (ARGB & 0x000000FFU);
+    value[2] = (ARGB & 0x000000FFU);
   }
 
   uint8_t value[3];
@@ -77,6 +77,79 @@ void color_u8c4_many(const float *const f, const color_series,
 
 using color_source_t = const float (*)[3];
 
+// Packed colours of a color_series at some resolution. The tables are shared
+// and live until the process exits, so a color_lut can be copied freely and
+// used from any thread.
+struct color_lut {
+  const pixel_ARGB *argb{nullptr};
+  const pixel_RGB *rgb{nullptr};
+  size_t size{0};
+
+  [[nodiscard]] inline bool is_valid() const noexcept {
+    return this->argb != nullptr;
+  }
+  // int(f * (size - 1)) clamped to the table, NaN goes to 0
+  [[nodiscard]] inline size_t index_of(float f) const noexcept {
+    const float last = float(this->size - 1);
+    float x = f * last;
+    x = (x > 0.0f) ? x : 0.0f;
+    x = (x < last) ? x : last;
+    return size_t(x);
+  }
+  [[nodiscard]] inline pixel_ARGB u8c4(float f) const noexcept {
+    return this->argb[this->index_of(f)];
+  }
+  [[nodiscard]] inline pixel_RGB u8c3(float f) const noexcept {
+    return this->rgb[this->index_of(f)];
+  }
+};
+
+// The number of entries of the built-in tables; a color_lut of this size
+// gives exactly the colours of color_u8c3 and color_u8c4.
+constexpr size_t default_color_lut_size = 512;
+
+// Get the packed table of cs with size entries, building it on first use.
+// Thread safe. Sizes other than default_color_lut_size, such as 4096 or
+// 65536, are resampled from the built-in table by linear interpolation.
+// Returns an invalid lut if cs is invalid or size is not in [2, 2^24].
+color_lut color_lut_of(color_series cs,
+                       size_t size = default_color_lut_size) noexcept;
+
+void color_u8c3_many(const float *const f, const color_lut &lut,
+                     const size_t pixel_num, pixel_RGB *const dest) noexcept;
+
+void color_u8c4_many(const float *const f, const color_lut &lut,
+                     const size_t pixel_num, pixel_ARGB *const dest) noexcept;
+
+enum class color_sampling : uint8_t {
+  // the entry at int(f * (size - 1)), as color_u8c3 and color_u8c4 do
+  nearest,
+  // blend the two entries around f, which removes the banding between
+  // neighbouring entries
+  linear,
+};
+
+struct color_sample_options {
+  color_sampling sampling{color_sampling::nearest};
+  // Only use the fractional part of f, and go from the last entry back to
+  // the first, for periodic palettes: f and f + 1 give the same colour.
+  // The table then covers [0, 1) with size entries.
+  bool cyclic{false};
+};
+
+pixel_RGB color_u8c3(const float f, const color_lut &lut,
+                     const color_sample_options &opt) noexcept;
+pixel_ARGB color_u8c4(const float f, const color_lut &lut,
+                      const color_sample_options &opt) noexcept;
+
+// Vectorised like the nearest lookups, the results equal the scalar ones.
+void color_u8c3_many(const float *const f, const color_lut &lut,
+                     const color_sample_options &opt, const size_t pixel_num,
+                     pixel_RGB *const dest) noexcept;
+void color_u8c4_many(const float *const f, const color_lut &lut,
+                     const color_sample_options &opt, const size_t pixel_num,
+                     pixel_ARGB *const dest) noexcept;
+
 color_source_t color_source(color_series cs) noexcept;
 
 pixel_RGB color_u8c3(const float f, const color_source_t cst) noexcept;
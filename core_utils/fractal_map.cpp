@@ -45,17 +45,24 @@ void fractal_utils::free_memory_aligned(void *data) noexcept {
 
 fractal_utils::fractal_map::fractal_map(size_t __rows, size_t __cols,
                                         uint32_t __element_bytes)
+    : fractal_map{__rows, __cols, __element_bytes,
+                  map_allocator::default_allocator()} {}
+
+fractal_utils::fractal_map::fractal_map(size_t __rows, size_t __cols,
+                                        uint32_t __element_bytes,
+                                        map_allocator &allocator)
     : rows(__rows),
       cols(__cols),
       element_bytes(__element_bytes),
-      call_free_on_destructor(true) {
+      call_free_on_destructor(true),
+      m_allocator(&allocator) {
   if (__rows <= 0 || __cols <= 0 || __element_bytes <= 0) {
     // no memory to be allocated
     this->data = nullptr;
   } else {
     this->call_free_on_destructor = true;
 
-    this->data = allocate_memory_aligned(64, __rows * __cols * __element_bytes);
+    this->data = allocator.allocate(__rows * __cols * __element_bytes);
   }
 }
 fractal_utils::fractal_map::fractal_map(size_t __rows, size_t __cols,
@@ -71,17 +78,23 @@ fractal_map fractal_utils::fractal_map::create(size_t rows, size_t cols,
   return fractal_map(rows, cols, sizeof_element);
 }
 
-fractal_utils::fractal_map::~fractal_map() {
-  if (this->call_free_on_destructor && this->data != nullptr) {
-    free_memory_aligned(this->data);
-  }
+fractal_map fractal_utils::fractal_map::create(
+    size_t rows, size_t cols, size_t sizeof_element,
+    map_allocator &allocator) noexcept {
+  return fractal_map(rows, cols, sizeof_element, allocator);
 }
 
+fractal_utils::fractal_map::~fractal_map() { this->release(); }
+
 void fractal_utils::fractal_map::release() noexcept {
-  if (this->call_free_on_destructor) {
-    this->call_free_on_destructor = false;
-    free_memory_aligned(this->data);
+  if (this->call_free_on_destructor && this->data != nullptr) {
+    if (this->m_allocator != nullptr) {
+      this->m_allocator->deallocate(this->data, this->byte_count());
+    } else {
+      free_memory_aligned(this->data);
+    }
   }
+  this->call_free_on_destructor = false;
   this->data = nullptr;
 }
 
@@ -89,8 +102,11 @@ fractal_utils::fractal_map::fractal_map(const fractal_map &src)
     : rows(src.rows),
       cols(src.cols),
       element_bytes(src.element_bytes),
-      call_free_on_destructor(true) {
-  this->data = allocate_memory_aligned(64, src.byte_count());
+      call_free_on_destructor(true),
+      m_allocator(src.m_allocator != nullptr
+                      ? src.m_allocator
+                      : &map_allocator::default_allocator()) {
+  this->data = this->m_allocator->allocate(src.byte_count());
 #ifdef __GNUC__
   __builtin_memcpy(this->data, src.data, src.byte_count());
 #else
@@ -102,6 +118,7 @@ fractal_utils::fractal_map::fractal_map(fractal_map &&src)
     : rows(src.rows), cols(src.cols), element_bytes(src.element_bytes) {
   this->data = src.data;
   this->call_free_on_destructor = src.call_free_on_destructor;
+  this->m_allocator = src.m_allocator;
 
   src.data = nullptr;
   src.call_free_on_destructor = false;
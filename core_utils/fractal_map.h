@@ -29,6 +29,7 @@ This file is part of FractalUtils.
 #include <type_traits>
 #include <typeinfo>
 #include "center_wind.hpp"
+#include "map_allocator.h"
 
 #ifdef FRACTAL_UTILS_HAVE_CXX_20
 #include <ranges>
@@ -48,16 +49,24 @@ class fractal_map {
 
  private:
   bool call_free_on_destructor{false};
+  // allocator of owned memory
+  map_allocator *m_allocator{nullptr};
 
  public:
   [[nodiscard]] static fractal_map create(size_t rows, size_t cols,
                                           size_t sizeof_element) noexcept;
+  [[nodiscard]] static fractal_map create(size_t rows, size_t cols,
+                                          size_t sizeof_element,
+                                          map_allocator &allocator) noexcept;
 
   ~fractal_map();
   fractal_map() = delete;
   fractal_map(const fractal_map &);
   fractal_map(fractal_map &&src);
   fractal_map(size_t __rows, size_t __cols, uint32_t __element_bytes);
+  // The allocator must outlive this map.
+  fractal_map(size_t __rows, size_t __cols, uint32_t __element_bytes,
+              map_allocator &allocator);
   fractal_map(size_t __rows, size_t __cols, uint32_t __element_bytes,
               void *__data);
 
@@ -0,0 +1,301 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "gradient_palette.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+
+#include "binary_archive.h"
+
+using namespace fractal_utils;
+
+namespace {
+using double3 = std::array<double, 3>;
+
+constexpr size_t max_table_size = size_t(1) << 24;
+
+double srgb_to_linear(double c) noexcept {
+  if (c <= 0.04045) {
+    return c / 12.92;
+  }
+  return std::pow((c + 0.055) / 1.055, 2.4);
+}
+
+double linear_to_srgb(double c) noexcept {
+  if (c <= 0.0031308) {
+    return c * 12.92;
+  }
+  return 1.055 * std::pow(c, 1 / 2.4) - 0.055;
+}
+
+// https://bottosson.github.io/posts/oklab/
+double3 srgb_to_oklab(const double3 &srgb) noexcept {
+  const double r = srgb_to_linear(srgb[0]);
+  const double g = srgb_to_linear(srgb[1]);
+  const double b = srgb_to_linear(srgb[2]);
+  const double l =
+      std::cbrt(0.4122214708 * r + 0.5363325363 * g + 0.0514459929 * b);
+  const double m =
+      std::cbrt(0.2119034982 * r + 0.6806995451 * g + 0.1073969566 * b);
+  const double s =
+      std::cbrt(0.0883024619 * r + 0.2817188376 * g + 0.6299787005 * b);
+  return {0.2104542553 * l + 0.7936177850 * m - 0.0040720468 * s,
+          1.9779984951 * l - 2.4285922050 * m + 0.4505937099 * s,
+          0.0259040371 * l + 0.7827717662 * m - 0.8086757660 * s};
+}
+
+double3 oklab_to_srgb(const double3 &lab) noexcept {
+  const double l_ = lab[0] + 0.3963377774 * lab[1] + 0.2158037573 * lab[2];
+  const double m_ = lab[0] - 0.1055613458 * lab[1] - 0.0638541728 * lab[2];
+  const double s_ = lab[0] - 0.0894841775 * lab[1] - 1.2914855480 * lab[2];
+  const double l = l_ * l_ * l_;
+  const double m = m_ * m_ * m_;
+  const double s = s_ * s_ * s_;
+  return {
+      linear_to_srgb(4.0767416621 * l - 3.3077115913 * m + 0.2309699292 * s),
+      linear_to_srgb(-1.2684380046 * l + 2.6097574011 * m - 0.3413193965 * s),
+      linear_to_srgb(-0.0041960863 * l - 0.7034186147 * m + 1.7076147010 * s)};
+}
+
+double normalize_hue(double h) noexcept {
+  h = std::fmod(h, 360.0);
+  return (h < 0) ? h + 360.0 : h;
+}
+
+double3 srgb_to_hsv(const double3 &rgb) noexcept {
+  const double max = std::max({rgb[0], rgb[1], rgb[2]});
+  const double min = std::min({rgb[0], rgb[1], rgb[2]});
+  const double delta = max - min;
+  double h = 0;
+  if (delta > 0) {
+    if (max == rgb[0]) {
+      h = 60 * ((rgb[1] - rgb[2]) / delta);
+    } else if (max == rgb[1]) {
+      h = 60 * ((rgb[2] - rgb[0]) / delta + 2);
+    } else {
+      h = 60 * ((rgb[0] - rgb[1]) / delta + 4);
+    }
+  }
+  return {normalize_hue(h), (max > 0) ? delta / max : 0, max};
+}
+
+double3 hsv_to_srgb(const double3 &hsv) noexcept {
+  const double h = normalize_hue(hsv[0]) / 60;
+  const double c = hsv[2] * hsv[1];
+  const double x = c * (1 - std::abs(std::fmod(h, 2.0) - 1));
+  const double m = hsv[2] - c;
+  double3 rgb;
+  switch (std::min(int(h), 5)) {
+    case 0:
+      rgb = {c, x, 0};
+      break;
+    case 1:
+      rgb = {x, c, 0};
+      break;
+    case 2:
+      rgb = {0, c, x};
+      break;
+    case 3:
+      rgb = {0, x, c};
+      break;
+    case 4:
+      rgb = {x, 0, c};
+      break;
+    default:
+      rgb = {c, 0, x};
+      break;
+  }
+  return {rgb[0] + m, rgb[1] + m, rgb[2] + m};
+}
+
+double3 to_srgb(gradient_space space, const double3 &value) noexcept {
+  switch (space) {
+    case gradient_space::hsv:
+      return hsv_to_srgb(value);
+    case gradient_space::oklab:
+      return oklab_to_srgb(value);
+    default:
+      return value;
+  }
+}
+
+double3 interpolate(gradient_space space, const gradient_stop &a,
+                    const gradient_stop &b, double t) noexcept {
+  double3 ret;
+  for (size_t i = 0; i < 3; i++) {
+    ret[i] = a.value[i] + t * (double(b.value[i]) - a.value[i]);
+  }
+  if (space == gradient_space::hsv) {
+    double dh = normalize_hue(b.value[0]) - normalize_hue(a.value[0]);
+    if (dh > 180) {
+      dh -= 360;
+    } else if (dh < -180) {
+      dh += 360;
+    }
+    ret[0] = normalize_hue(a.value[0] + t * dh);
+  }
+  return ret;
+}
+
+pixel_ARGB pack(const double3 &srgb) noexcept {
+  pixel_ARGB ret = 0xFF000000U;
+  for (size_t i = 0; i < 3; i++) {
+    // NaN goes to 0 as well
+    const double c = (srgb[i] > 0) ? std::min(srgb[i], 1.0) : 0.0;
+    ret |= pixel_ARGB(std::lround(c * 255)) << (16 - 8 * i);
+  }
+  return ret;
+}
+}  // namespace
+
+void gradient_palette::add_stop(float position, pixel_RGB color) noexcept {
+  double3 value{color.value[0] / 255.0, color.value[1] / 255.0,
+                color.value[2] / 255.0};
+  if (this->m_space == gradient_space::hsv) {
+    value = srgb_to_hsv(value);
+  } else if (this->m_space == gradient_space::oklab) {
+    value = srgb_to_oklab(value);
+  }
+  this->m_stops.emplace_back(gradient_stop{
+      position, {float(value[0]), float(value[1]), float(value[2])}});
+}
+
+std::string gradient_palette::compile(size_t size) noexcept {
+  if (this->m_stops.empty()) {
+    return "A gradient palette needs at least one stop";
+  }
+  if (size < 2 || size > max_table_size) {
+    return fmt::format("Invalid table size {}, expected 2 to {}", size,
+                       max_table_size);
+  }
+  for (const auto &stop : this->m_stops) {
+    if (!std::isfinite(stop.position)) {
+      return "Positions of gradient stops must be finite";
+    }
+  }
+
+  std::vector<gradient_stop> stops = this->m_stops;
+  std::stable_sort(stops.begin(), stops.end(),
+                   [](const gradient_stop &a, const gradient_stop &b) {
+                     return a.position < b.position;
+                   });
+
+  std::vector<pixel_ARGB> argb(size);
+  // index of the first stop after the current entry
+  size_t next = 0;
+  for (size_t i = 0; i < size; i++) {
+    const double t = double(i) / double(size - 1);
+    while (next < stops.size() && stops[next].position <= t) {
+      next++;
+    }
+    double3 value;
+    if (next == 0 || next == stops.size()) {
+      const auto &stop = stops[(next == 0) ? 0 : next - 1];
+      value = {stop.value[0], stop.value[1], stop.value[2]};
+    } else {
+      const auto &a = stops[next - 1];
+      const auto &b = stops[next];
+      value = interpolate(this->m_space, a, b,
+                          (t - a.position) / (b.position - a.position));
+    }
+    argb[i] = pack(to_srgb(this->m_space, value));
+  }
+
+  std::vector<pixel_RGB> rgb(size);
+  for (size_t i = 0; i < size; i++) {
+    rgb[i] = pixel_RGB{argb[i]};
+  }
+  this->m_argb = std::move(argb);
+  this->m_rgb = std::move(rgb);
+  return {};
+}
+
+void gradient_palette::append_to(binary_archive &archive,
+                                 int64_t tag) const noexcept {
+  // space, table size and stop count, then position and value of each stop
+  constexpr size_t header_bytes = 3 * sizeof(uint64_t);
+  std::vector<uint8_t> bytes(header_bytes +
+                             this->m_stops.size() * 4 * sizeof(float));
+  const uint64_t table_size =
+      this->is_compiled() ? this->m_argb.size() : default_color_lut_size;
+  const uint64_t header[3]{uint64_t(this->m_space), table_size,
+                           this->m_stops.size()};
+  memcpy(bytes.data(), header, header_bytes);
+  auto *dst = reinterpret_cast<float *>(bytes.data() + header_bytes);
+  for (const auto &stop : this->m_stops) {
+    *dst++ = stop.position;
+    for (float v : stop.value) {
+      *dst++ = v;
+    }
+  }
+  archive.segments().emplace_back(tag, std::move(bytes));
+}
+
+std::string gradient_palette::load_from(const binary_archive &archive,
+                                        int64_t tag) noexcept {
+  const data_segment *seg = archive.find_first_of(tag);
+  if (seg == nullptr || !seg->has_data()) {
+    return fmt::format("No gradient palette found at tag {}", tag);
+  }
+  constexpr size_t header_bytes = 3 * sizeof(uint64_t);
+  if (seg->bytes() < header_bytes) {
+    return fmt::format("Invalid gradient palette of {} bytes", seg->bytes());
+  }
+  const auto *src = reinterpret_cast<const uint8_t *>(seg->data());
+  uint64_t header[3];
+  memcpy(header, src, header_bytes);
+  if (header[0] > uint64_t(gradient_space::oklab)) {
+    return fmt::format("Invalid gradient space {}", header[0]);
+  }
+  constexpr size_t stop_bytes = 4 * sizeof(float);
+  // checked by division first, the product may wrap around
+  if (header[2] > (seg->bytes() - header_bytes) / stop_bytes ||
+      seg->bytes() != header_bytes + header[2] * stop_bytes) {
+    return fmt::format(
+        "Invalid gradient palette, {} stops can not fill {} bytes", header[2],
+        seg->bytes());
+  }
+  if (header[1] < 2 || header[1] > max_table_size) {
+    return fmt::format("Invalid table size {}, expected 2 to {}", header[1],
+                       max_table_size);
+  }
+
+  // compiled aside, so that this palette is untouched if it fails
+  gradient_palette loaded;
+  loaded.m_space = gradient_space(header[0]);
+  loaded.m_stops.resize(header[2]);
+  std::vector<float> values(header[2] * 4);
+  memcpy(values.data(), src + header_bytes, values.size() * sizeof(float));
+  for (size_t i = 0; i < loaded.m_stops.size(); i++) {
+    loaded.m_stops[i] = gradient_stop{
+        values[4 * i], {values[4 * i + 1], values[4 * i + 2],
+                        values[4 * i + 3]}};
+  }
+  auto err = loaded.compile(header[1]);
+  if (!err.empty()) {
+    return err;
+  }
+  *this = std::move(loaded);
+  return {};
+}
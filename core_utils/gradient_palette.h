@@ -0,0 +1,119 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_GRADIENTPALETTE_H
+#define FRACTALUTILS_COREUTILS_GRADIENTPALETTE_H
+
+#include <array>
+#include <initializer_list>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "fractal_colors.h"
+
+namespace fractal_utils {
+
+class binary_archive;
+
+// The space in which a gradient_palette interpolates between its stops, and
+// in which the components of a stop are given:
+//   rgb:   R, G, B of sRGB in [0, 1]
+//   hsv:   H in degrees, S and V in [0, 1]. Hue takes the shorter way round.
+//   oklab: L in [0, 1], a and b roughly in [-0.4, 0.4]. Perceptually uniform,
+//          so steps look even and blends do not turn grey or dark.
+enum class gradient_space : uint8_t { rgb, hsv, oklab };
+
+struct gradient_stop {
+  // where the stop sits in [0, 1]
+  float position;
+  std::array<float, 3> value;
+};
+
+// A user-defined palette made of colour stops. compile() samples it into the
+// same packed tables as the built-in series, so lut() works with every
+// color_lut function, including the batch kernels and linear sampling, at the
+// same speed as color_lut_of.
+class gradient_palette {
+ private:
+  std::vector<gradient_stop> m_stops;
+  gradient_space m_space{gradient_space::rgb};
+  std::vector<pixel_ARGB> m_argb;
+  std::vector<pixel_RGB> m_rgb;
+
+ public:
+  gradient_palette() = default;
+  gradient_palette(gradient_space space,
+                   std::initializer_list<gradient_stop> stops)
+      : m_stops{stops}, m_space{space} {}
+
+  [[nodiscard]] inline gradient_space space() const noexcept {
+    return this->m_space;
+  }
+  // Stops keep their values, which are then read in the new space.
+  inline void set_space(gradient_space space) noexcept {
+    this->m_space = space;
+  }
+
+  [[nodiscard]] inline std::span<const gradient_stop> stops() const noexcept {
+    return this->m_stops;
+  }
+  inline void add_stop(const gradient_stop &stop) noexcept {
+    this->m_stops.emplace_back(stop);
+  }
+  // Convert an sRGB colour into the space of this palette and add it.
+  void add_stop(float position, pixel_RGB color) noexcept;
+  inline void clear_stops() noexcept { this->m_stops.clear(); }
+
+  // Sample the stops into a table of size entries; before the first stop and
+  // after the last one the colour stays constant. Changes to the stops or the
+  // space take effect on the next compile. Returns error message, empty if
+  // succeeded.
+  [[nodiscard]] std::string compile(
+      size_t size = default_color_lut_size) noexcept;
+
+  [[nodiscard]] inline bool is_compiled() const noexcept {
+    return !this->m_argb.empty();
+  }
+  // The compiled table, or an invalid lut before compile. It points into
+  // this palette, and stays valid until the next compile or load_from.
+  [[nodiscard]] inline color_lut lut() const noexcept {
+    if (!this->is_compiled()) {
+      return {};
+    }
+    return color_lut{this->m_argb.data(), this->m_rgb.data(),
+                     this->m_argb.size()};
+  }
+
+  // Append one segment with tag, holding the space, the table size and the
+  // stops. The compiled table is not stored but rebuilt by load_from.
+  void append_to(binary_archive &archive, int64_t tag) const noexcept;
+  // Read the stops stored at tag and compile them. Returns error message,
+  // empty if succeeded.
+  [[nodiscard]] std::string load_from(const binary_archive &archive,
+                                      int64_t tag) noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_GRADIENTPALETTE_H
@@ -0,0 +1,89 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "map_algorithms.h"
+
+#include <thread>
+
+#ifdef FRACTALUTILS_COREUTILS_OPENMP_SUPPORT
+#include <omp.h>
+#endif
+
+using namespace fractal_utils;
+
+namespace {
+// below this many elements, starting threads costs more than it saves
+constexpr size_t min_elements_per_worker = size_t(1) << 15;
+}  // namespace
+
+int internal::map_algorithm_workers(size_t rows, size_t cols,
+                                    int threads) noexcept {
+  if (threads <= 0) {
+#ifdef FRACTALUTILS_COREUTILS_OPENMP_SUPPORT
+    threads = omp_get_max_threads();
+#else
+    threads = std::max<int>(1, std::thread::hardware_concurrency());
+#endif
+  }
+  const size_t by_size = std::max<size_t>(
+      1, rows * cols / min_elements_per_worker);
+  return int(std::min({size_t(threads), by_size, std::max<size_t>(rows, 1)}));
+}
+
+void internal::parallel_for_rows(
+    size_t rows, int workers,
+    const std::function<void(size_t, size_t, int)> &fun) noexcept {
+  workers = std::max(workers, 1);
+  auto block = [rows, workers, &fun](int w) {
+    const size_t beg = rows * w / workers;
+    const size_t end = rows * (w + 1) / workers;
+    fun(beg, end, w);
+  };
+  if (workers == 1) {
+    block(0);
+    return;
+  }
+
+#ifdef FRACTALUTILS_COREUTILS_OPENMP_SUPPORT
+#pragma omp parallel for schedule(static, 1) num_threads(workers)
+  for (int w = 0; w < workers; w++) {
+    block(w);
+  }
+#else
+  std::vector<std::thread> pool;
+  pool.reserve(workers - 1);
+  int w = 1;
+  try {
+    for (; w < workers; w++) {
+      pool.emplace_back(block, w);
+    }
+  } catch (...) {
+    // run what could not get a thread on this one
+  }
+  for (int rest = w; rest < workers; rest++) {
+    block(rest);
+  }
+  block(0);
+  for (auto &thread : pool) {
+    thread.join();
+  }
+#endif
+}
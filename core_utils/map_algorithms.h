@@ -0,0 +1,216 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_MAPALGORITHMS_H
+#define FRACTALUTILS_COREUTILS_MAPALGORITHMS_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+namespace internal {
+// Number of workers worth using for a map of this shape. threads <= 0 means
+// all hardware threads. Small maps get a single worker.
+int map_algorithm_workers(size_t rows, size_t cols, int threads) noexcept;
+
+// Split [0, rows) into workers contiguous blocks and call
+// fun(row_beg, row_end, worker) once for each, concurrently. Uses OpenMP if
+// core_utils is built with it, otherwise std::thread.
+void parallel_for_rows(
+    size_t rows, int workers,
+    const std::function<void(size_t, size_t, int)> &fun) noexcept;
+}  // namespace internal
+
+// The algorithms below run rows in parallel and call the functor on each
+// element of a row in a plain loop over contiguous memory, so it is inlined
+// and vectorised by the compiler for arithmetic element types. Maps are taken
+// as strided views, which all maps and views convert to.
+
+// dst(r, c) = fun(src(r, c))
+template <typename T, typename U, class fun_t>
+void transform(constant_strided_view src, strided_view dst, const fun_t &fun,
+               int threads = 0) noexcept {
+  assert(src.element_bytes() == sizeof(T));
+  assert(dst.element_bytes() == sizeof(U));
+  assert(src.rows() == dst.rows() && src.cols() == dst.cols());
+  const size_t cols = src.cols();
+  internal::parallel_for_rows(
+      src.rows(), internal::map_algorithm_workers(src.rows(), cols, threads),
+      [&](size_t beg, size_t end, int) {
+        for (size_t r = beg; r < end; r++) {
+          const T *__restrict s = reinterpret_cast<const T *>(src.row(r));
+          U *__restrict d = reinterpret_cast<U *>(dst.row(r));
+          for (size_t c = 0; c < cols; c++) {
+            d[c] = fun(s[c]);
+          }
+        }
+      });
+}
+
+// dst(r, c) = fun(a(r, c), b(r, c))
+template <typename A, typename B, typename U, class fun_t>
+void transform2(constant_strided_view a, constant_strided_view b,
+                strided_view dst, const fun_t &fun, int threads = 0) noexcept {
+  assert(a.element_bytes() == sizeof(A));
+  assert(b.element_bytes() == sizeof(B));
+  assert(dst.element_bytes() == sizeof(U));
+  assert(a.rows() == b.rows() && a.cols() == b.cols());
+  assert(a.rows() == dst.rows() && a.cols() == dst.cols());
+  const size_t cols = a.cols();
+  internal::parallel_for_rows(
+      a.rows(), internal::map_algorithm_workers(a.rows(), cols, threads),
+      [&](size_t beg, size_t end, int) {
+        for (size_t r = beg; r < end; r++) {
+          const A *__restrict sa = reinterpret_cast<const A *>(a.row(r));
+          const B *__restrict sb = reinterpret_cast<const B *>(b.row(r));
+          U *__restrict d = reinterpret_cast<U *>(dst.row(r));
+          for (size_t c = 0; c < cols; c++) {
+            d[c] = fun(sa[c], sb[c]);
+          }
+        }
+      });
+}
+
+// Fold every element into identity with acc = fun(acc, element), then
+// combine the results of the workers with combine(acc, acc). Both must be
+// associative, and identity must be neutral for combine.
+template <typename T, typename acc_t, class fun_t, class combine_t>
+acc_t reduce(constant_strided_view src, acc_t identity, const fun_t &fun,
+             const combine_t &combine, int threads = 0) noexcept {
+  assert(src.element_bytes() == sizeof(T));
+  const size_t cols = src.cols();
+  const int workers = internal::map_algorithm_workers(src.rows(), cols, threads);
+  std::vector<acc_t> partial(workers, identity);
+  internal::parallel_for_rows(
+      src.rows(), workers, [&](size_t beg, size_t end, int worker) {
+        acc_t acc = identity;
+        for (size_t r = beg; r < end; r++) {
+          const T *s = reinterpret_cast<const T *>(src.row(r));
+          for (size_t c = 0; c < cols; c++) {
+            acc = fun(acc, s[c]);
+          }
+        }
+        partial[worker] = acc;
+      });
+  acc_t result = identity;
+  for (const acc_t &p : partial) {
+    result = combine(result, p);
+  }
+  return result;
+}
+
+// {minimum, maximum} of all elements. NaNs are skipped as long as the first
+// element is not NaN. The map must not be empty.
+template <typename T>
+std::pair<T, T> minmax(constant_strided_view src, int threads = 0) noexcept {
+  assert(src.element_bytes() == sizeof(T));
+  assert(src.size() > 0);
+  const size_t cols = src.cols();
+  const int workers = internal::map_algorithm_workers(src.rows(), cols, threads);
+  const T first = *reinterpret_cast<const T *>(src.row(0));
+  std::vector<std::pair<T, T>> partial(workers, {first, first});
+  internal::parallel_for_rows(
+      src.rows(), workers, [&](size_t beg, size_t end, int worker) {
+        T lo = first;
+        T hi = first;
+        for (size_t r = beg; r < end; r++) {
+          const T *s = reinterpret_cast<const T *>(src.row(r));
+          // branch-free, so that it vectorises to min/max instructions
+          for (size_t c = 0; c < cols; c++) {
+            lo = (s[c] < lo) ? s[c] : lo;
+            hi = (s[c] > hi) ? s[c] : hi;
+          }
+        }
+        partial[worker] = {lo, hi};
+      });
+  std::pair<T, T> result{first, first};
+  for (const auto &[lo, hi] : partial) {
+    result.first = std::min(result.first, lo);
+    result.second = std::max(result.second, hi);
+  }
+  return result;
+}
+
+namespace internal {
+// histogram with the range in double, so that the range of an integer map
+// can have fractional bounds
+template <typename T>
+void histogram_of(constant_strided_view src, double lo, double hi,
+                  std::span<uint64_t> bins, int threads) noexcept {
+  assert(src.element_bytes() == sizeof(T));
+  std::fill(bins.begin(), bins.end(), 0);
+  if (bins.empty()) {
+    return;
+  }
+  const size_t cols = src.cols();
+  const int workers = map_algorithm_workers(src.rows(), cols, threads);
+  const size_t bin_count = bins.size();
+  const double scale = (hi > lo) ? double(bin_count) / (hi - lo) : 0.0;
+  const double last = double(bin_count - 1);
+  // one private histogram per worker, so no atomics in the loop
+  std::vector<uint64_t> partial(workers * bin_count, 0);
+  parallel_for_rows(
+      src.rows(), workers, [&](size_t beg, size_t end, int worker) {
+        uint64_t *h = partial.data() + worker * bin_count;
+        for (size_t r = beg; r < end; r++) {
+          const T *s = reinterpret_cast<const T *>(src.row(r));
+          for (size_t c = 0; c < cols; c++) {
+            double pos = (double(s[c]) - lo) * scale;
+            // NaN passes both clamps, and converting it to size_t is UB
+            if (std::isnan(pos)) {
+              continue;
+            }
+            pos = (pos < 0.0) ? 0.0 : pos;
+            pos = (pos > last) ? last : pos;
+            h[size_t(pos)]++;
+          }
+        }
+      });
+  for (int w = 0; w < workers; w++) {
+    for (size_t b = 0; b < bin_count; b++) {
+      bins[b] += partial[w * bin_count + b];
+    }
+  }
+}
+}  // namespace internal
+
+// Count elements into bins.size() equal bins spanning [lo, hi]. Elements out
+// of the range are counted in the first or last bin, NaNs are skipped. bins
+// are overwritten.
+template <typename T>
+void histogram(constant_strided_view src, T lo, T hi,
+               std::span<uint64_t> bins, int threads = 0) noexcept {
+  internal::histogram_of<T>(src, double(lo), double(hi), bins, threads);
+}
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_MAPALGORITHMS_H
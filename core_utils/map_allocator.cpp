@@ -0,0 +1,152 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "map_allocator.h"
+
+#include <algorithm>
+#include <bit>
+
+#include "fractal_map.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#ifdef FRACTALUTILS_COREUTILS_OPENMP_SUPPORT
+#include <omp.h>
+#endif
+
+using namespace fractal_utils;
+
+namespace {
+constexpr size_t page_bytes = 4096;
+
+// Returns 0 if the rounded size doesn't fit in size_t.
+inline size_t round_up(size_t bytes, size_t alignment) noexcept {
+  if (bytes > SIZE_MAX - alignment + 1) {
+    return 0;
+  }
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+void touch_pages(void *data, size_t bytes) noexcept {
+  uint8_t *const beg = reinterpret_cast<uint8_t *>(data);
+  const ptrdiff_t pages = (bytes + page_bytes - 1) / page_bytes;
+#ifdef FRACTALUTILS_COREUTILS_OPENMP_SUPPORT
+#pragma omp parallel for schedule(static)
+#endif
+  for (ptrdiff_t p = 0; p < pages; p++) {
+    beg[p * page_bytes] = 0;
+  }
+}
+}  // namespace
+
+map_allocator::map_allocator(const options &opt) noexcept : m_options{opt} {
+  this->m_options.alignment = std::bit_ceil(
+      std::max<size_t>(this->m_options.alignment, sizeof(void *)));
+}
+
+map_allocator &map_allocator::default_allocator() noexcept {
+  static map_allocator alloc;
+  return alloc;
+}
+
+size_t map_allocator::alignment_for(size_t bytes) const noexcept {
+  if (this->m_options.huge_pages && bytes >= huge_page_bytes) {
+    return std::max(this->m_options.alignment, huge_page_bytes);
+  }
+  return this->m_options.alignment;
+}
+
+void *map_allocator::allocate(size_t bytes) noexcept {
+  if (bytes == 0) {
+    return nullptr;
+  }
+  const size_t alignment = this->alignment_for(bytes);
+  // aligned_alloc requires the size to be a multiple of the alignment
+  const size_t size = round_up(bytes, alignment);
+  void *data = (size == 0) ? nullptr : allocate_memory_aligned(alignment, size);
+  if (data == nullptr) {
+    this->record_failure();
+    return nullptr;
+  }
+
+  const bool huge = (alignment >= huge_page_bytes);
+#ifdef __linux__
+  if (huge) {
+    // only advice, failure is harmless
+    madvise(data, size, MADV_HUGEPAGE);
+  }
+#endif
+  if (this->m_options.first_touch) {
+    touch_pages(data, size);
+  }
+  this->record_allocation(size, huge);
+  return data;
+}
+
+void map_allocator::deallocate(void *data, size_t bytes) noexcept {
+  if (data == nullptr) {
+    return;
+  }
+  const size_t alignment = this->alignment_for(bytes);
+  this->record_deallocation(round_up(bytes, alignment),
+                            alignment >= huge_page_bytes);
+  free_memory_aligned(data);
+}
+
+void map_allocator::record_allocation(size_t bytes, bool huge) noexcept {
+  this->m_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (huge) {
+    this->m_huge_page_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  const uint64_t in_use =
+      this->m_bytes_in_use.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  uint64_t peak = this->m_peak_bytes_in_use.load(std::memory_order_relaxed);
+  while (in_use > peak && !this->m_peak_bytes_in_use.compare_exchange_weak(
+                              peak, in_use, std::memory_order_relaxed)) {
+  }
+}
+
+void map_allocator::record_failure() noexcept {
+  this->m_failed_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void map_allocator::record_deallocation(size_t bytes, bool huge) noexcept {
+  this->m_deallocations.fetch_add(1, std::memory_order_relaxed);
+  this->m_bytes_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+  if (huge) {
+    this->m_huge_page_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+}
+
+map_allocator::statistics map_allocator::stats() const noexcept {
+  statistics ret;
+  ret.allocations = this->m_allocations.load(std::memory_order_relaxed);
+  ret.deallocations = this->m_deallocations.load(std::memory_order_relaxed);
+  ret.failed_allocations =
+      this->m_failed_allocations.load(std::memory_order_relaxed);
+  ret.bytes_in_use = this->m_bytes_in_use.load(std::memory_order_relaxed);
+  ret.peak_bytes_in_use =
+      this->m_peak_bytes_in_use.load(std::memory_order_relaxed);
+  ret.huge_page_bytes = this->m_huge_page_bytes.load(std::memory_order_relaxed);
+  return ret;
+}
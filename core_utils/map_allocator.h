@@ -0,0 +1,105 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_MAPALLOCATOR_H
+#define FRACTALUTILS_COREUTILS_MAPALLOCATOR_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fractal_utils {
+
+// Allocates the memory of unique_map and fractal_map. Derive from it to plug
+// in another allocation strategy; the maps only call allocate and deallocate.
+// An allocator must outlive every map that uses it.
+class map_allocator {
+ public:
+  struct options {
+    // alignment of every allocation, a power of 2. Use 64 for AVX-512.
+    size_t alignment{64};
+    // Ask the kernel to back large allocations with transparent huge pages.
+    // Such allocations are aligned to huge pages. Only effective on Linux.
+    bool huge_pages{false};
+    // Touch every page right after allocating, so that each page is placed on
+    // the NUMA node of the thread touching it. Pages are split among OpenMP
+    // threads by a static schedule, matching row-parallel loops with static
+    // schedule; without OpenMP the calling thread touches all of them.
+    bool first_touch{false};
+  };
+
+  struct statistics {
+    uint64_t allocations{0};
+    uint64_t deallocations{0};
+    uint64_t failed_allocations{0};
+    uint64_t bytes_in_use{0};
+    uint64_t peak_bytes_in_use{0};
+    // bytes in use that are advised to use huge pages
+    uint64_t huge_page_bytes{0};
+  };
+
+  // allocations at least this large may use huge pages
+  static constexpr size_t huge_page_bytes = size_t(1) << 21;
+
+ private:
+  options m_options;
+
+  std::atomic<uint64_t> m_allocations{0};
+  std::atomic<uint64_t> m_deallocations{0};
+  std::atomic<uint64_t> m_failed_allocations{0};
+  std::atomic<uint64_t> m_bytes_in_use{0};
+  std::atomic<uint64_t> m_peak_bytes_in_use{0};
+  std::atomic<uint64_t> m_huge_page_bytes{0};
+
+ public:
+  map_allocator() noexcept : map_allocator{options{}} {}
+  explicit map_allocator(const options &opt) noexcept;
+  map_allocator(const map_allocator &) = delete;
+  virtual ~map_allocator() = default;
+
+  map_allocator &operator=(const map_allocator &) = delete;
+
+  // Returns nullptr if bytes is 0 or the memory can't be allocated.
+  [[nodiscard]] virtual void *allocate(size_t bytes) noexcept;
+  // bytes must be the size passed to allocate
+  virtual void deallocate(void *data, size_t bytes) noexcept;
+
+  [[nodiscard]] inline const options &allocator_options() const noexcept {
+    return this->m_options;
+  }
+  [[nodiscard]] statistics stats() const noexcept;
+
+  // 64 byte aligned, no huge pages, no first touch. Maps created without an
+  // allocator use it.
+  [[nodiscard]] static map_allocator &default_allocator() noexcept;
+
+ protected:
+  // for derived allocators that keep the counters up to date
+  void record_allocation(size_t bytes, bool huge) noexcept;
+  void record_failure() noexcept;
+  void record_deallocation(size_t bytes, bool huge) noexcept;
+
+  [[nodiscard]] size_t alignment_for(size_t bytes) const noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_MAPALLOCATOR_H
@@ -0,0 +1,124 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "map_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace fractal_utils;
+
+histogram_engine::histogram_engine(const options &opt) noexcept
+    : m_options{opt} {
+  size_t bins = 0;
+  if (opt.hi >= opt.lo) {
+    bins = (opt.mode == bin_mode::integer)
+               ? size_t(std::floor(opt.hi) - std::floor(opt.lo)) + 1
+               : std::max<size_t>(opt.bins, 1);
+  }
+  if (opt.mode == bin_mode::integer) {
+    this->m_options.lo = std::floor(opt.lo);
+  } else if (opt.hi > opt.lo) {
+    this->m_scale = double(bins) / (opt.hi - opt.lo);
+  }
+  this->m_counts.assign(bins, 0);
+}
+
+histogram_engine histogram_engine::integer(int64_t lo, int64_t hi) noexcept {
+  return histogram_engine{
+      options{.mode = bin_mode::integer, .lo = double(lo), .hi = double(hi)}};
+}
+
+histogram_engine histogram_engine::uniform(double lo, double hi,
+                                           size_t bins) noexcept {
+  return histogram_engine{options{
+      .mode = bin_mode::uniform, .lo = lo, .hi = hi, .bins = bins}};
+}
+
+uint64_t histogram_engine::total() const noexcept {
+  uint64_t sum = 0;
+  for (uint64_t c : this->m_counts) {
+    sum += c;
+  }
+  return sum;
+}
+
+double histogram_engine::bin_value(size_t bin) const noexcept {
+  if (this->m_options.mode == bin_mode::integer) {
+    return this->m_options.lo + double(bin);
+  }
+  if (this->m_scale == 0) {
+    return this->m_options.lo;
+  }
+  return this->m_options.lo + double(bin) / this->m_scale;
+}
+
+void histogram_engine::clear() noexcept {
+  std::fill(this->m_counts.begin(), this->m_counts.end(), 0);
+  this->m_cdf_valid = false;
+}
+
+void histogram_engine::merge_scratch(int workers, bool subtract) noexcept {
+  const size_t bins = this->bin_count();
+  // each worker sums its own range of bins over all sub-histograms
+  const int merge_workers = int(std::min<size_t>(workers, bins / 4096 + 1));
+  internal::parallel_for_rows(
+      bins, merge_workers,
+      [this, workers, bins, subtract](size_t beg, size_t end, int) {
+        for (int w = 0; w < workers; w++) {
+          const uint64_t *h = this->m_scratch.data() + w * bins;
+          for (size_t b = beg; b < end; b++) {
+            if (subtract) {
+              this->m_counts[b] -= h[b];
+            } else {
+              this->m_counts[b] += h[b];
+            }
+          }
+        }
+      });
+  this->m_cdf_valid = false;
+}
+
+void histogram_engine::finalize() noexcept {
+  this->m_cdf.resize(this->bin_count());
+  uint64_t sum = 0;
+  for (size_t b = 0; b < this->bin_count(); b++) {
+    sum += this->m_counts[b];
+    this->m_cdf[b] = sum;
+  }
+  this->m_cdf_valid = true;
+}
+
+double histogram_engine::percentile(double p) const noexcept {
+  assert(this->m_cdf_valid);
+  if (this->m_cdf.empty()) {
+    return this->m_options.lo;
+  }
+  p = std::clamp(p, 0.0, 1.0);
+  // at least one element, so that empty leading bins are skipped
+  const uint64_t target = std::max<uint64_t>(
+      1, uint64_t(std::ceil(p * double(this->m_cdf.back()))));
+  const auto it =
+      std::lower_bound(this->m_cdf.begin(), this->m_cdf.end(), target);
+  const size_t bin = std::min<size_t>(it - this->m_cdf.begin(),
+                                      this->m_cdf.size() - 1);
+  return this->bin_value(bin);
+}
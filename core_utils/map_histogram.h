@@ -0,0 +1,238 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_MAPHISTOGRAM_H
+#define FRACTALUTILS_COREUTILS_MAPHISTOGRAM_H
+
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+
+#include "map_algorithms.h"
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+// Histogram and cumulative distribution of a map, for example of iteration
+// counts for histogram-equalised colouring. Maps are counted in parallel into
+// one private histogram per worker, which are then summed bin by bin, so no
+// bin is ever shared between threads. Counts can be added and subtracted per
+// sub-region, so the histogram of a crop is derived from the one of the whole
+// map by subtracting the border.
+class histogram_engine {
+ public:
+  enum class bin_mode : uint8_t {
+    // one bin per integer in [lo, hi], exact for iteration counts
+    integer,
+    // bins equally spaced over [lo, hi]
+    uniform,
+  };
+
+  struct options {
+    bin_mode mode{bin_mode::integer};
+    double lo{0};
+    double hi{0};
+    // number of bins in uniform mode, ignored in integer mode
+    size_t bins{256};
+  };
+
+ private:
+  options m_options;
+  std::vector<uint64_t> m_counts;
+  // m_cdf[b] is the number of elements in bins [0, b]
+  std::vector<uint64_t> m_cdf;
+  bool m_cdf_valid{false};
+  // bins per unit of value in uniform mode
+  double m_scale{0};
+  // per-worker histograms of the last accumulation
+  std::vector<uint64_t> m_scratch;
+
+  void merge_scratch(int workers, bool subtract) noexcept;
+
+  template <typename T>
+  void accumulate(constant_strided_view src, bool subtract,
+                  int threads) noexcept;
+
+ public:
+  histogram_engine() : histogram_engine{options{}} {}
+  explicit histogram_engine(const options &opt) noexcept;
+
+  [[nodiscard]] static histogram_engine integer(int64_t lo,
+                                                int64_t hi) noexcept;
+  [[nodiscard]] static histogram_engine uniform(double lo, double hi,
+                                                size_t bins) noexcept;
+
+  [[nodiscard]] inline const options &engine_options() const noexcept {
+    return this->m_options;
+  }
+  [[nodiscard]] inline size_t bin_count() const noexcept {
+    return this->m_counts.size();
+  }
+  [[nodiscard]] inline std::span<const uint64_t> counts() const noexcept {
+    return this->m_counts;
+  }
+  // number of counted elements
+  [[nodiscard]] uint64_t total() const noexcept;
+
+  // Values out of [lo, hi] fall into the first or last bin, so does NaN
+  // into the first one.
+  [[nodiscard]] inline size_t bin_of(double value) const noexcept {
+    double pos = (this->m_options.mode == bin_mode::integer)
+                     ? value - this->m_options.lo
+                     : (value - this->m_options.lo) * this->m_scale;
+    const double last = double(this->bin_count() - 1);
+    // written so that NaN fails the test, converting it to size_t is UB
+    pos = (pos >= 0.0) ? pos : 0.0;
+    pos = (pos > last) ? last : pos;
+    return size_t(pos);
+  }
+  // the smallest value of a bin
+  [[nodiscard]] double bin_value(size_t bin) const noexcept;
+
+  void clear() noexcept;
+
+  template <typename T>
+  void add(constant_strided_view src, int threads = 0) noexcept {
+    this->accumulate<T>(src, false, threads);
+  }
+  // src must have been added before
+  template <typename T>
+  void subtract(constant_strided_view src, int threads = 0) noexcept {
+    this->accumulate<T>(src, true, threads);
+  }
+  template <typename T>
+  void build(constant_strided_view src, int threads = 0) noexcept {
+    this->clear();
+    this->add<T>(src, threads);
+  }
+  // Turn the histogram of full, which must be the current one, into the
+  // histogram of full without skip_rows rows and skip_cols cols on each
+  // side, as cropped by write_png_skipped. Only the border is read.
+  template <typename T>
+  void crop(constant_strided_view full, size_t skip_rows, size_t skip_cols,
+            int threads = 0) noexcept {
+    assert(2 * skip_rows <= full.rows() && 2 * skip_cols <= full.cols());
+    const size_t rows = full.rows();
+    const size_t cols = full.cols();
+    const size_t inner_rows = rows - 2 * skip_rows;
+    this->subtract<T>(full.subview(0, 0, skip_rows, cols), threads);
+    this->subtract<T>(full.subview(rows - skip_rows, 0, skip_rows, cols),
+                      threads);
+    this->subtract<T>(full.subview(skip_rows, 0, inner_rows, skip_cols),
+                      threads);
+    this->subtract<T>(
+        full.subview(skip_rows, cols - skip_cols, inner_rows, skip_cols),
+        threads);
+  }
+
+  // Count a single value, NaN is skipped. Not thread safe.
+  inline void add_value(double value) noexcept {
+    if (std::isnan(value)) {
+      return;
+    }
+    this->m_counts[this->bin_of(value)]++;
+    this->m_cdf_valid = false;
+  }
+  // A counter for render_AB_options::fun_counter that counts the A of every
+  // pixel. It refers to this engine, which must outlive it.
+  template <typename A, typename B>
+  [[nodiscard]] std::function<void(A, B)> counter() noexcept {
+    return [this](A a, B) { this->add_value(double(a)); };
+  }
+
+  // Compute the cumulative distribution. Call it after counting and before
+  // the queries below, which are const and may run concurrently.
+  void finalize() noexcept;
+  [[nodiscard]] inline bool is_finalized() const noexcept {
+    return this->m_cdf_valid;
+  }
+
+  // Fraction of elements in the bin of value or below, in [0, 1]. This is
+  // the histogram-equalised position of value, 0 for NaN.
+  [[nodiscard]] inline double cdf(double value) const noexcept {
+    assert(this->m_cdf_valid);
+    const uint64_t total = this->m_cdf.empty() ? 0 : this->m_cdf.back();
+    if (total == 0 || std::isnan(value)) {
+      return 0;
+    }
+    return double(this->m_cdf[this->bin_of(value)]) / double(total);
+  }
+  // The smallest bin value such that at least fraction p of the elements are
+  // in its bin or below, p in [0, 1].
+  [[nodiscard]] double percentile(double p) const noexcept;
+};
+
+template <typename T>
+void histogram_engine::accumulate(constant_strided_view src, bool subtract,
+                                  int threads) noexcept {
+  assert(src.element_bytes() == sizeof(T));
+  const size_t bins = this->bin_count();
+  if (bins == 0) {
+    return;
+  }
+
+  if (this->m_options.mode == bin_mode::uniform) {
+    // the same bins as bin_of, counted by the kernel in map_algorithms.h
+    this->m_scratch.resize(bins);
+    internal::histogram_of<T>(src, this->m_options.lo, this->m_options.hi,
+                              this->m_scratch, threads);
+    this->merge_scratch(1, subtract);
+    return;
+  }
+
+  const size_t cols = src.cols();
+  const int workers =
+      internal::map_algorithm_workers(src.rows(), cols, threads);
+  this->m_scratch.assign(workers * bins, 0);
+  internal::parallel_for_rows(
+      src.rows(), workers, [&](size_t beg, size_t end, int worker) {
+        uint64_t *h = this->m_scratch.data() + worker * bins;
+        const int64_t lo = int64_t(this->m_options.lo);
+        const int64_t last = int64_t(bins) - 1;
+        for (size_t r = beg; r < end; r++) {
+          const T *s = reinterpret_cast<const T *>(src.row(r));
+          for (size_t c = 0; c < cols; c++) {
+            if constexpr (std::is_floating_point_v<T>) {
+              // NaN and values out of int64_t can't be converted to it
+              if (std::isnan(s[c])) {
+                continue;
+              }
+              h[this->bin_of(double(s[c]))]++;
+            } else {
+              int64_t b = int64_t(s[c]) - lo;
+              b = (b < 0) ? 0 : b;
+              b = (b > last) ? last : b;
+              h[b]++;
+            }
+          }
+        }
+      });
+  this->merge_scratch(workers, subtract);
+}
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_MAPHISTOGRAM_H
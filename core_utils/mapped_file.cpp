@@ -0,0 +1,174 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "mapped_file.h"
+
+#include <fmt/format.h>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace fractal_utils;
+
+mapped_file::mapped_file(mapped_file &&src) noexcept
+    : m_data{src.m_data},
+      m_size{src.m_size}
+#ifdef _WIN32
+      ,
+      m_file_handle{src.m_file_handle},
+      m_mapping_handle{src.m_mapping_handle}
+#endif
+{
+  src.m_data = nullptr;
+  src.m_size = 0;
+#ifdef _WIN32
+  src.m_file_handle = nullptr;
+  src.m_mapping_handle = nullptr;
+#endif
+}
+
+mapped_file::~mapped_file() { this->close(); }
+
+mapped_file &mapped_file::operator=(mapped_file &&src) & noexcept {
+  if (this == &src) {
+    return *this;
+  }
+  this->close();
+  std::swap(this->m_data, src.m_data);
+  std::swap(this->m_size, src.m_size);
+#ifdef _WIN32
+  std::swap(this->m_file_handle, src.m_file_handle);
+  std::swap(this->m_mapping_handle, src.m_mapping_handle);
+#endif
+  return *this;
+}
+
+#ifdef _WIN32
+
+std::string mapped_file::open(std::string_view filename) noexcept {
+  this->close();
+  const std::string name{filename};
+
+  HANDLE file = CreateFileA(name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size)) {
+    CloseHandle(file);
+    return fmt::format("Failed to get the size of {}", filename);
+  }
+
+  if (file_size.QuadPart == 0) {
+    // an empty file can not be mapped, but it is still a valid empty mapping
+    CloseHandle(file);
+    return {};
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    CloseHandle(file);
+    return fmt::format("Failed to create file mapping for {}", filename);
+  }
+
+  void *addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (addr == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return fmt::format("Failed to map {} into memory", filename);
+  }
+
+  this->m_file_handle = file;
+  this->m_mapping_handle = mapping;
+  this->m_data = reinterpret_cast<const uint8_t *>(addr);
+  this->m_size = file_size.QuadPart;
+  return {};
+}
+
+void mapped_file::close() noexcept {
+  if (this->m_data != nullptr) {
+    UnmapViewOfFile(this->m_data);
+  }
+  if (this->m_mapping_handle != nullptr) {
+    CloseHandle(this->m_mapping_handle);
+  }
+  if (this->m_file_handle != nullptr) {
+    CloseHandle(this->m_file_handle);
+  }
+  this->m_data = nullptr;
+  this->m_size = 0;
+  this->m_file_handle = nullptr;
+  this->m_mapping_handle = nullptr;
+}
+
+#else
+
+std::string mapped_file::open(std::string_view filename) noexcept {
+  this->close();
+  const std::string name{filename};
+
+  const int fd = ::open(name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return fmt::format("Failed to open file {}", filename);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return fmt::format("Failed to get the size of {}", filename);
+  }
+
+  if (st.st_size == 0) {
+    // mmap refuses zero-length mappings, but it is still a valid empty mapping
+    ::close(fd);
+    return {};
+  }
+
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return fmt::format("Failed to map {} into memory", filename);
+  }
+
+  this->m_data = reinterpret_cast<const uint8_t *>(addr);
+  this->m_size = st.st_size;
+  return {};
+}
+
+void mapped_file::close() noexcept {
+  if (this->m_data != nullptr) {
+    munmap(const_cast<uint8_t *>(this->m_data), this->m_size);
+  }
+  this->m_data = nullptr;
+  this->m_size = 0;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_MAPPEDFILE_H
+#define FRACTALUTILS_COREUTILS_MAPPEDFILE_H
+
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+namespace fractal_utils {
+
+// A read-only memory mapping of a whole file. Pages are loaded by the OS when
+// they are touched, so only the parts that are actually read cost any I/O.
+class mapped_file {
+ private:
+  const uint8_t *m_data{nullptr};
+  size_t m_size{0};
+#ifdef _WIN32
+  void *m_file_handle{nullptr};
+  void *m_mapping_handle{nullptr};
+#endif
+
+ public:
+  mapped_file() = default;
+  mapped_file(const mapped_file &) = delete;
+  mapped_file(mapped_file &&) noexcept;
+  ~mapped_file();
+
+  mapped_file &operator=(const mapped_file &) = delete;
+  mapped_file &operator=(mapped_file &&) & noexcept;
+
+  // returns error message, empty if succeeded
+  [[nodiscard]] std::string open(std::string_view filename) noexcept;
+  void close() noexcept;
+
+  [[nodiscard]] inline const uint8_t *data() const noexcept {
+    return this->m_data;
+  }
+  [[nodiscard]] inline size_t size() const noexcept { return this->m_size; }
+  [[nodiscard]] inline std::span<const uint8_t> bytes() const noexcept {
+    return {this->m_data, this->m_size};
+  }
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_MAPPEDFILE_H
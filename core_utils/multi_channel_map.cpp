@@ -0,0 +1,217 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "multi_channel_map.h"
+
+#include <cstring>
+#include <fmt/format.h>
+
+#include "binary_archive.h"
+
+using namespace fractal_utils;
+
+namespace {
+// a * b, false if it doesn't fit in size_t
+bool checked_mul(size_t a, size_t b, size_t &product) noexcept {
+  if (b != 0 && a > SIZE_MAX / b) {
+    return false;
+  }
+  product = a * b;
+  return true;
+}
+}  // namespace
+
+multi_channel_map::multi_channel_map(size_t r, size_t c,
+                                     std::span<const size_t> channel_bytes)
+    : multi_channel_map{r, c, channel_bytes,
+                        map_allocator::default_allocator()} {}
+
+multi_channel_map::multi_channel_map(size_t r, size_t c,
+                                     std::span<const size_t> channel_bytes,
+                                     map_allocator &allocator)
+    : m_allocator{&allocator} {
+  this->reset(r, c, channel_bytes);
+}
+
+multi_channel_map::multi_channel_map(multi_channel_map &&src) noexcept
+    : internal::map_shape{src},
+      m_data{std::move(src.m_data)},
+      m_allocator{src.m_allocator},
+      m_channel_bytes{std::move(src.m_channel_bytes)},
+      m_offsets{std::move(src.m_offsets)} {
+  src.clear_moved_from();
+}
+
+multi_channel_map &multi_channel_map::operator=(
+    multi_channel_map &&src) & noexcept {
+  if (this == &src) {
+    return *this;
+  }
+  static_cast<internal::map_shape &>(*this) = src;
+  this->m_data = std::move(src.m_data);
+  this->m_allocator = src.m_allocator;
+  this->m_channel_bytes = std::move(src.m_channel_bytes);
+  this->m_offsets = std::move(src.m_offsets);
+  src.clear_moved_from();
+  return *this;
+}
+
+void multi_channel_map::clear_moved_from() noexcept {
+  this->m_data.get_deleter().bytes = 0;
+  this->m_rows = 0;
+  this->m_cols = 0;
+  this->m_channel_bytes.clear();
+  this->m_offsets.clear();
+}
+
+uint8_t *multi_channel_map::plane(size_t ch) const noexcept {
+  assert(ch < this->channel_count());
+  return reinterpret_cast<uint8_t *>(this->m_data.get()) +
+         this->m_offsets[ch];
+}
+
+void multi_channel_map::reset(size_t r, size_t c,
+                              std::span<const size_t> channel_bytes) noexcept {
+  this->m_rows = r;
+  this->m_cols = c;
+  this->m_channel_bytes.assign(channel_bytes.begin(), channel_bytes.end());
+  this->m_offsets.resize(channel_bytes.size());
+
+  size_t bytes = 0;
+  for (size_t ch = 0; ch < channel_bytes.size(); ch++) {
+    this->m_offsets[ch] = bytes;
+    const size_t plane_bytes = r * c * channel_bytes[ch];
+    bytes += (plane_bytes + plane_alignment - 1) / plane_alignment *
+             plane_alignment;
+  }
+
+  if (bytes > this->capacity_bytes()) {
+    this->m_data.reset();
+    void *data = this->m_allocator->allocate(bytes);
+    this->m_data = std::unique_ptr<void, internal::void_deleter>{
+        data, internal::void_deleter{this->m_allocator,
+                                     data == nullptr ? 0 : bytes}};
+  }
+}
+
+void multi_channel_map::resize(size_t r, size_t c) noexcept {
+  // reset assigns m_channel_bytes from the span, which must not alias it
+  const std::vector<size_t> channel_bytes{this->m_channel_bytes};
+  this->reset(r, c, channel_bytes);
+}
+
+map_view multi_channel_map::channel(size_t ch) noexcept {
+  return map_view{this->plane(ch), this->rows(), this->cols(),
+                  this->m_channel_bytes[ch]};
+}
+
+constant_view multi_channel_map::channel(size_t ch) const noexcept {
+  return constant_view{this->plane(ch), this->rows(), this->cols(),
+                       this->m_channel_bytes[ch]};
+}
+
+void multi_channel_map::append_to(binary_archive &archive,
+                                  int64_t first_tag) const noexcept {
+  // rows, cols, channel count, then element bytes of each channel
+  std::vector<uint8_t> layout((3 + this->channel_count()) * sizeof(uint64_t));
+  auto *dst = reinterpret_cast<uint64_t *>(layout.data());
+  dst[0] = this->rows();
+  dst[1] = this->cols();
+  dst[2] = this->channel_count();
+  for (size_t ch = 0; ch < this->channel_count(); ch++) {
+    dst[3 + ch] = this->m_channel_bytes[ch];
+  }
+
+  auto &segments = archive.segments();
+  segments.emplace_back(first_tag, std::move(layout));
+  for (size_t ch = 0; ch < this->channel_count(); ch++) {
+    const constant_view view = this->channel(ch);
+    segments.emplace_back(
+        first_tag + 1 + int64_t(ch),
+        std::span<const uint8_t>{
+            reinterpret_cast<const uint8_t *>(view.data()), view.bytes()});
+  }
+}
+
+std::string multi_channel_map::load_from(const binary_archive &archive,
+                                         int64_t first_tag) noexcept {
+  const data_segment *layout_seg = archive.find_first_of(first_tag);
+  if (layout_seg == nullptr || !layout_seg->has_data()) {
+    return fmt::format("No multi-channel layout found at tag {}", first_tag);
+  }
+  if (layout_seg->bytes() < 3 * sizeof(uint64_t) ||
+      layout_seg->bytes() % sizeof(uint64_t) != 0) {
+    return fmt::format("Invalid multi-channel layout of {} bytes",
+                       layout_seg->bytes());
+  }
+  std::vector<uint64_t> layout(layout_seg->bytes() / sizeof(uint64_t));
+  memcpy(layout.data(), layout_seg->data(), layout_seg->bytes());
+  if (layout[2] != layout.size() - 3) {
+    return fmt::format(
+        "Invalid multi-channel layout, {} channels but {} element sizes",
+        layout[2], layout.size() - 3);
+  }
+
+  const std::vector<size_t> channel_bytes{layout.begin() + 3, layout.end()};
+  // check the layout against the channels before allocating for it
+  std::vector<const data_segment *> segments(channel_bytes.size());
+  size_t total_bytes = 0;
+  for (size_t ch = 0; ch < channel_bytes.size(); ch++) {
+    size_t elements;
+    size_t bytes;
+    if (!checked_mul(layout[0], layout[1], elements) ||
+        !checked_mul(elements, channel_bytes[ch], bytes) ||
+        bytes > SIZE_MAX - total_bytes - plane_alignment) {
+      return fmt::format(
+          "Invalid multi-channel layout, {} rows and {} cols of {} bytes "
+          "are too large",
+          layout[0], layout[1], channel_bytes[ch]);
+    }
+    total_bytes += bytes + plane_alignment;
+
+    const int64_t tag = first_tag + 1 + int64_t(ch);
+    segments[ch] = archive.find_first_of(tag);
+    if (segments[ch] == nullptr || !segments[ch]->has_data()) {
+      return fmt::format("Channel {} is missing, expected at tag {}", ch,
+                         tag);
+    }
+    if (segments[ch]->bytes() != bytes) {
+      return fmt::format(
+          "Channel {} has {} bytes, but {} rows and {} cols of {} bytes "
+          "need {}",
+          ch, segments[ch]->bytes(), layout[0], layout[1], channel_bytes[ch],
+          bytes);
+    }
+  }
+
+  this->reset(layout[0], layout[1], channel_bytes);
+  if (this->m_data == nullptr && this->channel_count() > 0 &&
+      this->size() > 0) {
+    return fmt::format("Failed to allocate memory for {} rows and {} cols",
+                       this->rows(), this->cols());
+  }
+
+  for (size_t ch = 0; ch < this->channel_count(); ch++) {
+    map_view view = this->channel(ch);
+    memcpy(view.data(), segments[ch]->data(), view.bytes());
+  }
+  return {};
+}
@@ -0,0 +1,164 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_MULTICHANNELMAP_H
+#define FRACTALUTILS_COREUTILS_MULTICHANNELMAP_H
+
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "map_allocator.h"
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+class binary_archive;
+
+// Several maps of the same shape, such as iteration counts, final |z|^2 and
+// distance estimates, stored as one plane per channel (structure of arrays)
+// in a single allocation. Every plane starts at a multiple of 64 bytes, so a
+// loop over one channel streams through contiguous, aligned memory.
+class multi_channel_map : public internal::map_shape {
+ private:
+  std::unique_ptr<void, internal::void_deleter> m_data{nullptr};
+  map_allocator *m_allocator{&map_allocator::default_allocator()};
+  // element bytes of each channel
+  std::vector<size_t> m_channel_bytes;
+  // offset of each plane in the allocation
+  std::vector<size_t> m_offsets;
+
+  [[nodiscard]] uint8_t *plane(size_t ch) const noexcept;
+  // unique_ptr leaves the deleter of a moved-from pointer untouched, so the
+  // capacity it records must be cleared by hand
+  void clear_moved_from() noexcept;
+
+ public:
+  static constexpr size_t plane_alignment = 64;
+
+  multi_channel_map() = default;
+  // The source is left empty and can be reset and used again.
+  multi_channel_map(multi_channel_map &&src) noexcept;
+  multi_channel_map(const multi_channel_map &) = delete;
+  multi_channel_map(size_t r, size_t c,
+                    std::span<const size_t> channel_bytes);
+  multi_channel_map(size_t r, size_t c,
+                    std::initializer_list<size_t> channel_bytes)
+      : multi_channel_map{r, c,
+                          std::span<const size_t>{channel_bytes.begin(),
+                                                  channel_bytes.size()}} {}
+  // The allocator must outlive this map.
+  multi_channel_map(size_t r, size_t c, std::span<const size_t> channel_bytes,
+                    map_allocator &allocator);
+
+  multi_channel_map &operator=(multi_channel_map &&src) & noexcept;
+  multi_channel_map &operator=(const multi_channel_map &) = delete;
+
+  // Reallocate only if the new layout needs more memory.
+  void reset(size_t r, size_t c,
+             std::span<const size_t> channel_bytes) noexcept;
+  // Keep the channels, change the shape.
+  void resize(size_t r, size_t c) noexcept;
+
+  [[nodiscard]] inline size_t channel_count() const noexcept {
+    return this->m_channel_bytes.size();
+  }
+  [[nodiscard]] inline std::span<const size_t> channel_element_bytes()
+      const noexcept {
+    return this->m_channel_bytes;
+  }
+  // total bytes of the allocation, padding included
+  [[nodiscard]] inline size_t capacity_bytes() const noexcept {
+    return this->m_data.get_deleter().bytes;
+  }
+
+  [[nodiscard]] map_view channel(size_t ch) noexcept;
+  [[nodiscard]] constant_view channel(size_t ch) const noexcept;
+
+  [[nodiscard]] inline map_allocator &allocator() const noexcept {
+    return *this->m_allocator;
+  }
+
+  // Append a layout segment with tag first_tag, followed by one segment per
+  // channel with tags first_tag + 1, first_tag + 2, ... The channel segments
+  // are views into this map, so it must outlive the archive or be saved
+  // before it changes. Set the encoding of each segment afterwards to
+  // compress channels differently.
+  void append_to(binary_archive &archive, int64_t first_tag) const noexcept;
+  // Reshape to the layout stored at first_tag and copy the channels in.
+  // Returns error message, empty if succeeded.
+  [[nodiscard]] std::string load_from(const binary_archive &archive,
+                                      int64_t first_tag) noexcept;
+};
+
+// multi_channel_map with a C++ type for each channel.
+template <typename... Ts>
+class soa_map : public multi_channel_map {
+  static_assert(sizeof...(Ts) > 0, "soa_map needs at least one channel");
+
+ public:
+  template <size_t I>
+  using channel_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+  static constexpr size_t channels = sizeof...(Ts);
+  static constexpr size_t element_bytes[channels]{sizeof(Ts)...};
+
+  soa_map() = default;
+  soa_map(size_t r, size_t c)
+      : multi_channel_map{r, c, std::span<const size_t>{element_bytes}} {}
+  soa_map(size_t r, size_t c, map_allocator &allocator)
+      : multi_channel_map{r, c, std::span<const size_t>{element_bytes},
+                          allocator} {}
+
+  void reset(size_t r, size_t c) noexcept {
+    multi_channel_map::reset(r, c, std::span<const size_t>{element_bytes});
+  }
+
+  template <size_t I>
+  [[nodiscard]] std::span<channel_type<I>> items() noexcept {
+    auto view = this->channel(I);
+    return {reinterpret_cast<channel_type<I> *>(view.data()), view.size()};
+  }
+  template <size_t I>
+  [[nodiscard]] std::span<const channel_type<I>> items() const noexcept {
+    auto view = this->channel(I);
+    return {reinterpret_cast<const channel_type<I> *>(view.data()),
+            view.size()};
+  }
+
+  template <size_t I>
+  channel_type<I> &at(size_t r, size_t c) noexcept {
+    return this->items<I>()[r * this->cols() + c];
+  }
+  template <size_t I>
+  const channel_type<I> &at(size_t r, size_t c) const noexcept {
+    return this->items<I>()[r * this->cols() + c];
+  }
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_MULTICHANNELMAP_H
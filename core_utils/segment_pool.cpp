@@ -0,0 +1,140 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "segment_pool.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <utility>
+
+#include "fractal_map.h"
+
+using namespace fractal_utils;
+
+namespace {
+// larger sizes would wrap when rounded up
+constexpr size_t max_request_bytes = SIZE_MAX - segment_pool::alignment;
+
+constexpr size_t align_up(size_t bytes) noexcept {
+  return (bytes + segment_pool::alignment - 1) / segment_pool::alignment *
+         segment_pool::alignment;
+}
+}  // namespace
+
+segment_pool::segment_pool(size_t block_bytes) noexcept
+    : m_block_bytes{
+          align_up(std::clamp<size_t>(block_bytes, 1, max_request_bytes))} {}
+
+segment_pool::segment_pool(segment_pool &&src) noexcept
+    : m_blocks{std::move(src.m_blocks)},
+      m_current{src.m_current},
+      m_used{src.m_used},
+      m_block_bytes{src.m_block_bytes} {
+  src.m_blocks.clear();
+  src.m_current = 0;
+  src.m_used = 0;
+}
+
+segment_pool::~segment_pool() { this->release(); }
+
+segment_pool &segment_pool::operator=(segment_pool &&src) & noexcept {
+  if (this == &src) {
+    return *this;
+  }
+  this->release();
+  std::swap(this->m_blocks, src.m_blocks);
+  std::swap(this->m_current, src.m_current);
+  std::swap(this->m_used, src.m_used);
+  std::swap(this->m_block_bytes, src.m_block_bytes);
+  return *this;
+}
+
+bool segment_pool::add_block(size_t min_bytes) noexcept {
+  if (min_bytes > max_request_bytes) {
+    return false;
+  }
+  const size_t bytes = std::max(this->m_block_bytes, align_up(min_bytes));
+  try {
+    this->m_blocks.reserve(this->m_blocks.size() + 1);
+  } catch (...) {
+    return false;
+  }
+  void *data = allocate_memory_aligned(alignment, bytes);
+  if (data == nullptr) {
+    return false;
+  }
+  this->m_blocks.emplace_back(block{reinterpret_cast<uint8_t *>(data), bytes});
+  return true;
+}
+
+std::span<uint8_t> segment_pool::allocate(size_t bytes) noexcept {
+  if (bytes > max_request_bytes) {
+    return {};
+  }
+  const size_t aligned_bytes = align_up(bytes);
+  // blocks too small for this request are skipped until the next reset
+  while (this->m_current < this->m_blocks.size()) {
+    const auto &blk = this->m_blocks[this->m_current];
+    if (blk.bytes - this->m_used >= aligned_bytes) {
+      uint8_t *ret = blk.data + this->m_used;
+      this->m_used += aligned_bytes;
+      return {ret, bytes};
+    }
+    this->m_current++;
+    this->m_used = 0;
+  }
+
+  if (!this->add_block(aligned_bytes)) {
+    return {};
+  }
+  this->m_current = this->m_blocks.size() - 1;
+  this->m_used = aligned_bytes;
+  return {this->m_blocks.back().data, bytes};
+}
+
+void segment_pool::reset() noexcept {
+  this->m_current = 0;
+  this->m_used = 0;
+}
+
+void segment_pool::release() noexcept {
+  for (auto &blk : this->m_blocks) {
+    free_memory_aligned(blk.data);
+  }
+  this->m_blocks.clear();
+  this->reset();
+}
+
+bool segment_pool::reserve(size_t bytes) noexcept {
+  const size_t cap = this->capacity_bytes();
+  if (cap >= bytes) {
+    return true;
+  }
+  return this->add_block(bytes - cap);
+}
+
+size_t segment_pool::capacity_bytes() const noexcept {
+  size_t ret = 0;
+  for (const auto &blk : this->m_blocks) {
+    ret += blk.bytes;
+  }
+  return ret;
+}
@@ -0,0 +1,88 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_SEGMENTPOOL_H
+#define FRACTALUTILS_COREUTILS_SEGMENTPOOL_H
+
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace fractal_utils {
+
+// Memory that archives are loaded into again and again. Allocations are
+// carved from large aligned blocks, and reset() makes the whole pool free
+// without returning the blocks to the system. Once the pool has grown to fit
+// the archives loaded into it, allocating from it never touches the heap.
+//
+// Not thread safe, use one pool per thread.
+class segment_pool {
+ public:
+  // every allocation starts at a multiple of this
+  static constexpr size_t alignment = 64;
+
+ private:
+  struct block {
+    uint8_t *data;
+    size_t bytes;
+  };
+  std::vector<block> m_blocks;
+  // index of the block that allocations are carved from
+  size_t m_current{0};
+  // bytes used in the current block
+  size_t m_used{0};
+  size_t m_block_bytes;
+
+ public:
+  explicit segment_pool(size_t block_bytes = size_t(1) << 24) noexcept;
+  segment_pool(const segment_pool &) = delete;
+  segment_pool(segment_pool &&) noexcept;
+  ~segment_pool();
+
+  segment_pool &operator=(const segment_pool &) = delete;
+  segment_pool &operator=(segment_pool &&) & noexcept;
+
+  // The returned span has a null data pointer if the memory can't be
+  // allocated, or if bytes is too large to be rounded up to the alignment.
+  [[nodiscard]] std::span<uint8_t> allocate(size_t bytes) noexcept;
+
+  // Make all memory free again, keeping the blocks. Everything allocated
+  // before must not be used any more.
+  void reset() noexcept;
+  // reset() and free all blocks
+  void release() noexcept;
+  // Grow the total capacity to at least this many bytes. Returns false if out
+  // of memory.
+  bool reserve(size_t bytes) noexcept;
+
+  [[nodiscard]] size_t capacity_bytes() const noexcept;
+  [[nodiscard]] inline size_t block_count() const noexcept {
+    return this->m_blocks.size();
+  }
+
+ private:
+  bool add_block(size_t min_bytes) noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_SEGMENTPOOL_H
@@ -19,16 +19,40 @@ This file is part of FractalUtils.
     github:https://github.com/ToKiNoBug
 */
 
+#include <algorithm>
 #include <cstring>
+#include <filesystem>
 #include <fmt/format.h>
+#include <fstream>
+#include <iterator>
 #include <stdio.h>
 
+#include "archive_checksum.h"
 #include "binary_archive.h"
+#include "segment_pool.h"
 
 bool generate_file(const char *const filename);
 
 bool parse_file(const char *const filename);
 
+bool parse_file_mapped(const char *const filename);
+
+bool parse_file_indexed(const char *const filename);
+
+bool test_codecs();
+
+bool test_parallel();
+
+bool test_checksum();
+
+bool test_pool();
+
+bool test_held_segments();
+
+bool test_broken_descriptor();
+
+bool test_corrupt_length();
+
 int main() {
   if (!generate_file("test.archive")) {
     return 1;
@@ -36,6 +60,39 @@ int main() {
   if (!parse_file("test.archive")) {
     return 1;
   }
+  if (!parse_file_mapped("test.archive")) {
+    return 1;
+  }
+  if (!parse_file_mapped("test_indexed.archive")) {
+    return 1;
+  }
+  if (!parse_file_indexed("test.archive")) {
+    return 1;
+  }
+  if (!parse_file_indexed("test_indexed.archive")) {
+    return 1;
+  }
+  if (!test_codecs()) {
+    return 1;
+  }
+  if (!test_parallel()) {
+    return 1;
+  }
+  if (!test_checksum()) {
+    return 1;
+  }
+  if (!test_pool()) {
+    return 1;
+  }
+  if (!test_held_segments()) {
+    return 1;
+  }
+  if (!test_broken_descriptor()) {
+    return 1;
+  }
+  if (!test_corrupt_length()) {
+    return 1;
+  }
 
   return 0;
 }
@@ -54,17 +111,27 @@ bool generate_file(const char *const filename) {
     std::fill(data.begin(), data.end(), 255);
     archive.segments().emplace_back(
         fractal_utils::data_segment{1, std::move(data)});
+
+    data.resize(114514);
+    std::fill(data.begin(), data.end(), 7);
+    archive.segments().emplace_back(
+        fractal_utils::data_segment{5, std::move(data)});
   }
 
-  const auto err = archive.save(filename);
+  auto err = archive.save(filename);
 
   if (!err.empty()) {
     fmt::print("Failed. Detail: {}\n", err);
     return false;
-  } else {
-    printf("Success\n");
-    return true;
   }
+
+  err = archive.save("test_indexed.archive", {.write_index = true});
+  if (!err.empty()) {
+    fmt::print("Failed to save with index. Detail: {}\n", err);
+    return false;
+  }
+  printf("Success\n");
+  return true;
 }
 
 bool parse_file(const char *const filename) {
@@ -91,4 +158,522 @@ bool parse_file(const char *const filename) {
   }
 
   return true;
-}
\ No newline at end of file
+}
+bool parse_file_mapped(const char *const filename) {
+  fractal_utils::binary_archive archive;
+  fractal_utils::binary_archive reference;
+
+  printf("parsing binfile with memory mapping...\n");
+
+  auto err = archive.load_mapped(filename);
+  if (!err.empty()) {
+    fmt::print("parse_file_mapped failed, detail: {}\n", err);
+    return false;
+  }
+  err = reference.load(std::string_view{filename});
+  if (!err.empty()) {
+    fmt::print("parse_file_mapped failed to load reference, detail: {}\n",
+               err);
+    return false;
+  }
+
+  if (archive.segments().size() != reference.segments().size()) {
+    fmt::print("parse_file_mapped got {} segments, but {} expected\n",
+               archive.segments().size(), reference.segments().size());
+    return false;
+  }
+
+  for (size_t i = 0; i < archive.segments().size(); i++) {
+    const auto &seg = archive.segments()[i];
+    const auto &ref = reference.segments()[i];
+    if (seg.tag() != ref.tag() || seg.bytes() != ref.bytes() ||
+        seg.has_ownership() ||
+        memcmp(seg.data(), ref.data(), seg.bytes()) != 0) {
+      fmt::print("parse_file_mapped: block {} differs from the reference\n",
+                 i);
+      return false;
+    }
+  }
+
+  fmt::print("parse_file_mapped succeeded\n");
+  return true;
+}
+
+bool parse_file_indexed(const char *const filename) {
+  fractal_utils::binary_archive archive;
+
+  fmt::print("parsing {} by index...\n", filename);
+
+  auto err = archive.open_indexed(filename);
+  if (!err.empty()) {
+    fmt::print("parse_file_indexed failed, detail: {}\n", err);
+    return false;
+  }
+
+  if (archive.segments().size() != 3) {
+    fmt::print("parse_file_indexed got {} segments, but 3 expected\n",
+               archive.segments().size());
+    return false;
+  }
+
+  auto *seg = archive.find_first_of(5);
+  if (seg == nullptr || seg->has_data() || seg->bytes() != 114514) {
+    fmt::print("parse_file_indexed failed to find segment with tag 5\n");
+    return false;
+  }
+  err = archive.fetch(*seg);
+  if (!err.empty() || !seg->has_data()) {
+    fmt::print("parse_file_indexed failed to fetch, detail: {}\n", err);
+    return false;
+  }
+  const auto *begin = reinterpret_cast<const uint8_t *>(seg->data());
+  if (std::any_of(begin, begin + seg->bytes(),
+                  [](uint8_t v) { return v != 7; })) {
+    fmt::print("parse_file_indexed fetched wrong data\n");
+    return false;
+  }
+
+  if (archive.find_last_of(1) != &archive.segments()[1] ||
+      archive.segments()[0].has_data()) {
+    fmt::print("parse_file_indexed: find_last_of(1) is wrong\n");
+    return false;
+  }
+
+  fmt::print("parse_file_indexed succeeded\n");
+  return true;
+}
+
+bool test_codecs() {
+  using namespace fractal_utils;
+  // a smooth uint16_t map, like iteration counts
+  std::vector<uint8_t> raw;
+  raw.resize(512 * 512 * sizeof(uint16_t));
+  for (size_t i = 0; i < raw.size() / sizeof(uint16_t); i++) {
+    const uint16_t val = uint16_t((i % 512) / 3 + (i / 512) / 5);
+    memcpy(raw.data() + i * sizeof(uint16_t), &val, sizeof(uint16_t));
+  }
+
+  const segment_encoding encodings[] = {
+      {segment_codec::identity, 2},
+      {segment_codec::deflate, 0},
+      {segment_codec::deflate, 2},
+      {segment_codec::zstd, 2},
+  };
+
+  for (const auto &enc : encodings) {
+    binary_archive archive;
+    archive.segments().emplace_back(data_segment{3, raw});
+    archive.segments().back().set_encoding(enc);
+    archive.segments().emplace_back(data_segment{4, raw});
+
+    const char *filename = "test_codec.archive";
+    auto err = archive.save(filename, {.write_index = true});
+    if (!err.empty()) {
+      fmt::print("test_codecs failed to save, detail: {}\n", err);
+      return false;
+    }
+
+    binary_archive loaded[3];
+    err = loaded[0].load(std::string_view{filename});
+    if (err.empty()) {
+      err = loaded[1].load_mapped(filename);
+    }
+    if (err.empty()) {
+      err = loaded[2].open_indexed(filename);
+    }
+    if (err.empty()) {
+      err = loaded[2].fetch_all();
+    }
+    if (!err.empty()) {
+      fmt::print("test_codecs failed to load, detail: {}\n", err);
+      return false;
+    }
+
+    for (auto &ar : loaded) {
+      const auto *seg = ar.find_first_of(3);
+      if (ar.segments().size() != 2 || seg == nullptr ||
+          seg->bytes() != raw.size() ||
+          memcmp(seg->data(), raw.data(), raw.size()) != 0) {
+        fmt::print("test_codecs: decoded data differs with codec {}\n",
+                   int(enc.codec));
+        return false;
+      }
+    }
+    fmt::print("codec {}, delta width {} : file size = {} bytes\n",
+               int(enc.codec), int(enc.delta_width),
+               std::filesystem::file_size(filename));
+  }
+  fmt::print("test_codecs succeeded\n");
+  return true;
+}
+
+std::vector<uint8_t> read_whole_file(const char *filename) {
+  std::ifstream ifs{filename, std::ios::binary};
+  return {std::istreambuf_iterator<char>{ifs},
+          std::istreambuf_iterator<char>{}};
+}
+
+bool test_parallel() {
+  using namespace fractal_utils;
+  binary_archive archive;
+  for (int64_t tag = 0; tag < 8; tag++) {
+    std::vector<uint8_t> data;
+    // plain segments 0 and 6 are larger than the pieces written by one worker
+    data.resize((tag % 6 == 0) ? (size_t(1) << 24) + 17 : 100000 * (tag + 1));
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = uint8_t((i / 1024 + i / 97) * (tag + 1));
+    }
+    archive.segments().emplace_back(data_segment{tag, std::move(data)});
+    if (tag % 2 == 1) {
+      archive.segments().back().set_encoding({segment_codec::deflate, 1});
+    }
+  }
+
+  for (bool write_index : {false, true}) {
+    auto err = archive.save("test_sequential.archive",
+                            {.write_index = write_index, .threads = 1});
+    if (err.empty()) {
+      err = archive.save("test_parallel.archive",
+                         {.write_index = write_index, .threads = 4});
+    }
+    if (!err.empty()) {
+      fmt::print("test_parallel failed to save, detail: {}\n", err);
+      return false;
+    }
+    if (read_whole_file("test_sequential.archive") !=
+        read_whole_file("test_parallel.archive")) {
+      fmt::print(
+          "test_parallel: parallel save differs from sequential save, "
+          "write_index = {}\n",
+          write_index);
+      return false;
+    }
+
+    binary_archive loaded;
+    err = loaded.load_parallel("test_parallel.archive", 4);
+    if (!err.empty()) {
+      fmt::print("test_parallel failed to load, detail: {}\n", err);
+      return false;
+    }
+    if (loaded.segments().size() != archive.segments().size()) {
+      fmt::print("test_parallel: segment number mismatch\n");
+      return false;
+    }
+    for (size_t i = 0; i < loaded.segments().size(); i++) {
+      const auto &a = archive.segments()[i];
+      const auto &b = loaded.segments()[i];
+      if (a.tag() != b.tag() || a.bytes() != b.bytes() ||
+          memcmp(a.data(), b.data(), a.bytes()) != 0) {
+        fmt::print("test_parallel: segment {} differs after loading\n", i);
+        return false;
+      }
+    }
+  }
+  fmt::print("test_parallel succeeded\n");
+  return true;
+}
+
+bool test_checksum() {
+  using namespace fractal_utils;
+  {
+    const char *check = "123456789";
+    if (internal::crc32c(0, {reinterpret_cast<const uint8_t *>(check), 9}) !=
+        0xE3069283) {
+      fmt::print("test_checksum: wrong crc32c of the check string\n");
+      return false;
+    }
+  }
+
+  std::vector<uint8_t> data;
+  data.resize(1000003);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = uint8_t(i * 7 + i / 251);
+  }
+  {
+    // checksums computed piece by piece must agree
+    const uint32_t whole = internal::crc32c(0, data);
+    uint32_t pieces{0};
+    for (size_t beg = 0; beg < data.size(); beg += 30011) {
+      pieces = internal::crc32c(
+          pieces, std::span<const uint8_t>{data}.subspan(
+                      beg, std::min<size_t>(30011, data.size() - beg)));
+    }
+    if (whole != pieces) {
+      fmt::print("test_checksum: crc32c of pieces mismatch\n");
+      return false;
+    }
+  }
+
+  binary_archive archive;
+  archive.segments().emplace_back(data_segment{1, data});
+  archive.segments().emplace_back(data_segment{2, data});
+  archive.segments().back().set_encoding({segment_codec::deflate, 1});
+
+  const char *filename = "test_checksum.archive";
+  for (int threads : {1, 4}) {
+    auto err = archive.save(
+        filename, {.write_index = true, .threads = threads,
+                   .write_checksum = true});
+    if (!err.empty()) {
+      fmt::print("test_checksum failed to save, detail: {}\n", err);
+      return false;
+    }
+
+    archive_verify_stats stats;
+    err = binary_archive::verify(filename, &stats);
+    if (!err.empty() || stats.segments != 2 || !stats.fully_checksummed() ||
+        !stats.indexed) {
+      fmt::print("test_checksum: verification failed, detail: {}\n", err);
+      return false;
+    }
+
+    binary_archive loaded[3];
+    err = loaded[0].load(std::string_view{filename});
+    if (err.empty()) {
+      err = loaded[1].load_mapped(filename);
+    }
+    if (err.empty()) {
+      err = loaded[2].load_parallel(filename, 2);
+    }
+    if (!err.empty()) {
+      fmt::print("test_checksum failed to load, detail: {}\n", err);
+      return false;
+    }
+    for (auto &ar : loaded) {
+      for (const auto &seg : ar.segments()) {
+        if (seg.bytes() != data.size() ||
+            memcmp(seg.data(), data.data(), data.size()) != 0) {
+          fmt::print("test_checksum: loaded data differs\n");
+          return false;
+        }
+      }
+    }
+  }
+
+  // damage the plain segment
+  {
+    std::fstream fs{filename, std::ios::binary | std::ios::in | std::ios::out};
+    fs.seekp(5000);
+    const char byte = 0x5A;
+    fs.write(&byte, 1);
+  }
+  if (binary_archive::verify(filename).empty()) {
+    fmt::print("test_checksum: damaged file passed the verification\n");
+    return false;
+  }
+  binary_archive damaged;
+  if (damaged.load(std::string_view{filename}).empty()) {
+    fmt::print("test_checksum: damaged file is loaded\n");
+    return false;
+  }
+
+  // a file cut at a record boundary passes, but is not reported as indexed
+  {
+    auto err = archive.save(filename,
+                            {.write_index = true, .write_checksum = true});
+    binary_archive indexed;
+    if (err.empty()) {
+      err = indexed.open_indexed(filename);
+    }
+    if (!err.empty()) {
+      fmt::print("test_checksum failed to save or open, detail: {}\n", err);
+      return false;
+    }
+    std::filesystem::resize_file(filename, indexed.segments()[1].offset());
+    archive_verify_stats stats;
+    err = binary_archive::verify(filename, &stats);
+    if (!err.empty() || stats.segments != 1 || !stats.fully_checksummed() ||
+        stats.indexed) {
+      fmt::print("test_checksum: truncated file is reported as complete\n");
+      return false;
+    }
+  }
+
+  // files without checksums pass, but are not reported as checksummed
+  archive_verify_stats stats;
+  if (!binary_archive::verify("test.archive", &stats).empty() ||
+      stats.checksummed_segments != 0 || stats.segments != 3) {
+    fmt::print("test_checksum: failed to verify test.archive\n");
+    return false;
+  }
+
+  fmt::print("test_checksum succeeded\n");
+  return true;
+}
+
+bool test_pool() {
+  using namespace fractal_utils;
+  segment_pool pool{1 << 16};
+  binary_archive archive;
+
+  size_t blocks_after_first_load{0};
+  for (int round = 0; round < 4; round++) {
+    // segments larger and smaller than a block, and an index footer
+    pool.reset();
+    auto err = archive.load(std::string_view{"test_indexed.archive"}, pool);
+    if (!err.empty()) {
+      fmt::print("test_pool failed to load, detail: {}\n", err);
+      return false;
+    }
+    if (archive.segments().size() != 3) {
+      fmt::print("test_pool: expected 3 segments, but got {}\n",
+                 archive.segments().size());
+      return false;
+    }
+    for (const auto &seg : archive.segments()) {
+      if (seg.has_ownership() ||
+          reinterpret_cast<uintptr_t>(seg.data()) % segment_pool::alignment !=
+              0) {
+        fmt::print("test_pool: segment is not carved from the pool\n");
+        return false;
+      }
+    }
+    if (round == 0) {
+      blocks_after_first_load = pool.block_count();
+    } else if (pool.block_count() != blocks_after_first_load) {
+      fmt::print("test_pool: the pool keeps growing\n");
+      return false;
+    }
+  }
+
+  binary_archive expected;
+  if (!expected.load(std::string_view{"test.archive"}).empty()) {
+    return false;
+  }
+  for (size_t i = 0; i < expected.segments().size(); i++) {
+    const auto &a = expected.segments()[i];
+    const auto &b = archive.segments()[i];
+    if (a.tag() != b.tag() || a.bytes() != b.bytes() ||
+        memcmp(a.data(), b.data(), a.bytes()) != 0) {
+      fmt::print("test_pool: segment {} differs\n", i);
+      return false;
+    }
+  }
+
+  fmt::print("test_pool succeeded, {} blocks, {} bytes\n", pool.block_count(),
+             pool.capacity_bytes());
+  return true;
+}
+
+// Segments added or removed through a held reference to segments() must not
+// make lookups return stale or out of range segments.
+bool test_held_segments() {
+  fractal_utils::binary_archive archive;
+  auto &segments = archive.segments();
+  for (int64_t tag : {1, 2, 3}) {
+    segments.emplace_back(tag, std::vector<uint8_t>(8, uint8_t(tag)));
+  }
+
+  if (archive.find_first_of(3) != &segments[2]) {
+    fmt::print("test_held_segments: find_first_of(3) is wrong\n");
+    return false;
+  }
+
+  segments.erase(segments.begin());
+  if (archive.find_first_of(3) != &segments[1] ||
+      archive.find_last_of(3) != &segments[1]) {
+    fmt::print("test_held_segments: lookup after erase is wrong\n");
+    return false;
+  }
+
+  segments.emplace_back(4, std::vector<uint8_t>(8, 4));
+  segments.erase(segments.begin());
+  // same count as when the index was built, but 3 moved
+  if (archive.find_first_of(3) != &segments[0]) {
+    fmt::print("test_held_segments: lookup after emplace is wrong\n");
+    return false;
+  }
+
+  segments.pop_back();
+  if (archive.find_first_of(4) != nullptr ||
+      archive.find_first_of(3) != &segments[0]) {
+    fmt::print("test_held_segments: lookup after pop_back is wrong\n");
+    return false;
+  }
+
+  fmt::print("test_held_segments succeeded\n");
+  return true;
+}
+
+// A descriptor claiming an impossible decoded size must be reported as an
+// error instead of being allocated for.
+bool test_broken_descriptor() {
+  using namespace fractal_utils;
+  const uint64_t raw_bytes = 4096;
+  binary_archive archive;
+  archive.segments().emplace_back(
+      data_segment{3, std::vector<uint8_t>(raw_bytes, 1)});
+  archive.segments().back().set_encoding({segment_codec::identity, 2});
+  const char *filename = "test_broken.archive";
+  auto err = archive.save(filename);
+  if (!err.empty()) {
+    fmt::print("test_broken_descriptor failed to save, detail: {}\n", err);
+    return false;
+  }
+
+  // codec, delta width, flags and padding, then raw_bytes
+  std::vector<uint8_t> pattern(16, 0);
+  pattern[1] = 2;
+  memcpy(pattern.data() + 8, &raw_bytes, sizeof(raw_bytes));
+  std::vector<uint8_t> file = read_whole_file(filename);
+  auto it = std::search(file.begin(), file.end(), pattern.begin(),
+                        pattern.end());
+  if (it == file.end()) {
+    fmt::print("test_broken_descriptor: descriptor not found\n");
+    return false;
+  }
+  const uint64_t huge = uint64_t(1) << 62;
+  memcpy(&*it + 8, &huge, sizeof(huge));
+  {
+    std::ofstream ofs{filename, std::ios::binary};
+    ofs.write(reinterpret_cast<const char *>(file.data()), file.size());
+  }
+
+  binary_archive loaded;
+  if (loaded.load_from_memory(file).empty() ||
+      loaded.load(std::string_view{filename}).empty()) {
+    fmt::print("test_broken_descriptor: a broken descriptor was accepted\n");
+    return false;
+  }
+  fmt::print("test_broken_descriptor succeeded\n");
+  return true;
+}
+
+// A record length reaching past the end of file must be reported as an error
+// instead of being carved from the pool.
+bool test_corrupt_length() {
+  using namespace fractal_utils;
+  segment_pool pool;
+  if (pool.allocate(SIZE_MAX - 10).data() != nullptr) {
+    fmt::print("test_corrupt_length: a wrapping size is allocated\n");
+    return false;
+  }
+
+  binary_archive archive;
+  archive.segments().emplace_back(
+      data_segment{3, std::vector<uint8_t>(4096, 1)});
+  const char *filename = "test_corrupt.archive";
+  auto err = archive.save(filename);
+  if (!err.empty()) {
+    fmt::print("test_corrupt_length failed to save, detail: {}\n", err);
+    return false;
+  }
+
+  // the length follows the tag of the first record
+  std::vector<uint8_t> file = read_whole_file(filename);
+  const uint64_t length = UINT64_MAX - 10;
+  memcpy(file.data() + sizeof(file_header) + sizeof(int64_t), &length,
+         sizeof(length));
+  {
+    std::ofstream ofs{filename, std::ios::binary};
+    ofs.write(reinterpret_cast<const char *>(file.data()), file.size());
+  }
+
+  binary_archive loaded;
+  if (loaded.load(std::string_view{filename}, pool).empty()) {
+    fmt::print("test_corrupt_length: a corrupt length was accepted\n");
+    return false;
+  }
+  fmt::print("test_corrupt_length succeeded\n");
+  return true;
+}
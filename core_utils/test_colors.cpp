@@ -19,11 +19,35 @@ This file is part of FractalUtils.
     github:https://github.com/ToKiNoBug
 */
 
+#include <chrono>
+#include <limits>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
 
+#include "binary_archive.h"
 #include "fractal_colors.h"
+#include "gradient_palette.h"
+
+bool test_many();
+bool test_lut();
+bool test_sampling();
+bool test_gradient();
 
 int main() {
+  if (!test_many()) {
+    return 1;
+  }
+  if (!test_lut()) {
+    return 1;
+  }
+  if (!test_sampling()) {
+    return 1;
+  }
+  if (!test_gradient()) {
+    return 1;
+  }
+
   const uint32_t val =
       fractal_utils::color_u8c4(0.9, fractal_utils::color_series::pink);
 
@@ -42,4 +66,251 @@ int main() {
                  fractal_utils::color_series::parula)));
 
   return 0;
-}
\ No newline at end of file
+}
+
+bool test_many() {
+  using namespace fractal_utils;
+  // a 4K frame, plus an odd tail for the scalar remainder
+  const size_t pixel_num = 3840 * 2160 + 7;
+  std::vector<float> f(pixel_num);
+  for (size_t i = 0; i < pixel_num; i++) {
+    f[i] = float(i % 10007) / 10006;
+  }
+  std::vector<pixel_RGB> rgb(pixel_num);
+  std::vector<pixel_ARGB> argb(pixel_num);
+
+  for (int s = 0; s <= int(color_series::parula); s++) {
+    const color_series cs = color_series(s);
+    const auto begin = std::chrono::steady_clock::now();
+    color_u8c3_many(f.data(), cs, pixel_num, rgb.data());
+    const auto mid = std::chrono::steady_clock::now();
+    color_u8c4_many(f.data(), cs, pixel_num, argb.data());
+    const auto end = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < pixel_num; i++) {
+      const pixel_RGB expected_rgb = color_u8c3(f[i], cs);
+      if (memcmp(&expected_rgb, &rgb[i], sizeof(pixel_RGB)) != 0 ||
+          argb[i] != color_u8c4(f[i], cs)) {
+        printf("color_u8c*_many differs from color_u8c* for %s at %zu\n",
+               color_series_enum_to_str(cs), i);
+        return false;
+      }
+    }
+    if (cs == color_series::parula) {
+      printf("4K frame: color_u8c3_many %lld us, color_u8c4_many %lld us\n",
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+                 mid - begin)
+                 .count(),
+             (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+                 end - mid)
+                 .count());
+    }
+  }
+  return true;
+}
+
+bool test_lut() {
+  using namespace fractal_utils;
+  const color_lut fine = color_lut_of(color_series::jet, 4096);
+  if (!fine.is_valid() || fine.size != 4096 ||
+      color_lut_of(color_series::jet, 4096).argb != fine.argb) {
+    printf("color_lut_of failed to build or to cache a table\n");
+    return false;
+  }
+  // both ends are exact copies of the built-in table
+  if (fine.u8c4(0) != color_u8c4(0, color_series::jet) ||
+      fine.u8c4(1) != color_u8c4(1, color_series::jet)) {
+    printf("color_lut_of resampled the ends of the table\n");
+    return false;
+  }
+
+  std::vector<float> f(1000);
+  for (size_t i = 0; i < f.size(); i++) {
+    f[i] = float(i) / (f.size() - 1);
+  }
+  std::vector<pixel_RGB> rgb(f.size());
+  std::vector<pixel_ARGB> argb(f.size());
+  color_u8c3_many(f.data(), fine, f.size(), rgb.data());
+  color_u8c4_many(f.data(), fine, f.size(), argb.data());
+  for (size_t i = 0; i < f.size(); i++) {
+    const pixel_RGB expected = fine.u8c3(f[i]);
+    if (argb[i] != fine.u8c4(f[i]) ||
+        memcmp(&expected, &rgb[i], sizeof(pixel_RGB)) != 0 ||
+        pixel_RGB{argb[i]}.value[2] != expected.value[2]) {
+      printf("batch lookup in a color_lut differs at %zu\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool test_sampling() {
+  using namespace fractal_utils;
+  const color_lut lut = color_lut_of(color_series::hsv, 64);
+  // inside and outside [0, 1], the ends, NaN, infinities and an odd tail
+  std::vector<float> f(4099);
+  for (size_t i = 0; i < f.size(); i++) {
+    f[i] = float(i) / 1000 - 1.5f;
+  }
+  f[10] = 0;
+  f[11] = 1;
+  f[12] = 0x1.fffffep-1f;
+  f[13] = -0x1p-30f;
+  f[14] = std::numeric_limits<float>::quiet_NaN();
+  f[15] = std::numeric_limits<float>::infinity();
+  f[16] = -std::numeric_limits<float>::infinity();
+  std::vector<pixel_RGB> rgb(f.size());
+  std::vector<pixel_ARGB> argb(f.size());
+
+  for (color_sampling sampling :
+       {color_sampling::nearest, color_sampling::linear}) {
+    for (bool cyclic : {false, true}) {
+      const color_sample_options opt{sampling, cyclic};
+      color_u8c3_many(f.data(), lut, opt, f.size(), rgb.data());
+      color_u8c4_many(f.data(), lut, opt, f.size(), argb.data());
+      for (size_t i = 0; i < f.size(); i++) {
+        const pixel_RGB expected = color_u8c3(f[i], lut, opt);
+        if (argb[i] != color_u8c4(f[i], lut, opt) ||
+            memcmp(&expected, &rgb[i], sizeof(pixel_RGB)) != 0) {
+          printf("sampled batch differs at %zu, linear = %i, cyclic = %i\n",
+                 i, int(sampling == color_sampling::linear), int(cyclic));
+          return false;
+        }
+      }
+    }
+  }
+
+  const color_sample_options linear{color_sampling::linear, false};
+  const color_sample_options cyclic{color_sampling::linear, true};
+  // the entries are hit exactly, and halfway is the average of two entries
+  if (color_u8c4(0, lut, linear) != lut.argb[0] ||
+      color_u8c4(1, lut, linear) != lut.argb[63] ||
+      color_u8c4(2.0f / 63, lut, linear) != lut.argb[2]) {
+    printf("linear sampling misses the table entries\n");
+    return false;
+  }
+  const pixel_ARGB a = lut.argb[5];
+  const pixel_ARGB b = lut.argb[6];
+  const pixel_ARGB mid = color_u8c4(5.5f / 63, lut, linear);
+  for (int shift = 0; shift < 32; shift += 8) {
+    const int expected = (int((a >> shift) & 0xFF) +
+                          int((b >> shift) & 0xFF) + 1) / 2;
+    if (int((mid >> shift) & 0xFF) != expected) {
+      printf("linear sampling does not blend halfway\n");
+      return false;
+    }
+  }
+  // cyclic sampling repeats with period 1 and wraps around the last entry
+  if (color_u8c4(0.25f, lut, cyclic) != color_u8c4(3.25f, lut, cyclic) ||
+      color_u8c4(0.25f, lut, cyclic) != color_u8c4(-0.75f, lut, cyclic) ||
+      color_u8c4(1, lut, cyclic) != lut.argb[0]) {
+    printf("cyclic sampling is not periodic\n");
+    return false;
+  }
+  return true;
+}
+
+bool test_gradient() {
+  using namespace fractal_utils;
+  std::string err;
+  // black to white in sRGB gives a plain grey ramp
+  gradient_palette grey{gradient_space::rgb, {{0, {0, 0, 0}}, {1, {1, 1, 1}}}};
+  err = grey.compile(256);
+  if (!err.empty()) {
+    printf("Failed to compile a gradient: %s\n", err.c_str());
+    return false;
+  }
+  const color_lut grey_lut = grey.lut();
+  for (uint32_t i = 0; i < 256; i++) {
+    if (grey_lut.argb[i] != (0xFF000000U | (i << 16) | (i << 8) | i)) {
+      printf("grey gradient is wrong at %u: 0x%X\n", i, grey_lut.argb[i]);
+      return false;
+    }
+  }
+
+  // red to blue through magenta, the shorter way round the hue circle
+  gradient_palette hue{gradient_space::hsv,
+                       {{0, {0, 1, 1}}, {1, {240, 1, 1}}}};
+  // stops out of order and beyond [0, 1]
+  gradient_palette lab{gradient_space::oklab, {}};
+  lab.add_stop(0.8f, pixel_RGB{255, 255, 0});
+  lab.add_stop(0.2f, pixel_RGB{0, 0, 255});
+  if (!hue.compile(3).empty() || !lab.compile().empty()) {
+    printf("Failed to compile a gradient\n");
+    return false;
+  }
+  if (hue.lut().argb[1] != 0xFFFF00FFU) {
+    printf("hsv gradient did not pass through magenta: 0x%X\n",
+           hue.lut().argb[1]);
+    return false;
+  }
+  const color_lut lab_lut = lab.lut();
+  if (lab_lut.u8c4(0) != 0xFF0000FFU || lab_lut.u8c4(0.2f) != 0xFF0000FFU ||
+      lab_lut.u8c4(0.81f) != 0xFFFFFF00U || lab_lut.u8c4(1) != 0xFFFFFF00U) {
+    printf("oklab gradient does not hold its stops\n");
+    return false;
+  }
+  if (gradient_palette{}.compile().empty() ||
+      grey.compile(1).empty()) {
+    printf("Invalid gradients were compiled\n");
+    return false;
+  }
+
+  // the batch kernels accept the compiled table like any other
+  std::vector<float> f(1001);
+  for (size_t i = 0; i < f.size(); i++) {
+    f[i] = float(i) / 1000;
+  }
+  std::vector<pixel_ARGB> argb(f.size());
+  const color_sample_options linear{color_sampling::linear, false};
+  color_u8c4_many(f.data(), lab_lut, linear, f.size(), argb.data());
+  for (size_t i = 0; i < f.size(); i++) {
+    if (argb[i] != color_u8c4(f[i], lab_lut, linear)) {
+      printf("batch sampling of a gradient differs at %zu\n", i);
+      return false;
+    }
+  }
+
+  binary_archive archive;
+  lab.append_to(archive, 42);
+  gradient_palette loaded;
+  err = loaded.load_from(archive, 42);
+  if (!err.empty()) {
+    printf("Failed to load a gradient: %s\n", err.c_str());
+    return false;
+  }
+  if (loaded.space() != gradient_space::oklab ||
+      loaded.lut().size != lab_lut.size ||
+      memcmp(loaded.lut().argb, lab_lut.argb,
+             lab_lut.size * sizeof(pixel_ARGB)) != 0) {
+    printf("Loaded gradient differs from the saved one\n");
+    return false;
+  }
+  if (loaded.load_from(archive, 43).empty()) {
+    printf("Loaded a gradient from a missing segment\n");
+    return false;
+  }
+
+  // broken segments are rejected and leave the loaded palette untouched
+  const uint64_t broken_headers[][3]{
+      // stops * 16 bytes wraps around to 0
+      {uint64_t(gradient_space::rgb), 256, uint64_t(1) << 60},
+      // the stop fits, but the table size is invalid
+      {uint64_t(gradient_space::rgb), 1, 1},
+  };
+  int64_t tag = 44;
+  for (const auto &header : broken_headers) {
+    std::vector<uint8_t> bytes(sizeof(header) +
+                               header[2] * 4 * sizeof(float));
+    memcpy(bytes.data(), header, sizeof(header));
+    archive.segments().emplace_back(tag, std::move(bytes));
+    if (loaded.load_from(archive, tag).empty() ||
+        loaded.space() != gradient_space::oklab ||
+        loaded.stops().size() != lab.stops().size()) {
+      printf("A broken gradient segment is loaded\n");
+      return false;
+    }
+    tag++;
+  }
+  return true;
+}
@@ -0,0 +1,191 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <fmt/format.h>
+#include <limits>
+#include <numeric>
+
+#include "map_algorithms.h"
+#include "map_histogram.h"
+#include "unique_map.h"
+
+bool test_algorithms();
+bool test_histogram();
+
+int main() {
+  if (!test_algorithms()) {
+    return 1;
+  }
+  if (!test_histogram()) {
+    return 1;
+  }
+  return 0;
+}
+
+bool test_algorithms() {
+  using namespace fractal_utils;
+  // large enough to be split among several workers
+  unique_map iters{541, 960, sizeof(uint16_t)};
+  for (size_t r = 0; r < iters.rows(); r++) {
+    for (size_t c = 0; c < iters.cols(); c++) {
+      iters.at<uint16_t>(r, c) = (r * 7 + c * 13) % 1000 + 5;
+    }
+  }
+
+  const constant_view iters_view{iters};
+  const std::pair<uint16_t, uint16_t> range =
+      minmax<uint16_t>(iters_view, 4);
+  const uint16_t lo = range.first;
+  const uint16_t hi = range.second;
+  if (lo != 5 || hi != 1004) {
+    fmt::print("test_algorithms: minmax gives [{}, {}]\n", lo, hi);
+    return false;
+  }
+
+  const uint64_t sum = reduce<uint16_t>(
+      iters_view, uint64_t(0), [](uint64_t acc, uint16_t v) { return acc + v; },
+      std::plus<uint64_t>{}, 4);
+  const uint16_t *items = iters.address<uint16_t>(0);
+  const uint64_t expected =
+      std::accumulate(items, items + iters.size(), uint64_t(0));
+  if (sum != expected) {
+    fmt::print("test_algorithms: reduce gives {}, expected {}\n", sum,
+               expected);
+    return false;
+  }
+
+  unique_map normalized{iters.rows(), iters.cols(), sizeof(float)};
+  transform<uint16_t, float>(
+      iters_view, normalized,
+      [lo, hi](uint16_t v) { return float(v - lo) / float(hi - lo); }, 4);
+  // a sub-region goes through the strided path
+  unique_map doubled{100, 200, sizeof(float)};
+  transform2<uint16_t, float, float>(
+      constant_view{iters}.subview(10, 20, 100, 200),
+      constant_view{normalized}.subview(10, 20, 100, 200), doubled,
+      [](uint16_t a, float b) { return a * b; }, 3);
+  if (std::abs(normalized.at<float>(540, 959) -
+               float(iters.at<uint16_t>(540, 959) - lo) / (hi - lo)) >
+          1e-6f ||
+      doubled.at<float>(3, 4) !=
+          iters.at<uint16_t>(13, 24) * normalized.at<float>(13, 24)) {
+    fmt::print("test_algorithms: transform gives wrong values\n");
+    return false;
+  }
+
+  std::vector<uint64_t> bins(10);
+  histogram<float>(constant_view{normalized}, 0.0f, 1.0f, bins, 4);
+  if (std::accumulate(bins.begin(), bins.end(), uint64_t(0)) !=
+      normalized.size()) {
+    fmt::print("test_algorithms: histogram lost elements\n");
+    return false;
+  }
+  for (uint64_t count : bins) {
+    // the values are nearly uniform
+    if (count < normalized.size() / 12) {
+      fmt::print("test_algorithms: unexpected histogram bin {}\n", count);
+      return false;
+    }
+  }
+
+  // NaNs, such as |z|^2 of an escaped orbit, are not counted
+  normalized.at<float>(0, 0) = std::numeric_limits<float>::quiet_NaN();
+  normalized.at<float>(7, 9) = std::numeric_limits<float>::infinity();
+  histogram<float>(constant_view{normalized}, 0.0f, 1.0f, bins, 4);
+  if (std::accumulate(bins.begin(), bins.end(), uint64_t(0)) !=
+      normalized.size() - 1) {
+    fmt::print("test_algorithms: histogram counted a NaN\n");
+    return false;
+  }
+
+  fmt::print("test_algorithms succeeded\n");
+  return true;
+}
+
+bool test_histogram() {
+  using namespace fractal_utils;
+  unique_map iters{480, 640, sizeof(int32_t)};
+  for (size_t r = 0; r < iters.rows(); r++) {
+    for (size_t c = 0; c < iters.cols(); c++) {
+      iters.at<int32_t>(r, c) = (r * 3 + c) % 500;
+    }
+  }
+  const constant_view full{iters};
+
+  auto hist = histogram_engine::integer(0, 499);
+  hist.build<int32_t>(full, 4);
+  hist.finalize();
+  if (hist.total() != iters.size() || hist.percentile(0.5) < 240 ||
+      hist.percentile(0.5) > 260 || hist.cdf(499) != 1.0) {
+    fmt::print("test_histogram: wrong statistics of the full map\n");
+    return false;
+  }
+
+  // cropping by subtracting the border matches counting the crop directly
+  hist.crop<int32_t>(full, 40, 60, 4);
+  auto expected = histogram_engine::integer(0, 499);
+  expected.build<int32_t>(full.subview(40, 60, 400, 520), 1);
+  if (!std::equal(hist.counts().begin(), hist.counts().end(),
+                  expected.counts().begin())) {
+    fmt::print("test_histogram: cropped histogram differs\n");
+    return false;
+  }
+
+  // per-pixel counting through render_AB_options::fun_counter
+  auto per_pixel = histogram_engine::uniform(0.0, 500.0, 50);
+  auto counter = per_pixel.counter<int32_t, float>();
+  for (size_t i = 0; i < iters.size(); i++) {
+    counter(iters.at<int32_t>(i), 0.0f);
+  }
+  auto uniform = histogram_engine::uniform(0.0, 500.0, 50);
+  uniform.build<int32_t>(full, 4);
+  if (!std::equal(uniform.counts().begin(), uniform.counts().end(),
+                  per_pixel.counts().begin())) {
+    fmt::print("test_histogram: per-pixel counter differs\n");
+    return false;
+  }
+
+  // NaNs and values out of int64_t in a float map are skipped or clamped
+  unique_map norm2{16, 16, sizeof(float)};
+  for (size_t i = 0; i < norm2.size(); i++) {
+    norm2.at<float>(i) = float(i % 10);
+  }
+  norm2.at<float>(3) = std::numeric_limits<float>::quiet_NaN();
+  norm2.at<float>(5) = 1e30f;
+  norm2.at<float>(7) = -std::numeric_limits<float>::infinity();
+  for (auto engine : {histogram_engine::integer(0, 9),
+                      histogram_engine::uniform(0.0, 10.0, 10)}) {
+    engine.build<float>(constant_view{norm2}, 2);
+    engine.add_value(std::numeric_limits<double>::quiet_NaN());
+    engine.finalize();
+    if (engine.total() != norm2.size() - 1 || engine.counts()[9] != 26 ||
+        engine.counts()[0] != 27 ||
+        engine.cdf(std::numeric_limits<double>::quiet_NaN()) != 0) {
+      fmt::print("test_histogram: NaN or huge values are miscounted\n");
+      return false;
+    }
+  }
+
+  fmt::print("test_histogram succeeded\n");
+  return true;
+}
@@ -0,0 +1,376 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include <cstring>
+#include <sstream>
+#include <fmt/format.h>
+
+#include "binary_archive.h"
+#include "multi_channel_map.h"
+#include "tiled_map.h"
+#include "typed_map.h"
+#include "unique_map.h"
+
+bool test_allocator();
+bool test_subview();
+bool test_tiled();
+bool test_soa();
+bool test_typed();
+
+int main() {
+  if (!test_allocator()) {
+    return 1;
+  }
+  if (!test_subview()) {
+    return 1;
+  }
+  if (!test_tiled()) {
+    return 1;
+  }
+  if (!test_soa()) {
+    return 1;
+  }
+  if (!test_typed()) {
+    return 1;
+  }
+  return 0;
+}
+
+bool test_allocator() {
+  using namespace fractal_utils;
+  map_allocator alloc{{.alignment = 128, .huge_pages = true,
+                       .first_touch = true}};
+  {
+    unique_map small{16, 16, 4, alloc};
+    unique_map large{1024, 1024, 8, alloc};
+    if (reinterpret_cast<uintptr_t>(small.data()) % 128 != 0 ||
+        reinterpret_cast<uintptr_t>(large.data()) %
+                map_allocator::huge_page_bytes !=
+            0) {
+      fmt::print("test_allocator: misaligned allocation\n");
+      return false;
+    }
+
+    // growing and copying stay with the allocator
+    small.reserve_bytes(4096);
+    if (small.capacity() != 4096 || small.capacity_bytes() != 4096) {
+      fmt::print("test_allocator: capacity is not in bytes\n");
+      return false;
+    }
+    unique_map copy{small};
+    if (&copy.allocator() != &alloc) {
+      fmt::print("test_allocator: copy lost the allocator\n");
+      return false;
+    }
+
+    fractal_map fm{64, 64, 4, alloc};
+    fractal_map moved{std::move(fm)};
+    memset(moved.data, 0, moved.byte_count());
+
+    const auto stats = alloc.stats();
+    // small, large, small after reserve, copy, fm
+    if (stats.allocations != 5 || stats.deallocations != 1 ||
+        stats.huge_page_bytes != 1024 * 1024 * 8) {
+      fmt::print(
+          "test_allocator: unexpected statistics, allocations = {}, "
+          "deallocations = {}, huge page bytes = {}\n",
+          stats.allocations, stats.deallocations, stats.huge_page_bytes);
+      return false;
+    }
+
+    unique_map other{16, 16, 4};
+    other.at<uint32_t>(3, 5) = 42;
+    other.set_allocator(alloc);
+    if (other.at<uint32_t>(3, 5) != 42 || alloc.stats().allocations != 6) {
+      fmt::print("test_allocator: set_allocator failed\n");
+      return false;
+    }
+  }
+
+  // rounding this up to the alignment would wrap
+  if (alloc.allocate(SIZE_MAX - 10) != nullptr ||
+      alloc.stats().failed_allocations != 1) {
+    fmt::print("test_allocator: a wrapping size is allocated\n");
+    return false;
+  }
+
+  const auto stats = alloc.stats();
+  if (stats.bytes_in_use != 0 || stats.allocations != stats.deallocations) {
+    fmt::print("test_allocator: {} bytes leaked\n", stats.bytes_in_use);
+    return false;
+  }
+  fmt::print("test_allocator succeeded, peak = {} bytes\n",
+             stats.peak_bytes_in_use);
+  return true;
+}
+
+bool test_subview() {
+  using namespace fractal_utils;
+  unique_map map{37, 53, sizeof(uint32_t)};
+  for (size_t r = 0; r < map.rows(); r++) {
+    for (size_t c = 0; c < map.cols(); c++) {
+      map.at<uint32_t>(r, c) = r * 1000 + c;
+    }
+  }
+
+  // a view of a view keeps the pitch of the whole map
+  strided_view sv = map_view{map}.subview(3, 5, 30, 40).subview(2, 7, 20, 11);
+  if (sv.pitch() != map.cols() * sizeof(uint32_t) || sv.is_contiguous()) {
+    fmt::print("test_subview: wrong pitch\n");
+    return false;
+  }
+  sv.at<uint32_t>(0, 0) = 7;
+  if (map.at<uint32_t>(5, 12) != 7) {
+    fmt::print("test_subview: the subview does not alias the map\n");
+    return false;
+  }
+
+  unique_map copied;
+  copy(constant_view{map}.subview(10, 20, 15, 9), copied);
+  if (copied.rows() != 15 || copied.cols() != 9) {
+    fmt::print("test_subview: wrong shape of the copy\n");
+    return false;
+  }
+  for (size_t r = 0; r < copied.rows(); r++) {
+    for (size_t c = 0; c < copied.cols(); c++) {
+      if (copied.at<uint32_t>(r, c) != map.at<uint32_t>(r + 10, c + 20)) {
+        fmt::print("test_subview: mismatch at ({}, {})\n", r, c);
+        return false;
+      }
+    }
+  }
+
+  fmt::print("test_subview succeeded\n");
+  return true;
+}
+
+bool test_tiled() {
+  using namespace fractal_utils;
+  // not a multiple of the tile size in either direction
+  unique_map map{150, 203, sizeof(uint64_t)};
+  for (size_t r = 0; r < map.rows(); r++) {
+    for (size_t c = 0; c < map.cols(); c++) {
+      map.at<uint64_t>(r, c) = r * 1000 + c;
+    }
+  }
+
+  tiled_map tiled;
+  tiled.load(constant_view{map});
+  if (tiled.tile_rows() != 3 || tiled.tile_cols() != 4) {
+    fmt::print("test_tiled: wrong tile grid\n");
+    return false;
+  }
+  for (size_t r = 0; r < map.rows(); r++) {
+    for (size_t c = 0; c < map.cols(); c++) {
+      if (tiled.at<uint64_t>(r, c) != map.at<uint64_t>(r, c)) {
+        fmt::print("test_tiled: mismatch at ({}, {})\n", r, c);
+        return false;
+      }
+    }
+  }
+
+  // the first tiles are stored along the Z curve
+  if (tiled.tile_position(1) != std::pair<size_t, size_t>{0, 1} ||
+      tiled.tile_position(2) != std::pair<size_t, size_t>{1, 0}) {
+    fmt::print("test_tiled: tiles are not in Z order\n");
+    return false;
+  }
+
+  tiled.at<uint64_t>(149, 202) = 42;
+  unique_map back;
+  tiled.store(back);
+  if (back.rows() != map.rows() || back.cols() != map.cols() ||
+      back.at<uint64_t>(149, 202) != 42 ||
+      back.at<uint64_t>(77, 130) != map.at<uint64_t>(77, 130)) {
+    fmt::print("test_tiled: failed to convert back to row-major\n");
+    return false;
+  }
+
+  // a moved-from map must allocate again when it is reused
+  tiled_map moved{std::move(tiled)};
+  tiled.reset(70, 70, sizeof(uint64_t));
+  tiled.at<uint64_t>(69, 69) = 7;
+  tiled_map assigned;
+  assigned = std::move(tiled);
+  tiled.load(constant_view{map});
+  if (tiled.at<uint64_t>(149, 202) != map.at<uint64_t>(149, 202) ||
+      moved.at<uint64_t>(149, 202) != 42 ||
+      assigned.at<uint64_t>(69, 69) != 7) {
+    fmt::print("test_tiled: failed to reuse a moved-from map\n");
+    return false;
+  }
+
+  // a map whose memory can't be allocated must not keep the new shape
+  struct failing_allocator : public map_allocator {
+    void *allocate(size_t) noexcept override {
+      this->record_failure();
+      return nullptr;
+    }
+  } failing;
+  tiled_map empty{150, 203, sizeof(uint64_t), failing};
+  if (empty.rows() != 0 || empty.cols() != 0 || empty.tile_count() != 0) {
+    fmt::print("test_tiled: a failed allocation kept the shape\n");
+    return false;
+  }
+
+  fmt::print("test_tiled succeeded\n");
+  return true;
+}
+
+bool test_soa() {
+  using namespace fractal_utils;
+  // iteration count, |z|^2 and distance estimate
+  soa_map<uint16_t, double, float> map{33, 47};
+  for (size_t r = 0; r < map.rows(); r++) {
+    for (size_t c = 0; c < map.cols(); c++) {
+      map.at<0>(r, c) = r + c;
+      map.at<1>(r, c) = r * 0.5;
+      map.at<2>(r, c) = c * 0.25f;
+    }
+  }
+  for (size_t ch = 0; ch < map.channels; ch++) {
+    if (reinterpret_cast<uintptr_t>(map.channel(ch).data()) %
+            multi_channel_map::plane_alignment !=
+        0) {
+      fmt::print("test_soa: channel {} is misaligned\n", ch);
+      return false;
+    }
+  }
+
+  std::stringstream ss;
+  {
+    binary_archive archive;
+    map.append_to(archive, 100);
+    auto err = archive.save(ss);
+    if (!err.empty()) {
+      fmt::print("test_soa: failed to save, {}\n", err);
+      return false;
+    }
+  }
+
+  binary_archive archive;
+  auto err = archive.load(ss);
+  multi_channel_map loaded;
+  if (err.empty()) {
+    err = loaded.load_from(archive, 100);
+  }
+  if (!err.empty()) {
+    fmt::print("test_soa: failed to load, {}\n", err);
+    return false;
+  }
+  if (loaded.rows() != map.rows() || loaded.cols() != map.cols() ||
+      loaded.channel_count() != 3) {
+    fmt::print("test_soa: wrong layout after loading\n");
+    return false;
+  }
+  for (size_t ch = 0; ch < map.channels; ch++) {
+    const constant_view a = map.channel(ch);
+    const constant_view b = loaded.channel(ch);
+    if (a.element_bytes() != b.element_bytes() ||
+        memcmp(a.data(), b.data(), a.bytes()) != 0) {
+      fmt::print("test_soa: channel {} differs after loading\n", ch);
+      return false;
+    }
+  }
+
+  // a moved-from map must allocate again when it is reused
+  multi_channel_map moved{std::move(loaded)};
+  const std::vector<size_t> one_channel{sizeof(uint32_t)};
+  loaded.reset(5, 6, one_channel);
+  multi_channel_map assigned;
+  assigned = std::move(loaded);
+  loaded.reset(7, 8, one_channel);
+  if (loaded.channel(0).data() == nullptr ||
+      assigned.channel(0).data() == nullptr || moved.channel_count() != 3) {
+    fmt::print("test_soa: failed to reuse a moved-from map\n");
+    return false;
+  }
+
+  // rows * cols * element bytes wraps around to the size of the channel
+  {
+    const uint64_t layout[]{(uint64_t(1) << 61) + 1, 8, 1, 8};
+    binary_archive broken;
+    broken.segments().emplace_back(
+        100, std::vector<uint8_t>{reinterpret_cast<const uint8_t *>(layout),
+                                  reinterpret_cast<const uint8_t *>(layout) +
+                                      sizeof(layout)});
+    broken.segments().emplace_back(101, std::vector<uint8_t>(64));
+    if (loaded.load_from(broken, 100).empty()) {
+      fmt::print("test_soa: an overflowing layout was loaded\n");
+      return false;
+    }
+  }
+
+  fmt::print("test_soa succeeded\n");
+  return true;
+}
+
+bool test_typed() {
+  using namespace fractal_utils;
+  struct rgb {
+    uint8_t r, g, b;
+  };
+  typed_unique_map<rgb> map{21, 45};
+  if (map.pitch() != 192) {
+    fmt::print("test_typed: pitch is {} bytes, expected 192\n", map.pitch());
+    return false;
+  }
+  for (size_t r = 0; r < map.rows(); r++) {
+    if (reinterpret_cast<uintptr_t>(map.row(r)) % typed_map_row_alignment !=
+        0) {
+      fmt::print("test_typed: row {} is misaligned\n", r);
+      return false;
+    }
+    for (size_t c = 0; c < map.cols(); c++) {
+      map(r, c) = rgb{uint8_t(r), uint8_t(c), 7};
+    }
+  }
+
+  // typed -> untyped -> typed
+  const constant_strided_view untyped = map.view().subview(4, 9, 10, 30);
+  typed_map_view<const rgb> sub{untyped};
+  if (untyped.element_bytes() != sizeof(rgb) || sub(3, 2).r != 7 ||
+      sub(3, 2).g != 11) {
+    fmt::print("test_typed: conversion between views failed\n");
+    return false;
+  }
+
+  const typed_unique_map<rgb> copied{map};
+  if (copied(20, 44).g != 44 || copied.pitch() != map.pitch()) {
+    fmt::print("test_typed: copy failed\n");
+    return false;
+  }
+
+  // a moved-from map must allocate again when it is reused
+  typed_unique_map<rgb> moved{std::move(map)};
+  map.reset(3, 4);
+  typed_unique_map<rgb> assigned;
+  assigned = std::move(map);
+  map.reset(5, 6);
+  if (map.row(0) == nullptr || assigned.row(0) == nullptr ||
+      moved(20, 44).g != 44) {
+    fmt::print("test_typed: failed to reuse a moved-from map\n");
+    return false;
+  }
+
+  fmt::print("test_typed succeeded\n");
+  return true;
+}
@@ -0,0 +1,179 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "tiled_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace fractal_utils;
+
+namespace {
+// interleave the bits of r and c, c takes the lower bit
+uint64_t morton_code(uint32_t r, uint32_t c) noexcept {
+  auto spread = [](uint64_t v) {
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+  };
+  return (spread(r) << 1) | spread(c);
+}
+}  // namespace
+
+tiled_map::tiled_map(size_t r, size_t c, size_t ele_bytes)
+    : tiled_map{r, c, ele_bytes, map_allocator::default_allocator()} {}
+
+tiled_map::tiled_map(size_t r, size_t c, size_t ele_bytes,
+                     map_allocator &allocator)
+    : m_allocator{&allocator} {
+  this->reset(r, c, ele_bytes);
+}
+
+tiled_map::tiled_map(tiled_map &&src) noexcept
+    : internal::map_base{src},
+      m_data{std::move(src.m_data)},
+      m_allocator{src.m_allocator},
+      m_tile_rows{src.m_tile_rows},
+      m_tile_cols{src.m_tile_cols},
+      m_slot_of_tile{std::move(src.m_slot_of_tile)},
+      m_tile_of_slot{std::move(src.m_tile_of_slot)} {
+  src.clear_moved_from();
+}
+
+tiled_map &tiled_map::operator=(tiled_map &&src) & noexcept {
+  if (this == &src) {
+    return *this;
+  }
+  static_cast<internal::map_base &>(*this) = src;
+  this->m_data = std::move(src.m_data);
+  this->m_allocator = src.m_allocator;
+  this->m_tile_rows = src.m_tile_rows;
+  this->m_tile_cols = src.m_tile_cols;
+  this->m_slot_of_tile = std::move(src.m_slot_of_tile);
+  this->m_tile_of_slot = std::move(src.m_tile_of_slot);
+  src.clear_moved_from();
+  return *this;
+}
+
+void tiled_map::clear_moved_from() noexcept {
+  this->m_data.get_deleter().bytes = 0;
+  static_cast<internal::map_base &>(*this) =
+      internal::map_base{0, 0, this->element_bytes()};
+  this->m_tile_rows = 0;
+  this->m_tile_cols = 0;
+  this->m_slot_of_tile.clear();
+  this->m_tile_of_slot.clear();
+}
+
+void tiled_map::reset(size_t r, size_t c, size_t ele_bytes) noexcept {
+  const size_t old_bytes = this->m_data.get_deleter().bytes;
+
+  this->m_rows = r;
+  this->m_cols = c;
+  this->m_ele_bytes = ele_bytes;
+  const size_t tile_rows = (r + tile_size - 1) >> tile_shift;
+  const size_t tile_cols = (c + tile_size - 1) >> tile_shift;
+
+  if (tile_rows != this->m_tile_rows || tile_cols != this->m_tile_cols) {
+    this->m_tile_rows = tile_rows;
+    this->m_tile_cols = tile_cols;
+
+    const size_t count = tile_rows * tile_cols;
+    this->m_tile_of_slot.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      this->m_tile_of_slot[i] = i;
+    }
+    std::sort(this->m_tile_of_slot.begin(), this->m_tile_of_slot.end(),
+              [tile_cols](uint32_t a, uint32_t b) {
+                return morton_code(a / tile_cols, a % tile_cols) <
+                       morton_code(b / tile_cols, b % tile_cols);
+              });
+    this->m_slot_of_tile.resize(count);
+    for (size_t slot = 0; slot < count; slot++) {
+      this->m_slot_of_tile[this->m_tile_of_slot[slot]] = slot;
+    }
+  }
+
+  const size_t bytes = this->tile_count() * this->tile_bytes();
+  if (bytes > old_bytes) {
+    this->m_data.reset();
+    void *data = this->m_allocator->allocate(bytes);
+    this->m_data = std::unique_ptr<void, internal::void_deleter>{
+        data, internal::void_deleter{this->m_allocator,
+                                     data == nullptr ? 0 : bytes}};
+    if (data == nullptr) {
+      // an empty map, rather than a sized one without memory
+      this->clear_moved_from();
+    }
+  }
+}
+
+strided_view tiled_map::tile(size_t tr, size_t tc) noexcept {
+  assert(tr < this->m_tile_rows && tc < this->m_tile_cols);
+  auto *begin = reinterpret_cast<uint8_t *>(this->m_data.get()) +
+                this->m_slot_of_tile[tr * this->m_tile_cols + tc] *
+                    this->tile_bytes();
+  return strided_view{begin,
+                      std::min(tile_size, this->rows() - tr * tile_size),
+                      std::min(tile_size, this->cols() - tc * tile_size),
+                      this->element_bytes(), tile_size * this->element_bytes()};
+}
+
+constant_strided_view tiled_map::tile(size_t tr, size_t tc) const noexcept {
+  return const_cast<tiled_map *>(this)->tile(tr, tc);
+}
+
+void tiled_map::load(constant_strided_view src) noexcept {
+  this->reset(src.rows(), src.cols(), src.element_bytes());
+  for (size_t slot = 0; slot < this->tile_count(); slot++) {
+    const auto [tr, tc] = this->tile_position(slot);
+    strided_view dst = this->tile(tr, tc);
+    const auto from = src.subview(tr * tile_size, tc * tile_size, dst.rows(),
+                                  dst.cols());
+    const size_t row_bytes = dst.cols() * dst.element_bytes();
+    for (size_t r = 0; r < dst.rows(); r++) {
+      memcpy(dst.row(r), from.row(r), row_bytes);
+    }
+  }
+}
+
+void tiled_map::store(strided_view dst) const noexcept {
+  assert(dst.rows() == this->rows() && dst.cols() == this->cols());
+  assert(dst.element_bytes() == this->element_bytes());
+  for (size_t slot = 0; slot < this->tile_count(); slot++) {
+    const auto [tr, tc] = this->tile_position(slot);
+    const constant_strided_view src = this->tile(tr, tc);
+    strided_view to =
+        dst.subview(tr * tile_size, tc * tile_size, src.rows(), src.cols());
+    const size_t row_bytes = src.cols() * src.element_bytes();
+    for (size_t r = 0; r < src.rows(); r++) {
+      memcpy(to.row(r), src.row(r), row_bytes);
+    }
+  }
+}
+
+void tiled_map::store(unique_map &dst) const noexcept {
+  dst.reset(this->rows(), this->cols(), this->element_bytes());
+  this->store(strided_view{dst});
+}
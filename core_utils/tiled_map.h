@@ -0,0 +1,155 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_TILEDMAP_H
+#define FRACTALUTILS_COREUTILS_TILEDMAP_H
+
+#include <cassert>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "map_allocator.h"
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+// A map stored in square tiles of tile_size * tile_size elements. Elements of
+// a tile are contiguous and row-major, tiles are stored along a Z (Morton)
+// curve, so both an element's neighbours and a tile's neighbours are usually
+// close in memory. Tiles on the right and bottom border are allocated in full
+// but only partially used; the unused elements are unspecified.
+class tiled_map : public internal::map_base {
+ public:
+  static constexpr size_t tile_shift = 6;
+  static constexpr size_t tile_size = size_t(1) << tile_shift;
+  static constexpr size_t tile_elements = tile_size * tile_size;
+
+ private:
+  std::unique_ptr<void, internal::void_deleter> m_data{nullptr};
+  map_allocator *m_allocator{&map_allocator::default_allocator()};
+  size_t m_tile_rows{0};
+  size_t m_tile_cols{0};
+  // row-major tile index -> position of the tile in memory
+  std::vector<uint32_t> m_slot_of_tile;
+  // position of a tile in memory -> row-major tile index
+  std::vector<uint32_t> m_tile_of_slot;
+
+  [[nodiscard]] inline size_t tile_bytes() const noexcept {
+    return tile_elements * this->element_bytes();
+  }
+
+  // unique_ptr leaves the deleter of a moved-from pointer untouched, so the
+  // capacity it records must be cleared by hand
+  void clear_moved_from() noexcept;
+
+  [[nodiscard]] inline size_t element_offset(size_t r,
+                                             size_t c) const noexcept {
+    assert(r < this->rows());
+    assert(c < this->cols());
+    const size_t tile =
+        (r >> tile_shift) * this->m_tile_cols + (c >> tile_shift);
+    return size_t(this->m_slot_of_tile[tile]) * tile_elements +
+           ((r & (tile_size - 1)) << tile_shift) + (c & (tile_size - 1));
+  }
+
+ public:
+  tiled_map() = default;
+  // The source is left empty and can be reset and used again.
+  tiled_map(tiled_map &&src) noexcept;
+  tiled_map(const tiled_map &) = delete;
+  tiled_map(size_t r, size_t c, size_t ele_bytes);
+  // The allocator must outlive this map.
+  tiled_map(size_t r, size_t c, size_t ele_bytes, map_allocator &allocator);
+
+  tiled_map &operator=(tiled_map &&src) & noexcept;
+  tiled_map &operator=(const tiled_map &) = delete;
+
+  // Reallocate only if the new shape needs more tile memory. If that fails,
+  // the map becomes 0x0.
+  void reset(size_t r, size_t c, size_t ele_bytes) noexcept;
+
+  // number of tiles in each direction
+  [[nodiscard]] inline size_t tile_rows() const noexcept {
+    return this->m_tile_rows;
+  }
+  [[nodiscard]] inline size_t tile_cols() const noexcept {
+    return this->m_tile_cols;
+  }
+  [[nodiscard]] inline size_t tile_count() const noexcept {
+    return this->m_tile_rows * this->m_tile_cols;
+  }
+
+  // The tile stored at position slot in memory, as (tile row, tile col).
+  // Visiting slots 0, 1, 2, ... walks the tiles along the Z curve.
+  [[nodiscard]] inline std::pair<size_t, size_t> tile_position(
+      size_t slot) const noexcept {
+    assert(slot < this->tile_count());
+    const size_t tile = this->m_tile_of_slot[slot];
+    return {tile / this->m_tile_cols, tile % this->m_tile_cols};
+  }
+
+  // The valid part of a tile. Its pitch is tile_size elements.
+  [[nodiscard]] strided_view tile(size_t tr, size_t tc) noexcept;
+  [[nodiscard]] constant_strided_view tile(size_t tr,
+                                           size_t tc) const noexcept;
+
+  template <typename T>
+  T *address(size_t r, size_t c) noexcept {
+    static_assert(!std::is_same_v<T, void>, "T should not be void");
+    assert(sizeof(T) == this->element_bytes());
+    return reinterpret_cast<T *>(this->m_data.get()) +
+           this->element_offset(r, c);
+  }
+  template <typename T>
+  const T *address(size_t r, size_t c) const noexcept {
+    static_assert(!std::is_same_v<T, void>, "T should not be void");
+    assert(sizeof(T) == this->element_bytes());
+    return reinterpret_cast<const T *>(this->m_data.get()) +
+           this->element_offset(r, c);
+  }
+
+  template <typename T>
+  T &at(size_t r, size_t c) noexcept {
+    return *this->address<T>(r, c);
+  }
+  template <typename T>
+  const T &at(size_t r, size_t c) const noexcept {
+    return *this->address<T>(r, c);
+  }
+
+  [[nodiscard]] inline map_allocator &allocator() const noexcept {
+    return *this->m_allocator;
+  }
+
+  // Reshape to src and copy it in, tile by tile.
+  void load(constant_strided_view src) noexcept;
+  // Copy to dst, which must have the same shape.
+  void store(strided_view dst) const noexcept;
+  // Reshape dst to this map and copy to it.
+  void store(unique_map &dst) const noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_TILEDMAP_H
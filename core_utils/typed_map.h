@@ -0,0 +1,288 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_COREUTILS_TYPEDMAP_H
+#define FRACTALUTILS_COREUTILS_TYPEDMAP_H
+
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include "map_allocator.h"
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+// Rows of typed maps start at multiples of this many bytes, the width of an
+// AVX-512 register.
+constexpr size_t typed_map_row_alignment = 64;
+
+// A non-owning view of a map of T whose rows are pitch bytes apart. The
+// element type is part of the type, so accesses are not checked against an
+// element size at run time; the size is checked once when converting from an
+// untyped view. T may be const.
+template <typename T>
+class typed_map_view {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "elements of maps are copied as bytes");
+
+ public:
+  using value_type = T;
+
+ private:
+  T *m_data{nullptr};
+  size_t m_rows{0};
+  size_t m_cols{0};
+  // in bytes
+  size_t m_pitch{0};
+
+  using byte_t = std::conditional_t<std::is_const_v<T>, const uint8_t, uint8_t>;
+
+ public:
+  typed_map_view() = default;
+  typed_map_view(T *data, size_t r, size_t c, size_t pitch_bytes) noexcept
+      : m_data{data}, m_rows{r}, m_cols{c}, m_pitch{pitch_bytes} {
+    assert(pitch_bytes >= c * sizeof(T));
+  }
+  // a view of const T from a view of T
+  template <typename U>
+    requires std::is_same_v<const U, T> && (!std::is_same_v<U, T>)
+  typed_map_view(typed_map_view<U> src) noexcept
+      : typed_map_view{src.row(0), src.rows(), src.cols(), src.pitch()} {}
+
+  // from untyped views, their element size must be sizeof(T)
+  explicit typed_map_view(strided_view src) noexcept
+    requires(!std::is_const_v<T>)
+      : typed_map_view{
+            src.rows() == 0 ? nullptr : reinterpret_cast<T *>(src.row(0)),
+            src.rows(), src.cols(), src.pitch()} {
+    assert(src.element_bytes() == sizeof(T));
+  }
+  explicit typed_map_view(constant_strided_view src) noexcept
+    requires std::is_const_v<T>
+      : typed_map_view{
+            src.rows() == 0 ? nullptr : reinterpret_cast<T *>(src.row(0)),
+            src.rows(), src.cols(), src.pitch()} {
+    assert(src.element_bytes() == sizeof(T));
+  }
+
+  [[nodiscard]] inline size_t rows() const noexcept { return this->m_rows; }
+  [[nodiscard]] inline size_t cols() const noexcept { return this->m_cols; }
+  [[nodiscard]] inline size_t size() const noexcept {
+    return this->m_rows * this->m_cols;
+  }
+  [[nodiscard]] inline size_t pitch() const noexcept { return this->m_pitch; }
+  [[nodiscard]] inline bool is_contiguous() const noexcept {
+    return this->m_pitch == this->m_cols * sizeof(T);
+  }
+
+  // Doesn't check r, so the row after the last one can be used as an end.
+  [[nodiscard]] inline T *row(size_t r) const noexcept {
+    return reinterpret_cast<T *>(reinterpret_cast<byte_t *>(this->m_data) +
+                                 r * this->m_pitch);
+  }
+  [[nodiscard]] inline std::span<T> row_span(size_t r) const noexcept {
+    assert(r < this->m_rows);
+    return {this->row(r), this->m_cols};
+  }
+  [[nodiscard]] inline T &at(size_t r, size_t c) const noexcept {
+    assert(r < this->m_rows);
+    assert(c < this->m_cols);
+    return this->row(r)[c];
+  }
+  [[nodiscard]] inline T &operator()(size_t r, size_t c) const noexcept {
+    return this->at(r, c);
+  }
+
+  [[nodiscard]] typed_map_view subview(size_t r0, size_t c0, size_t r,
+                                       size_t c) const noexcept {
+    assert(r0 + r <= this->m_rows);
+    assert(c0 + c <= this->m_cols);
+    return {this->row(r0) + c0, r, c, this->m_pitch};
+  }
+
+  // to untyped views
+  operator constant_strided_view() const noexcept {
+    return {this->m_data, this->m_rows, this->m_cols, sizeof(T),
+            this->m_pitch};
+  }
+  operator strided_view() const noexcept
+    requires(!std::is_const_v<T>)
+  {
+    return {this->m_data, this->m_rows, this->m_cols, sizeof(T),
+            this->m_pitch};
+  }
+};
+
+// An owning map of T. Each row is padded to typed_map_row_alignment bytes,
+// so every row starts on an aligned address if the allocator aligns to at
+// least that much, which the default one does. Vector loads at the start of
+// a row are aligned and may read into the padding.
+template <typename T>
+class typed_unique_map {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "elements of maps are copied as bytes");
+
+ private:
+  std::unique_ptr<void, internal::void_deleter> m_data{nullptr};
+  map_allocator *m_allocator{&map_allocator::default_allocator()};
+  size_t m_rows{0};
+  size_t m_cols{0};
+  // in bytes
+  size_t m_pitch{0};
+
+  // unique_ptr leaves the deleter of a moved-from pointer untouched, so the
+  // capacity it records must be cleared by hand
+  void clear_moved_from() noexcept {
+    this->m_data.get_deleter().bytes = 0;
+    this->m_rows = 0;
+    this->m_cols = 0;
+    this->m_pitch = 0;
+  }
+
+ public:
+  using value_type = T;
+
+  [[nodiscard]] static constexpr size_t pitch_for(size_t cols) noexcept {
+    return (cols * sizeof(T) + typed_map_row_alignment - 1) /
+           typed_map_row_alignment * typed_map_row_alignment;
+  }
+
+  typed_unique_map() = default;
+  // The source is left empty and can be reset and used again.
+  typed_unique_map(typed_unique_map &&src) noexcept
+      : m_data{std::move(src.m_data)},
+        m_allocator{src.m_allocator},
+        m_rows{src.m_rows},
+        m_cols{src.m_cols},
+        m_pitch{src.m_pitch} {
+    src.clear_moved_from();
+  }
+  typed_unique_map(const typed_unique_map &src)
+      : typed_unique_map{src.rows(), src.cols(), src.allocator()} {
+    if (this->m_data != nullptr) {
+      memcpy(this->m_data.get(), src.m_data.get(),
+             src.rows() * src.pitch());
+    }
+  }
+  typed_unique_map(size_t r, size_t c)
+      : typed_unique_map{r, c, map_allocator::default_allocator()} {}
+  // The allocator must outlive this map.
+  typed_unique_map(size_t r, size_t c, map_allocator &allocator)
+      : m_allocator{&allocator} {
+    this->reset(r, c);
+  }
+
+  typed_unique_map &operator=(typed_unique_map &&src) & noexcept {
+    if (this != &src) {
+      this->m_data = std::move(src.m_data);
+      this->m_allocator = src.m_allocator;
+      this->m_rows = src.m_rows;
+      this->m_cols = src.m_cols;
+      this->m_pitch = src.m_pitch;
+      src.clear_moved_from();
+    }
+    return *this;
+  }
+  typed_unique_map &operator=(const typed_unique_map &src) & noexcept {
+    if (this != &src) {
+      this->reset(src.rows(), src.cols());
+      if (this->m_data != nullptr) {
+        memcpy(this->m_data.get(), src.m_data.get(),
+               src.rows() * src.pitch());
+      }
+    }
+    return *this;
+  }
+
+  // Reallocate only if the new shape needs more memory. Contents are
+  // unspecified afterwards.
+  void reset(size_t r, size_t c) noexcept {
+    this->m_rows = r;
+    this->m_cols = c;
+    this->m_pitch = pitch_for(c);
+    const size_t bytes = r * this->m_pitch;
+    if (bytes > this->capacity_bytes()) {
+      this->m_data.reset();
+      void *data = this->m_allocator->allocate(bytes);
+      this->m_data = std::unique_ptr<void, internal::void_deleter>{
+          data, internal::void_deleter{this->m_allocator,
+                                       data == nullptr ? 0 : bytes}};
+    }
+  }
+
+  [[nodiscard]] inline size_t rows() const noexcept { return this->m_rows; }
+  [[nodiscard]] inline size_t cols() const noexcept { return this->m_cols; }
+  [[nodiscard]] inline size_t size() const noexcept {
+    return this->m_rows * this->m_cols;
+  }
+  [[nodiscard]] inline size_t pitch() const noexcept { return this->m_pitch; }
+  [[nodiscard]] inline size_t capacity_bytes() const noexcept {
+    return this->m_data.get_deleter().bytes;
+  }
+  [[nodiscard]] inline map_allocator &allocator() const noexcept {
+    return *this->m_allocator;
+  }
+
+  [[nodiscard]] inline typed_map_view<T> view() noexcept {
+    return {reinterpret_cast<T *>(this->m_data.get()), this->m_rows,
+            this->m_cols, this->m_pitch};
+  }
+  [[nodiscard]] inline typed_map_view<const T> view() const noexcept {
+    return {reinterpret_cast<const T *>(this->m_data.get()), this->m_rows,
+            this->m_cols, this->m_pitch};
+  }
+  inline operator typed_map_view<T>() noexcept { return this->view(); }
+  inline operator typed_map_view<const T>() const noexcept {
+    return this->view();
+  }
+  inline operator strided_view() noexcept { return this->view(); }
+  inline operator constant_strided_view() const noexcept {
+    return this->view();
+  }
+
+  [[nodiscard]] inline T *row(size_t r) noexcept {
+    return this->view().row(r);
+  }
+  [[nodiscard]] inline const T *row(size_t r) const noexcept {
+    return this->view().row(r);
+  }
+  [[nodiscard]] inline T &at(size_t r, size_t c) noexcept {
+    return this->view().at(r, c);
+  }
+  [[nodiscard]] inline const T &at(size_t r, size_t c) const noexcept {
+    return this->view().at(r, c);
+  }
+  [[nodiscard]] inline T &operator()(size_t r, size_t c) noexcept {
+    return this->at(r, c);
+  }
+  [[nodiscard]] inline const T &operator()(size_t r, size_t c) const noexcept {
+    return this->at(r, c);
+  }
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_COREUTILS_TYPEDMAP_H
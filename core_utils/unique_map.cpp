@@ -25,30 +25,45 @@ General Public License for more details.
 
 using namespace fractal_utils;
 
-unique_map::unique_map(const unique_map &src) : internal::map_base{src} {
-  this->m_data.reset(allocate_memory_aligned(64, src.bytes()));
+void unique_map::reallocate(size_t bytes, size_t copy_bytes) noexcept {
+  void *new_data = this->m_allocator->allocate(bytes);
+  if (copy_bytes > 0) {
+    memcpy(new_data, this->m_data.get(), copy_bytes);
+  }
+  this->m_data = std::unique_ptr<void, internal::void_deleter>{
+      new_data, internal::void_deleter{this->m_allocator, bytes}};
+  this->m_capacity = bytes;
+}
+
+unique_map::unique_map(const unique_map &src)
+    : internal::map_base{src}, m_allocator{src.m_allocator} {
+  this->reallocate(src.bytes(), 0);
   if (src.bytes() > 0)
     memcpy(this->m_data.get(), src.m_data.get(), src.bytes());
-  this->m_capacity = src.bytes();
 }
 
 unique_map::unique_map(unique_map &&src)
     : internal::map_base{src},
       m_data{std::move(src.m_data)},
-      m_capacity{src.capacity_bytes()} {
+      m_capacity{src.capacity_bytes()},
+      m_allocator{src.m_allocator} {
   src.reset(0, 0, src.element_bytes());
   src.m_capacity = 0;
 }
 
 unique_map::unique_map(internal::map_base base) : internal::map_base{base} {
-  this->m_data.reset(allocate_memory_aligned(64, base.bytes()));
-  this->m_capacity = base.bytes();
+  this->reallocate(base.bytes(), 0);
 }
 
 unique_map::unique_map(size_t r, size_t c, size_t ele_bytes)
     : internal::map_base{r, c, ele_bytes} {
-  this->m_data.reset(allocate_memory_aligned(64, r * c * ele_bytes));
-  this->m_capacity = r * c * ele_bytes;
+  this->reallocate(r * c * ele_bytes, 0);
+}
+
+unique_map::unique_map(size_t r, size_t c, size_t ele_bytes,
+                       map_allocator &allocator)
+    : internal::map_base{r, c, ele_bytes}, m_allocator{&allocator} {
+  this->reallocate(r * c * ele_bytes, 0);
 }
 
 unique_map &unique_map::operator=(const unique_map &src) & noexcept {
@@ -62,6 +77,7 @@ unique_map &unique_map::operator=(const unique_map &src) & noexcept {
 unique_map &unique_map::operator=(unique_map &&src) & noexcept {
   this->m_data = std::move(src.m_data);
   this->m_capacity = src.m_capacity;
+  this->m_allocator = src.m_allocator;
   src.m_capacity = 0;
   static_cast<internal::map_base &>(*this) = src;
   src.reset(0, 0, this->element_bytes());
@@ -84,7 +100,7 @@ void unique_map::reset(size_t r, size_t c, size_t ele_bytes) noexcept {
   const size_t old_bytes = this->bytes();
 
   const internal::map_base new_base{r, c, ele_bytes};
-  if (new_base.bytes() <= 0 || new_base.bytes() <= this->capacity()) {
+  if (new_base.bytes() <= 0 || new_base.bytes() <= this->capacity_bytes()) {
     static_cast<internal::map_base &>(*this) = new_base;
     return;
   }
@@ -111,12 +127,7 @@ void unique_map::reserve_bytes(size_t bytes) noexcept {
     return;
   }
 
-  void *new_data = allocate_memory_aligned(64, bytes);
-
-  memcpy(new_data, this->data(), this->bytes());
-
-  this->m_data.reset(new_data);
-  this->m_capacity = bytes;
+  this->reallocate(bytes, this->bytes());
 }
 
 void unique_map::shrink_to_fit() noexcept {
@@ -125,10 +136,17 @@ void unique_map::shrink_to_fit() noexcept {
     return;
   }
 
-  void *new_data = allocate_memory_aligned(64, this->bytes());
-  memcpy(new_data, this->data(), this->bytes());
-  this->m_data.reset(new_data);
-  this->m_capacity = this->bytes();
+  this->reallocate(this->bytes(), this->bytes());
+}
+
+void unique_map::set_allocator(map_allocator &allocator) noexcept {
+  if (this->m_allocator == &allocator) {
+    return;
+  }
+  this->m_allocator = &allocator;
+  if (this->m_data != nullptr) {
+    this->reallocate(this->m_capacity, this->bytes());
+  }
 }
 
 ///////////////////////////////////////////////////////////
@@ -182,6 +200,82 @@ constant_view &constant_view::operator=(
   return *this;
 }
 
+strided_view map_view::subview(size_t r0, size_t c0, size_t r,
+                               size_t c) const noexcept {
+  return strided_view{*this}.subview(r0, c0, r, c);
+}
+
+constant_strided_view constant_view::subview(size_t r0, size_t c0, size_t r,
+                                             size_t c) const noexcept {
+  return constant_strided_view{*this}.subview(r0, c0, r, c);
+}
+
+///////////////////////////////////////////////////////////
+
+strided_view::strided_view(void *_data, size_t r, size_t c, size_t eleb,
+                           size_t pitch)
+    : internal::map_base{r, c, eleb}, m_data{_data}, m_pitch{pitch} {
+  assert(pitch >= c * eleb);
+}
+
+strided_view::strided_view(map_view src)
+    : strided_view{src.data(), src.rows(), src.cols(), src.element_bytes(),
+                   src.cols() * src.element_bytes()} {}
+
+strided_view::strided_view(unique_map &src) : strided_view{map_view{src}} {}
+
+strided_view::strided_view(fractal_map &src) : strided_view{map_view{src}} {}
+
+strided_view strided_view::subview(size_t r0, size_t c0, size_t r,
+                                   size_t c) const noexcept {
+  assert(r0 + r <= this->rows());
+  assert(c0 + c <= this->cols());
+  auto *begin = reinterpret_cast<uint8_t *>(this->m_data) +
+                r0 * this->m_pitch + c0 * this->element_bytes();
+  return strided_view{begin, r, c, this->element_bytes(), this->m_pitch};
+}
+
+///////////////////////////////////////////////////////////
+
+constant_strided_view::constant_strided_view(const void *_data, size_t r,
+                                             size_t c, size_t eleb,
+                                             size_t pitch)
+    : internal::map_base{r, c, eleb}, m_data{_data}, m_pitch{pitch} {
+  assert(pitch >= c * eleb);
+}
+
+constant_strided_view::constant_strided_view(const strided_view &src)
+    : constant_strided_view{src.m_data, src.rows(), src.cols(),
+                            src.element_bytes(), src.pitch()} {}
+
+constant_strided_view::constant_strided_view(constant_view src)
+    : constant_strided_view{src.data(), src.rows(), src.cols(),
+                            src.element_bytes(),
+                            src.cols() * src.element_bytes()} {}
+
+constant_strided_view constant_strided_view::subview(
+    size_t r0, size_t c0, size_t r, size_t c) const noexcept {
+  assert(r0 + r <= this->rows());
+  assert(c0 + c <= this->cols());
+  const auto *begin = reinterpret_cast<const uint8_t *>(this->m_data) +
+                      r0 * this->m_pitch + c0 * this->element_bytes();
+  return constant_strided_view{begin, r, c, this->element_bytes(),
+                               this->m_pitch};
+}
+
+void fractal_utils::copy(constant_strided_view src, unique_map &dst) noexcept {
+  dst.reset(src.rows(), src.cols(), src.element_bytes());
+  const size_t row_bytes = src.cols() * src.element_bytes();
+  if (src.is_contiguous() && src.rows() > 0) {
+    memcpy(dst.data(), src.row(0), src.bytes());
+    return;
+  }
+  auto *dest = reinterpret_cast<uint8_t *>(dst.data());
+  for (size_t r = 0; r < src.rows(); r++) {
+    memcpy(dest + r * row_bytes, src.row(r), row_bytes);
+  }
+}
+
 /*
 void fractal_utils::copy(constant_view src, unique_map &dst) noexcept {
   static_cast<internal::map_base &>(dst) = src;
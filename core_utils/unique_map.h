@@ -31,6 +31,7 @@ General Public License for more details.
 #endif
 
 #include "fractal_map.h"
+#include "map_allocator.h"
 
 namespace fractal_utils {
 
@@ -237,9 +238,81 @@ class map_accesser {
   FRACTAL_UTILS_PRIVATE_MACRO_MAKE_CONST_ACCESSER_MEMBER_FUNCTIONS
 };
 
+// implement const data access for views whose rows are not packed, i.e. the
+// distance between two rows (the pitch) may be larger than a row
+template <class derived>
+class const_strided_accesser {
+ private:
+  const uint8_t *impl_row(size_t r) const noexcept {
+    const auto *d = static_cast<const derived *>(this);
+    assert(r < d->rows());
+    return reinterpret_cast<const uint8_t *>(d->impl_get_data_for_accesser()) +
+           r * d->pitch();
+  }
+
+ public:
+  const void *row(size_t r) const noexcept { return this->impl_row(r); }
+
+  template <typename T>
+  const T *address(size_t r, size_t c) const noexcept {
+    static_assert(!std::is_same_v<T, void>, "T should not be void");
+    assert(sizeof(T) == static_cast<const derived *>(this)->element_bytes());
+    assert(c < static_cast<const derived *>(this)->cols());
+    return reinterpret_cast<const T *>(this->impl_row(r)) + c;
+  }
+
+  template <typename T>
+  const T &at(size_t r, size_t c) const noexcept {
+    return *this->address<T>(r, c);
+  }
+};
+
+// implement data access for views whose rows are not packed
+template <class derived>
+class strided_accesser : public const_strided_accesser<derived> {
+ private:
+  uint8_t *impl_row(size_t r) const noexcept {
+    const auto *d = static_cast<const derived *>(this);
+    assert(r < d->rows());
+    return reinterpret_cast<uint8_t *>(d->impl_get_data_for_accesser()) +
+           r * d->pitch();
+  }
+
+ public:
+  using const_strided_accesser<derived>::row;
+  using const_strided_accesser<derived>::address;
+  using const_strided_accesser<derived>::at;
+
+  void *row(size_t r) noexcept { return this->impl_row(r); }
+
+  template <typename T>
+  T *address(size_t r, size_t c) noexcept {
+    static_assert(!std::is_same_v<T, void>, "T should not be void");
+    assert(sizeof(T) == static_cast<derived *>(this)->element_bytes());
+    assert(c < static_cast<derived *>(this)->cols());
+    return reinterpret_cast<T *>(this->impl_row(r)) + c;
+  }
+
+  template <typename T>
+  T &at(size_t r, size_t c) noexcept {
+    return *this->address<T>(r, c);
+  }
+};
+
 class void_deleter {
  public:
-  void operator()(void *data) const noexcept { free_memory_aligned(data); }
+  // nullptr means the memory comes from allocate_memory_aligned
+  map_allocator *allocator{nullptr};
+  // bytes passed to allocator->allocate
+  size_t bytes{0};
+
+  void operator()(void *data) const noexcept {
+    if (this->allocator != nullptr) {
+      this->allocator->deallocate(data, this->bytes);
+    } else {
+      free_memory_aligned(data);
+    }
+  }
 };
 
 template <class T>
@@ -254,12 +327,17 @@ concept map_like = requires(T t) {
 using const_fractal_map_t = const fractal_map;
 }  // namespace internal
 
+class strided_view;
+class constant_strided_view;
+
 class unique_map : public internal::map_accesser<unique_map>,
                    // public internal::const_map_accesser<unique_map>,
                    public internal::map_base {
  private:
   std::unique_ptr<void, internal::void_deleter> m_data{nullptr};
+  // in bytes
   size_t m_capacity{0};
+  map_allocator *m_allocator{&map_allocator::default_allocator()};
 
   template <class T>
   friend class internal::map_accesser;
@@ -270,6 +348,10 @@ class unique_map : public internal::map_accesser<unique_map>,
     return this->m_data.get();
   }
 
+  // Replace the memory with a new allocation of this map's allocator, copying
+  // copy_bytes bytes of the old data.
+  void reallocate(size_t bytes, size_t copy_bytes) noexcept;
+
  public:
   unique_map() = default;
   unique_map(unique_map &&);
@@ -277,16 +359,17 @@ class unique_map : public internal::map_accesser<unique_map>,
 
   explicit unique_map(internal::map_base);
   unique_map(size_t r, size_t c, size_t ele_bytes);
+  // The allocator must outlive this map.
+  unique_map(size_t r, size_t c, size_t ele_bytes, map_allocator &allocator);
   explicit operator fractal_map() noexcept;
   explicit operator internal::const_fractal_map_t() const noexcept;
 
   unique_map &operator=(const unique_map &src) & noexcept;
   unique_map &operator=(unique_map &&src) & noexcept;
 
+  // in bytes
   inline size_t capacity() const noexcept { return this->m_capacity; }
-  inline size_t capacity_bytes() const noexcept {
-    return this->m_capacity * this->element_bytes();
-  }
+  inline size_t capacity_bytes() const noexcept { return this->capacity(); }
 
   consteval bool own_memory() const noexcept { return true; }
   consteval bool has_ownership() const noexcept { return true; }
@@ -304,6 +387,13 @@ class unique_map : public internal::map_accesser<unique_map>,
 
   void shrink_to_fit() noexcept;
 
+  [[nodiscard]] inline map_allocator &allocator() const noexcept {
+    return *this->m_allocator;
+  }
+  // Move the data into memory of another allocator, which must outlive this
+  // map. Later allocations also use it.
+  void set_allocator(map_allocator &allocator) noexcept;
+
   auto &unwrap_ptr() noexcept { return this->m_data; }
 
   template <class T>
@@ -344,6 +434,10 @@ class map_view : public internal::map_accesser<map_view>,
   explicit operator fractal_map() noexcept;
   explicit operator const fractal_map() const noexcept;
 
+  // A zero-copy view of the rows [r0, r0 + r) and columns [c0, c0 + c).
+  [[nodiscard]] strided_view subview(size_t r0, size_t c0, size_t r,
+                                     size_t c) const noexcept;
+
   consteval bool own_memory() const noexcept { return false; }
   consteval bool has_ownership() const noexcept { return false; }
 };
@@ -378,10 +472,102 @@ class constant_view : public internal::const_map_accesser<constant_view>,
 
   constant_view &operator=(const constant_view &) & noexcept;
 
+  // A zero-copy view of the rows [r0, r0 + r) and columns [c0, c0 + c).
+  [[nodiscard]] constant_strided_view subview(size_t r0, size_t c0, size_t r,
+                                              size_t c) const noexcept;
+
+  consteval bool own_memory() const noexcept { return false; }
+  consteval bool has_ownership() const noexcept { return false; }
+};
+
+// A view whose rows are pitch bytes apart, for example a sub-region of a
+// larger map. It has no data() on purpose: the elements are not contiguous
+// unless is_contiguous() is true, so it can not be copied with one memcpy.
+class strided_view : public internal::strided_accesser<strided_view>,
+                     public internal::map_base {
+ private:
+  void *m_data{nullptr};
+  // in bytes
+  size_t m_pitch{0};
+
+  template <class T>
+  friend class internal::strided_accesser;
+  template <class T>
+  friend class internal::const_strided_accesser;
+
+  friend class constant_strided_view;
+
+  void *impl_get_data_for_accesser() const noexcept { return this->m_data; }
+
+ public:
+  strided_view() = default;
+  strided_view(const strided_view &) = default;
+  strided_view(strided_view &&) = default;
+  strided_view(void *_data, size_t r, size_t c, size_t eleb, size_t pitch);
+
+  strided_view(map_view src);
+  strided_view(unique_map &src);
+  strided_view(fractal_map &src);
+
+  strided_view &operator=(const strided_view &) & noexcept = default;
+
+  [[nodiscard]] inline size_t pitch() const noexcept { return this->m_pitch; }
+  [[nodiscard]] inline bool is_contiguous() const noexcept {
+    return this->m_pitch == this->cols() * this->element_bytes();
+  }
+
+  [[nodiscard]] strided_view subview(size_t r0, size_t c0, size_t r,
+                                     size_t c) const noexcept;
+
+  consteval bool own_memory() const noexcept { return false; }
+  consteval bool has_ownership() const noexcept { return false; }
+};
+
+class constant_strided_view
+    : public internal::const_strided_accesser<constant_strided_view>,
+      public internal::map_base {
+ private:
+  const void *m_data{nullptr};
+  // in bytes
+  size_t m_pitch{0};
+
+  template <class T>
+  friend class internal::const_strided_accesser;
+
+  const void *impl_get_data_for_accesser() const noexcept {
+    return this->m_data;
+  }
+
+ public:
+  constant_strided_view() = default;
+  constant_strided_view(const constant_strided_view &) = default;
+  constant_strided_view(constant_strided_view &&) = default;
+  constant_strided_view(const void *_data, size_t r, size_t c, size_t eleb,
+                        size_t pitch);
+
+  constant_strided_view(const strided_view &src);
+  // Other maps convert through constant_view, so that functions overloaded on
+  // both view types stay unambiguous for them.
+  constant_strided_view(constant_view src);
+
+  constant_strided_view &operator=(const constant_strided_view &) & noexcept =
+      default;
+
+  [[nodiscard]] inline size_t pitch() const noexcept { return this->m_pitch; }
+  [[nodiscard]] inline bool is_contiguous() const noexcept {
+    return this->m_pitch == this->cols() * this->element_bytes();
+  }
+
+  [[nodiscard]] constant_strided_view subview(size_t r0, size_t c0, size_t r,
+                                              size_t c) const noexcept;
+
   consteval bool own_memory() const noexcept { return false; }
   consteval bool has_ownership() const noexcept { return false; }
 };
 
+// Copy the elements of src row by row into dst, which is reshaped to fit.
+void copy(constant_strided_view src, unique_map &dst) noexcept;
+
 }  // namespace fractal_utils
 
 #endif  // FRACTALUTILS_COREUTILS_UNIQUEMAP_H
\ No newline at end of file
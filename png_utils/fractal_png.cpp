@@ -148,6 +148,11 @@ bool fractal_utils::write_png(const char *const filename, const color_space cs,
 
 bool fractal_utils::write_png(const char *const filename, const color_space cs,
                               constant_view map) noexcept {
+  return write_png(filename, cs, constant_strided_view{map});
+}
+
+bool fractal_utils::write_png(const char *const filename, const color_space cs,
+                              constant_strided_view map) noexcept {
   using namespace fractal_utils;
   const bool is_ok = uint32_t(cs) == map.element_bytes();
 
@@ -189,8 +194,7 @@ bool fractal_utils::write_png(const char *const filename, const color_space cs,
   png_write_info(wt.png, wt.info);
 
   for (uint64_t r = 0; r < map.rows(); r++) {
-    png_write_row(wt.png, reinterpret_cast<const uint8_t *>(map.data()) +
-                              r * map.cols() * map.element_bytes());
+    png_write_row(wt.png, reinterpret_cast<const uint8_t *>(map.row(r)));
   }
 
   png_write_end(wt.png, wt.info);
@@ -204,30 +208,21 @@ bool fractal_utils::write_png_skipped(
     const char *filename, const color_space cs, constant_view cv,
     const uint64_t skip_rows, const uint64_t skip_cols,
     std::vector<const void *> &buffer) noexcept {
-  if (skip_rows * 2 >= cv.rows()) {
-    return false;
-  }
-  if (skip_cols * 2 >= cv.cols()) {
-    return false;
-  }
-  const uint64_t image_rows = cv.rows() - 2 * skip_rows;
-  const uint64_t image_cols = cv.cols() - 2 * skip_cols;
-
   buffer.clear();
-  buffer.reserve(image_rows);
-  for (uint64_t r = skip_rows; r < cv.rows() - skip_rows; r++) {
-    const uint64_t offset = r * cv.cols() + skip_cols;
-    buffer.emplace_back(reinterpret_cast<const uint8_t *>(cv.data()) +
-                        offset * cv.element_bytes());
-  }
-
-  return write_png(filename, cs, buffer.data(), image_rows, image_cols);
+  return write_png_skipped(filename, cs, cv, skip_rows, skip_cols);
 }
 
 bool fractal_utils::write_png_skipped(const char *filename,
                                       const color_space cs, constant_view cv,
                                       const uint64_t skip_rows,
                                       const uint64_t skip_cols) noexcept {
-  std::vector<const void *> buf;
-  return write_png_skipped(filename, cs, cv, skip_rows, skip_cols, buf);
-}
\ No newline at end of file
+  if (skip_rows * 2 >= cv.rows()) {
+    return false;
+  }
+  if (skip_cols * 2 >= cv.cols()) {
+    return false;
+  }
+  return write_png(filename, cs,
+                   cv.subview(skip_rows, skip_cols, cv.rows() - 2 * skip_rows,
+                              cv.cols() - 2 * skip_cols));
+}
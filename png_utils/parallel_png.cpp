@@ -0,0 +1,424 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "png_utils.h"
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+
+#include "map_algorithms.h"
+
+using namespace fractal_utils;
+
+namespace {
+
+constexpr std::array<uint8_t, 8> png_signature{137, 80, 78, 71,
+                                               13,  10, 26, 10};
+// deflate refers at most this far back, so a band is primed with this many
+// filtered bytes of the band above it and compresses almost as well as one
+// long stream
+constexpr size_t deflate_window_bytes = size_t(1) << 15;
+// smaller bands are not worth a stream of their own
+constexpr size_t min_band_bytes = size_t(1) << 17;
+// IDAT chunks are cut at this size, far below the 2^31-1 limit of a chunk
+constexpr size_t max_idat_bytes = size_t(1) << 20;
+// avail_in and avail_out of z_stream are 32 bit
+constexpr size_t max_deflate_step = size_t(1) << 30;
+
+using png_sink_t = std::function<bool(std::span<const uint8_t>)>;
+
+void put_u32(uint8_t *dst, uint32_t v) noexcept {
+  dst[0] = uint8_t(v >> 24);
+  dst[1] = uint8_t(v >> 16);
+  dst[2] = uint8_t(v >> 8);
+  dst[3] = uint8_t(v);
+}
+
+uint32_t chunk_crc(const char *type, std::span<const uint8_t> data) noexcept {
+  uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+  if (!data.empty()) {
+    // a null buffer would make zlib return the initial value instead
+    crc = crc32_z(crc, data.data(), data.size());
+  }
+  return uint32_t(crc);
+}
+
+bool write_chunk(const png_sink_t &sink, const char *type,
+                 std::span<const uint8_t> data, uint32_t crc) noexcept {
+  std::array<uint8_t, 8> head;
+  put_u32(head.data(), uint32_t(data.size()));
+  memcpy(head.data() + 4, type, 4);
+  std::array<uint8_t, 4> tail;
+  put_u32(tail.data(), crc);
+  return sink(head) && (data.empty() || sink(data)) && sink(tail);
+}
+
+// Copy one row into PNG channel order. write_png makes libpng swap alpha for
+// u8c4, so the first byte of each pixel is taken as alpha here too.
+void pack_row(const uint8_t *src, uint8_t *dst, color_space cs,
+              size_t cols) noexcept {
+  if (cs != color_space::u8c4) {
+    memcpy(dst, src, cols * size_t(cs));
+    return;
+  }
+  for (size_t c = 0; c < cols; c++) {
+    dst[4 * c + 0] = src[4 * c + 1];
+    dst[4 * c + 1] = src[4 * c + 2];
+    dst[4 * c + 2] = src[4 * c + 3];
+    dst[4 * c + 3] = src[4 * c + 0];
+  }
+}
+
+inline uint8_t paeth(int a, int b, int c) noexcept {
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return uint8_t(a);
+  }
+  return uint8_t(pb <= pc ? b : c);
+}
+
+// Apply PNG filter type to row, prev is the row above (zeros for the first
+// row of the image) and bpp the number of bytes per pixel.
+void filter_row(int type, const uint8_t *row, const uint8_t *prev,
+                size_t bytes, size_t bpp, uint8_t *dst) noexcept {
+  switch (type) {
+    case 0:
+      memcpy(dst, row, bytes);
+      return;
+    case 1:
+      memcpy(dst, row, bpp);
+      for (size_t i = bpp; i < bytes; i++) {
+        dst[i] = uint8_t(row[i] - row[i - bpp]);
+      }
+      return;
+    case 2:
+      for (size_t i = 0; i < bytes; i++) {
+        dst[i] = uint8_t(row[i] - prev[i]);
+      }
+      return;
+    case 3:
+      for (size_t i = 0; i < bpp; i++) {
+        dst[i] = uint8_t(row[i] - (prev[i] >> 1));
+      }
+      for (size_t i = bpp; i < bytes; i++) {
+        dst[i] = uint8_t(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+      }
+      return;
+    default:
+      for (size_t i = 0; i < bpp; i++) {
+        dst[i] = uint8_t(row[i] - prev[i]);
+      }
+      for (size_t i = bpp; i < bytes; i++) {
+        dst[i] = uint8_t(row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]));
+      }
+      return;
+  }
+}
+
+// the heuristic of libpng: bytes are taken as signed and the filter with the
+// smallest sum of magnitudes wins
+uint64_t filtered_cost(const uint8_t *data, size_t bytes) noexcept {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    sum += data[i] < 128 ? data[i] : 256 - data[i];
+  }
+  return sum;
+}
+
+// second byte of the zlib header for a 32K window, FLEVEL only tells how
+// hard deflate tried
+uint8_t zlib_flags(int level) noexcept {
+  if (level < 2) {
+    return 0x01;
+  }
+  if (level < 6) {
+    return 0x5E;
+  }
+  return level == 6 ? 0x9C : 0xDA;
+}
+
+struct band_stream {
+  std::vector<uint8_t> data;
+  // one crc for each max_idat_bytes piece of data
+  std::vector<uint32_t> crcs;
+  uint32_t adler;
+  bool success{false};
+};
+
+// Raw deflate of one band. Every band but the last ends with a sync flush,
+// which pads the stream to a byte boundary without marking the last block,
+// so the bands can be concatenated into a single stream.
+bool deflate_band(std::span<const uint8_t> src, std::span<const uint8_t> dict,
+                  bool is_last, int level, size_t reserved,
+                  std::vector<uint8_t> &dst) noexcept {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+    return false;
+  }
+  if (!dict.empty() &&
+      deflateSetDictionary(&zs, dict.data(), uInt(dict.size())) != Z_OK) {
+    deflateEnd(&zs);
+    return false;
+  }
+
+  dst.resize(reserved + deflateBound(&zs, src.size()) + 64);
+  size_t consumed = 0;
+  size_t produced = reserved;
+  bool success = false;
+  while (true) {
+    if (dst.size() - produced < 64) {
+      dst.resize(dst.size() * 2);
+    }
+    const size_t in_step = std::min(src.size() - consumed, max_deflate_step);
+    const size_t out_step = std::min(dst.size() - produced, max_deflate_step);
+    const bool is_final_step = consumed + in_step == src.size();
+    zs.next_in = const_cast<Bytef *>(src.data() + consumed);
+    zs.avail_in = uInt(in_step);
+    zs.next_out = dst.data() + produced;
+    zs.avail_out = uInt(out_step);
+
+    const int flush =
+        is_final_step ? (is_last ? Z_FINISH : Z_SYNC_FLUSH) : Z_NO_FLUSH;
+    const int ret = deflate(&zs, flush);
+    consumed += in_step - zs.avail_in;
+    produced += out_step - zs.avail_out;
+
+    if (ret == Z_STREAM_END) {
+      success = true;
+      break;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      break;
+    }
+    if (!is_last && is_final_step && zs.avail_in == 0 && zs.avail_out != 0) {
+      success = true;
+      break;
+    }
+  }
+  deflateEnd(&zs);
+  dst.resize(produced);
+  return success;
+}
+
+bool encode_png(const color_space cs, constant_strided_view cv,
+                const png_encode_options &opt,
+                const png_sink_t &sink) noexcept {
+  if (uint32_t(cs) != cv.element_bytes()) {
+    fmt::print(
+        "\nError : function write_png_parallel failed. The given color space "
+        "is u8c{}, but the size of element is {}.\n",
+        int(cs), cv.element_bytes());
+    return false;
+  }
+  const size_t rows = cv.rows();
+  const size_t cols = cv.cols();
+  if (rows == 0 || cols == 0 || rows > 0x7FFFFFFF || cols > 0x7FFFFFFF) {
+    fmt::print(
+        "\nError : function write_png_parallel failed. Can not encode an "
+        "image of {} rows and {} cols.\n",
+        rows, cols);
+    return false;
+  }
+  const int level = std::clamp(opt.level, 0, 9);
+  const size_t bpp = size_t(cs);
+  const size_t row_bytes = cols * bpp;
+  const size_t stride = row_bytes + 1;
+  const int workers = internal::map_algorithm_workers(rows, cols, opt.threads);
+
+  // filter every row, each row only needs its neighbour above
+  std::vector<uint8_t> filtered(rows * stride);
+  internal::parallel_for_rows(
+      rows, workers, [&](size_t beg, size_t end, int) {
+        std::vector<uint8_t> prev(row_bytes, 0);
+        std::vector<uint8_t> cur(row_bytes);
+        std::vector<uint8_t> best(row_bytes);
+        std::vector<uint8_t> trial(row_bytes);
+        if (beg > 0) {
+          pack_row(reinterpret_cast<const uint8_t *>(cv.row(beg - 1)),
+                   prev.data(), cs, cols);
+        }
+        for (size_t r = beg; r < end; r++) {
+          pack_row(reinterpret_cast<const uint8_t *>(cv.row(r)), cur.data(),
+                   cs, cols);
+          int best_type = 0;
+          uint64_t best_cost = UINT64_MAX;
+          for (int type = 0; type < 5; type++) {
+            filter_row(type, cur.data(), prev.data(), row_bytes, bpp,
+                       trial.data());
+            const uint64_t cost = filtered_cost(trial.data(), row_bytes);
+            if (cost < best_cost) {
+              best_cost = cost;
+              best_type = type;
+              std::swap(best, trial);
+            }
+          }
+          uint8_t *const dst = filtered.data() + r * stride;
+          dst[0] = uint8_t(best_type);
+          memcpy(dst + 1, best.data(), row_bytes);
+          std::swap(prev, cur);
+        }
+      });
+
+  size_t band_rows = opt.band_rows;
+  if (band_rows == 0) {
+    const size_t by_workers = (rows + 4 * workers - 1) / (4 * workers);
+    const size_t by_bytes = (min_band_bytes + stride - 1) / stride;
+    band_rows = std::max(by_workers, by_bytes);
+  }
+  band_rows = std::clamp<size_t>(band_rows, 1, rows);
+  const size_t band_num = (rows + band_rows - 1) / band_rows;
+
+  std::vector<band_stream> bands(band_num);
+  internal::parallel_for_rows(
+      band_num, std::min<int>(workers, band_num),
+      [&](size_t beg, size_t end, int) {
+        for (size_t b = beg; b < end; b++) {
+          const size_t offset = b * band_rows * stride;
+          const size_t bytes =
+              (std::min(rows, (b + 1) * band_rows) - b * band_rows) * stride;
+          const size_t dict_bytes = std::min(offset, deflate_window_bytes);
+          const std::span<const uint8_t> src{filtered.data() + offset, bytes};
+          band_stream &band = bands[b];
+          // the first band leaves room for the zlib header
+          if (!deflate_band(src, {src.data() - dict_bytes, dict_bytes},
+                            b + 1 == band_num, level, b == 0 ? 2 : 0,
+                            band.data)) {
+            continue;
+          }
+          if (b == 0) {
+            band.data[0] = 0x78;
+            band.data[1] = zlib_flags(level);
+          }
+          band.adler = uint32_t(adler32_z(1, src.data(), src.size()));
+          for (size_t p = 0; p < band.data.size(); p += max_idat_bytes) {
+            const size_t len = std::min(max_idat_bytes, band.data.size() - p);
+            band.crcs.emplace_back(
+                chunk_crc("IDAT", {band.data.data() + p, len}));
+          }
+          band.success = true;
+        }
+      });
+
+  uLong adler = 1;
+  for (size_t b = 0; b < band_num; b++) {
+    if (!bands[b].success) {
+      fmt::print(
+          "\nError : function write_png_parallel failed. zlib failed to "
+          "compress band {}.\n",
+          b);
+      return false;
+    }
+    const size_t band_bytes =
+        (std::min(rows, (b + 1) * band_rows) - b * band_rows) * stride;
+    adler = b == 0 ? bands[0].adler
+                   : adler32_combine(adler, bands[b].adler,
+                                     z_off_t(band_bytes));
+  }
+
+  std::array<uint8_t, 13> ihdr;
+  put_u32(ihdr.data(), uint32_t(cols));
+  put_u32(ihdr.data() + 4, uint32_t(rows));
+  ihdr[8] = 8;
+  switch (cs) {
+    case color_space::u8c1:
+      ihdr[9] = 0;
+      break;
+    case color_space::u8c3:
+      ihdr[9] = 2;
+      break;
+    case color_space::u8c4:
+      ihdr[9] = 6;
+      break;
+  }
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+
+  if (!sink(png_signature) ||
+      !write_chunk(sink, "IHDR", ihdr, chunk_crc("IHDR", ihdr))) {
+    return false;
+  }
+  for (const band_stream &band : bands) {
+    for (size_t p = 0, i = 0; p < band.data.size(); p += max_idat_bytes, i++) {
+      const size_t len = std::min(max_idat_bytes, band.data.size() - p);
+      if (!write_chunk(sink, "IDAT", {band.data.data() + p, len},
+                       band.crcs[i])) {
+        return false;
+      }
+    }
+  }
+  std::array<uint8_t, 4> trailer;
+  put_u32(trailer.data(), uint32_t(adler));
+  return write_chunk(sink, "IDAT", trailer, chunk_crc("IDAT", trailer)) &&
+         write_chunk(sink, "IEND", {}, chunk_crc("IEND", {}));
+}
+
+}  // namespace
+
+bool fractal_utils::write_png_parallel(const char *const filename,
+                                       const color_space cs,
+                                       constant_strided_view cv,
+                                       const png_encode_options &opt) noexcept {
+  FILE *fp;
+#ifdef _WIN32
+  fopen_s(&fp, filename, "wb");
+#else
+  fp = fopen(filename, "wb");
+#endif
+  if (fp == NULL) {
+    fmt::print("\nError : function write_png_parallel failed. fopen failed.\n");
+    return false;
+  }
+
+  const bool success =
+      encode_png(cs, cv, opt, [fp](std::span<const uint8_t> data) {
+        return fwrite(data.data(), 1, data.size(), fp) == data.size();
+      });
+  if (fclose(fp) != 0 || !success) {
+    fmt::print("\nError : function write_png_parallel failed to write {}.\n",
+               filename);
+    return false;
+  }
+  return true;
+}
+
+bool fractal_utils::encode_png_parallel(
+    const color_space cs, constant_strided_view cv, std::vector<uint8_t> &png,
+    const png_encode_options &opt) noexcept {
+  png.clear();
+  return encode_png(cs, cv, opt, [&png](std::span<const uint8_t> data) {
+    png.insert(png.end(), data.begin(), data.end());
+    return true;
+  });
+}
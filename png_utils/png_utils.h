@@ -41,15 +41,46 @@ enum class color_space : uint8_t { u8c1 = 1, u8c3 = 3, u8c4 = 4 };
 [[nodiscard]] bool write_png(const char *const filename, const color_space cs,
                              constant_view cv) noexcept;
 
-[[nodiscard]] bool write_png_skipped(
-    const char *filename, const color_space cs, constant_view cv,
-    const uint64_t skip_rows, const uint64_t skip_cols,
-    std::vector<const void *> &buffer) noexcept;
+// Rows are read pitch bytes apart, so a sub-region of a larger map can be
+// written without copying it.
+[[nodiscard]] bool write_png(const char *const filename, const color_space cs,
+                             constant_strided_view cv) noexcept;
+
+[[deprecated(
+    "The buffer is not used anymore, cropping is done by a strided view. "
+    "Use the overload without buffer instead!")]] [[nodiscard]] bool
+write_png_skipped(const char *filename, const color_space cs, constant_view cv,
+                  const uint64_t skip_rows, const uint64_t skip_cols,
+                  std::vector<const void *> &buffer) noexcept;
 
+// Write cv without skip_rows rows and skip_cols cols on each side.
 [[nodiscard]] bool write_png_skipped(const char *filename, const color_space cs,
                                      constant_view cv, const uint64_t skip_rows,
                                      const uint64_t skip_cols) noexcept;
 
+struct png_encode_options {
+  // zlib compression level, 0 to 9
+  int level{6};
+  // <= 0 means all hardware threads
+  int threads{0};
+  // Rows in each band that is deflated on its own, 0 lets the encoder choose
+  // from the size of the image and the number of threads.
+  uint64_t band_rows{0};
+};
+
+// Same image as write_png, but rows are filtered in parallel and horizontal
+// bands are deflated concurrently. Each band is primed with the tail of the
+// band above and ends on a sync flush, so they join into one zlib stream
+// that any decoder reads.
+[[nodiscard]] bool write_png_parallel(
+    const char *const filename, const color_space cs, constant_strided_view cv,
+    const png_encode_options &opt = {}) noexcept;
+
+// Encode to memory instead of a file, png is overwritten.
+[[nodiscard]] bool encode_png_parallel(
+    const color_space cs, constant_strided_view cv, std::vector<uint8_t> &png,
+    const png_encode_options &opt = {}) noexcept;
+
 }  // namespace fractal_utils
 
 #endif  // FRACTALUTILS_FRACTAL_PNG_H
\ No newline at end of file
@@ -23,11 +23,97 @@ This file is part of FractalUtils.
 
 #include "../core_utils/core_utils.h"
 
+#include <png.h>
+
 #include <cstring>
 #include <stdio.h>
+#include <vector>
 
 using namespace fractal_utils;
 
+// decode a png with libpng into tightly packed rows
+bool decode(const uint8_t *png_data, size_t png_bytes, const char *filename,
+            int channels, std::vector<uint8_t> &pixels) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  const int began =
+      png_data != nullptr
+          ? png_image_begin_read_from_memory(&image, png_data, png_bytes)
+          : png_image_begin_read_from_file(&image, filename);
+  if (!began) {
+    printf("libpng failed to read the header: %s\n", image.message);
+    return false;
+  }
+  image.format = channels == 1   ? PNG_FORMAT_GRAY
+                 : channels == 3 ? PNG_FORMAT_RGB
+                                 : PNG_FORMAT_RGBA;
+  pixels.resize(PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr)) {
+    printf("libpng failed to decode: %s\n", image.message);
+    return false;
+  }
+  return true;
+}
+
+// Write a strided view with both encoders and check that libpng decodes the
+// same pixels from both.
+bool test_parallel(color_space cs) {
+  const int channels = int(cs);
+  unique_map map{203, 157, size_t(channels)};
+  uint8_t *const data = reinterpret_cast<uint8_t *>(map.data());
+  uint32_t state = 12345;
+  for (size_t r = 0; r < map.rows(); r++) {
+    for (size_t b = 0; b < map.cols() * channels; b++) {
+      state = state * 1103515245 + 12345;
+      // smooth enough for every filter type to win somewhere
+      data[r * map.cols() * channels + b] =
+          uint8_t(r * 3 + b / channels + ((state >> 16) & 7) * (b % 3));
+    }
+  }
+  const constant_strided_view cv =
+      constant_view{map}.subview(5, 3, map.rows() - 9, map.cols() - 7);
+
+  if (!write_png("test_serial.png", cs, cv)) {
+    return false;
+  }
+  std::vector<uint8_t> expected;
+  if (!decode(nullptr, 0, "test_serial.png", channels, expected)) {
+    return false;
+  }
+
+  for (int level : {0, 1, 6, 9}) {
+    for (uint64_t band_rows : {0, 1, 7, 1000}) {
+      png_encode_options opt;
+      opt.level = level;
+      opt.threads = 4;
+      opt.band_rows = band_rows;
+      std::vector<uint8_t> png;
+      std::vector<uint8_t> pixels;
+      if (!encode_png_parallel(cs, cv, png, opt) ||
+          !decode(png.data(), png.size(), nullptr, channels, pixels)) {
+        printf("u8c%i, level %i, band_rows %i failed.\n", channels, level,
+               int(band_rows));
+        return false;
+      }
+      if (pixels != expected) {
+        printf("u8c%i, level %i, band_rows %i decoded different pixels.\n",
+               channels, level, int(band_rows));
+        return false;
+      }
+    }
+  }
+
+  std::vector<uint8_t> pixels;
+  if (!write_png_parallel("test_parallel.png", cs, cv) ||
+      !decode(nullptr, 0, "test_parallel.png", channels, pixels) ||
+      pixels != expected) {
+    printf("write_png_parallel failed for u8c%i.\n", channels);
+    return false;
+  }
+  return true;
+}
+
 int main() {
   // printf("rua~\n");
 
@@ -53,5 +139,13 @@ int main() {
 
   printf("success = %i.\n", int(success));
 
+  for (color_space cs :
+       {color_space::u8c1, color_space::u8c3, color_space::u8c4}) {
+    if (!test_parallel(cs)) {
+      return 1;
+    }
+  }
+  printf("test_parallel succeeded\n");
+
   return 0;
 }
\ No newline at end of file
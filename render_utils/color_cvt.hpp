@@ -89,5 +89,32 @@ inline FRACTAL_UTILS_CUDA_HOST_DEVICE_FUN void hsv_to_rgb(float H, float S,
   B = temp[2] + m;
 }
 
+namespace internal {
+// one channel of hsv_to_rgb_branchless, h6 = H / 60
+inline FRACTAL_UTILS_CUDA_HOST_DEVICE_FUN float hsv_channel(
+    float n, float h6, float V, float VS) noexcept {
+  float k = n + h6;
+  k = k - 6.0f * std::floor(k * (1.0f / 6.0f));
+  float t = 4.0f - k;
+  t = (k < t) ? k : t;
+  t = (t < 1.0f) ? t : 1.0f;
+  t = (t > 0.0f) ? t : 0.0f;
+  return V - VS * t;
+}
+}  // namespace internal
+
+// The same conversion without branches, table or loops, so it vectorises:
+// each channel is V - V * S * clamp(min(k, 4 - k), 0, 1), with
+// k = (n + H / 60) mod 6 and n = 5, 3, 1 for R, G and B. Any finite H is
+// accepted. The batch functions in render_utils.h give exactly these values.
+inline FRACTAL_UTILS_CUDA_HOST_DEVICE_FUN void hsv_to_rgb_branchless(
+    float H, float S, float V, float &R, float &G, float &B) noexcept {
+  const float h6 = H / 60.0f;
+  const float VS = V * S;
+  R = internal::hsv_channel(5.0f, h6, V, VS);
+  G = internal::hsv_channel(3.0f, h6, V, VS);
+  B = internal::hsv_channel(1.0f, h6, V, VS);
+}
+
 }  // namespace fractal_utils
 #endif  // FRACTALUTILS_COLOR_CVT_HPP
@@ -0,0 +1,543 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "image_resample.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include "map_algorithms.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define FRACTALUTILS_IMAGE_RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+using namespace fractal_utils;
+
+namespace {
+// the two source pixels around a destination pixel, and the 8 bit weight of
+// the second one
+struct bilinear_tap {
+  size_t first;
+  size_t second;
+  uint32_t weight;
+};
+
+bilinear_tap tap_of(size_t dst_idx, size_t src_size, double scale) noexcept {
+  double x = (double(dst_idx) + 0.5) * scale - 0.5;
+  x = std::clamp(x, 0.0, double(src_size - 1));
+  const size_t first = size_t(x);
+  const size_t second = std::min(first + 1, src_size - 1);
+  return {first, second, uint32_t(std::lround((x - double(first)) * 256))};
+}
+}  // namespace
+
+void fractal_utils::resize_bilinear_u8(constant_strided_view src,
+                                       strided_view dst, int threads) noexcept {
+  assert(src.element_bytes() == dst.element_bytes());
+  assert(src.element_bytes() >= 1 && src.element_bytes() <= 4);
+  if (src.rows() == 0 || src.cols() == 0 || dst.rows() == 0 ||
+      dst.cols() == 0) {
+    return;
+  }
+  const size_t channels = src.element_bytes();
+
+  std::vector<bilinear_tap> col_taps(dst.cols());
+  const double scale_x = double(src.cols()) / double(dst.cols());
+  for (size_t c = 0; c < dst.cols(); c++) {
+    col_taps[c] = tap_of(c, src.cols(), scale_x);
+    // in bytes from here on
+    col_taps[c].first *= channels;
+    col_taps[c].second *= channels;
+  }
+
+  const double scale_y = double(src.rows()) / double(dst.rows());
+  internal::parallel_for_rows(
+      dst.rows(),
+      internal::map_algorithm_workers(dst.rows(), dst.cols(), threads),
+      [&](size_t beg, size_t end, int) {
+        for (size_t r = beg; r < end; r++) {
+          const bilinear_tap row_tap = tap_of(r, src.rows(), scale_y);
+          const auto *top =
+              static_cast<const uint8_t *>(src.row(row_tap.first));
+          const auto *bottom =
+              static_cast<const uint8_t *>(src.row(row_tap.second));
+          auto *d = static_cast<uint8_t *>(dst.row(r));
+          const uint32_t wy = row_tap.weight;
+          for (size_t c = 0; c < dst.cols(); c++) {
+            const bilinear_tap &t = col_taps[c];
+            const uint32_t wx = t.weight;
+            for (size_t k = 0; k < channels; k++) {
+              const uint32_t upper =
+                  top[t.first + k] * (256 - wx) + top[t.second + k] * wx;
+              const uint32_t lower =
+                  bottom[t.first + k] * (256 - wx) + bottom[t.second + k] * wx;
+              d[c * channels + k] =
+                  uint8_t((upper * (256 - wy) + lower * wy + (1U << 15)) >> 16);
+            }
+          }
+        }
+      });
+}
+
+namespace {
+constexpr int weight_bits = 14;
+constexpr int32_t weight_one = 1 << weight_bits;
+constexpr int32_t weight_round = 1 << (weight_bits - 1);
+
+double filter_support(resample_filter filter) noexcept {
+  switch (filter) {
+    case resample_filter::area:
+      return 0.5;
+    case resample_filter::bilinear:
+      return 1;
+    case resample_filter::bicubic:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+double sinc(double x) noexcept {
+  if (x == 0) {
+    return 1;
+  }
+  x *= 3.14159265358979323846;
+  return std::sin(x) / x;
+}
+
+double filter_value(resample_filter filter, double x) noexcept {
+  x = std::abs(x);
+  switch (filter) {
+    case resample_filter::area:
+      return (x <= 0.5) ? 1 : 0;
+    case resample_filter::bilinear:
+      return (x < 1) ? 1 - x : 0;
+    case resample_filter::bicubic: {
+      constexpr double a = -0.5;
+      if (x < 1) {
+        return ((a + 2) * x - (a + 3)) * x * x + 1;
+      }
+      if (x < 2) {
+        return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+      }
+      return 0;
+    }
+    default:
+      return (x < 3) ? sinc(x) * sinc(x / 3) : 0;
+  }
+}
+
+// The source pixels [first[i], first[i] + taps) and their weights for each
+// destination pixel i. Destinations near the edges use fewer pixels, and
+// their remaining weights are 0.
+struct filter_taps {
+  size_t taps{0};
+  std::vector<size_t> first;
+  std::vector<int16_t> weights;
+
+  [[nodiscard]] const int16_t *weights_of(size_t i) const noexcept {
+    return this->weights.data() + i * this->taps;
+  }
+};
+
+filter_taps make_taps(size_t src_size, size_t dst_size,
+                      resample_filter filter) noexcept {
+  const double scale = double(src_size) / double(dst_size);
+  const double filter_scale = std::max(scale, 1.0);
+  const double support = filter_support(filter) * filter_scale;
+
+  filter_taps ret;
+  ret.taps = std::min(size_t(std::ceil(support)) * 2 + 1, src_size);
+  ret.first.resize(dst_size);
+  ret.weights.assign(dst_size * ret.taps, 0);
+
+  std::vector<double> w(ret.taps);
+  for (size_t i = 0; i < dst_size; i++) {
+    const double center = (double(i) + 0.5) * scale;
+    // pixel x covers [x, x + 1), so its centre is x + 0.5
+    size_t lo = size_t(std::max(0.0, std::floor(center - support + 0.5)));
+    lo = std::min(lo, src_size - ret.taps);
+    double sum = 0;
+    for (size_t k = 0; k < ret.taps; k++) {
+      w[k] = filter_value(filter,
+                          (double(lo + k) + 0.5 - center) / filter_scale);
+      sum += w[k];
+    }
+    if (sum == 0) {
+      // only when enlarging with area, the nearest pixel takes it all
+      const size_t nearest = std::min(size_t(center), src_size - 1) - lo;
+      w[std::min(nearest, ret.taps - 1)] = 1;
+      sum = 1;
+    }
+
+    ret.first[i] = lo;
+    int16_t *dst = ret.weights.data() + i * ret.taps;
+    int32_t int_sum = 0;
+    size_t largest = 0;
+    for (size_t k = 0; k < ret.taps; k++) {
+      dst[k] = int16_t(std::lround(w[k] / sum * weight_one));
+      int_sum += dst[k];
+      if (dst[k] > dst[largest]) {
+        largest = k;
+      }
+    }
+    // the weights must add up to exactly 1 so flat areas stay flat
+    dst[largest] = int16_t(dst[largest] + (weight_one - int_sum));
+  }
+  return ret;
+}
+
+inline uint8_t clamp_u8(int32_t acc) noexcept {
+  acc = (acc + weight_round) >> weight_bits;
+  return uint8_t(std::clamp(acc, 0, 255));
+}
+
+template <size_t channels>
+void horizontal_row(const uint8_t *src, uint8_t *dst, size_t dst_cols,
+                    const filter_taps &taps) noexcept {
+  for (size_t c = 0; c < dst_cols; c++) {
+    const uint8_t *s = src + taps.first[c] * channels;
+    const int16_t *w = taps.weights_of(c);
+    int32_t acc[channels]{};
+    for (size_t k = 0; k < taps.taps; k++) {
+      for (size_t ch = 0; ch < channels; ch++) {
+        acc[ch] += int32_t(w[k]) * s[k * channels + ch];
+      }
+    }
+    for (size_t ch = 0; ch < channels; ch++) {
+      dst[c * channels + ch] = clamp_u8(acc[ch]);
+    }
+  }
+}
+
+void horizontal_row(size_t channels, const uint8_t *src, uint8_t *dst,
+                    size_t dst_cols, const filter_taps &taps) noexcept {
+  switch (channels) {
+    case 1:
+      return horizontal_row<1>(src, dst, dst_cols, taps);
+    case 2:
+      return horizontal_row<2>(src, dst, dst_cols, taps);
+    case 3:
+      return horizontal_row<3>(src, dst, dst_cols, taps);
+    default:
+      return horizontal_row<4>(src, dst, dst_cols, taps);
+  }
+}
+
+// dst[j] = sum of w[k] * rows[k][j] for the bytes [begin, bytes)
+void vertical_row_scalar(const uint8_t *const *rows, const int16_t *w,
+                         size_t taps, uint8_t *dst, size_t begin,
+                         size_t bytes) noexcept {
+  for (size_t j = begin; j < bytes; j++) {
+    int32_t acc = 0;
+    for (size_t k = 0; k < taps; k++) {
+      acc += int32_t(w[k]) * rows[k][j];
+    }
+    dst[j] = clamp_u8(acc);
+  }
+}
+
+#ifdef FRACTALUTILS_IMAGE_RESAMPLE_X86
+// Two source rows per madd, 16 bytes per iteration. Integer maths, so the
+// result equals vertical_row_scalar.
+__attribute__((target("avx2"))) size_t vertical_row_avx2(
+    const uint8_t *const *rows, const int16_t *w, size_t taps, uint8_t *dst,
+    size_t bytes) noexcept {
+  const __m256i round = _mm256_set1_epi32(weight_round);
+  size_t j = 0;
+  for (; j + 16 <= bytes; j += 16) {
+    __m256i acc_lo = round;
+    __m256i acc_hi = round;
+    for (size_t k = 0; k < taps; k += 2) {
+      const __m256i a = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[k] + j)));
+      __m256i b = _mm256_setzero_si256();
+      int32_t w_pair = uint16_t(w[k]);
+      if (k + 1 < taps) {
+        b = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(rows[k + 1] + j)));
+        w_pair |= int32_t(uint32_t(uint16_t(w[k + 1])) << 16);
+      }
+      const __m256i wk = _mm256_set1_epi32(w_pair);
+      acc_lo = _mm256_add_epi32(
+          acc_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wk));
+      acc_hi = _mm256_add_epi32(
+          acc_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wk));
+    }
+    acc_lo = _mm256_srai_epi32(acc_lo, weight_bits);
+    acc_hi = _mm256_srai_epi32(acc_hi, weight_bits);
+    // bytes 0-7 in the low lane, 8-15 in the high lane
+    __m256i px = _mm256_packs_epi32(acc_lo, acc_hi);
+    px = _mm256_packus_epi16(px, px);
+    px = _mm256_permute4x64_epi64(px, 0b1000);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + j),
+                     _mm256_castsi256_si128(px));
+  }
+  return j;
+}
+
+bool cpu_has_avx2() noexcept {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+#endif
+
+void vertical_row(const uint8_t *const *rows, const int16_t *w, size_t taps,
+                  uint8_t *dst, size_t bytes) noexcept {
+  size_t j = 0;
+#ifdef FRACTALUTILS_IMAGE_RESAMPLE_X86
+  if (cpu_has_avx2()) {
+    j = vertical_row_avx2(rows, w, taps, dst, bytes);
+  }
+#endif
+  vertical_row_scalar(rows, w, taps, dst, j, bytes);
+}
+}  // namespace
+
+void fractal_utils::resize_u8(constant_strided_view src, strided_view dst,
+                              resample_filter filter, int threads) noexcept {
+  assert(src.element_bytes() == dst.element_bytes());
+  assert(src.element_bytes() >= 1 && src.element_bytes() <= 4);
+  if (src.rows() == 0 || src.cols() == 0 || dst.rows() == 0 ||
+      dst.cols() == 0) {
+    return;
+  }
+  const size_t channels = src.element_bytes();
+  const filter_taps col_taps = make_taps(src.cols(), dst.cols(), filter);
+  const filter_taps row_taps = make_taps(src.rows(), dst.rows(), filter);
+
+  // Filter the rows first, only those that the vertical pass reads.
+  const size_t row_beg = row_taps.first.front();
+  const size_t row_end = row_taps.first.back() + row_taps.taps;
+  const size_t mid_pitch = dst.cols() * channels;
+  std::vector<uint8_t> mid((row_end - row_beg) * mid_pitch);
+  internal::parallel_for_rows(
+      row_end - row_beg,
+      internal::map_algorithm_workers(row_end - row_beg, src.cols(), threads),
+      [&](size_t beg, size_t end, int) {
+        for (size_t r = beg; r < end; r++) {
+          horizontal_row(channels,
+                         static_cast<const uint8_t *>(src.row(row_beg + r)),
+                         mid.data() + r * mid_pitch, dst.cols(), col_taps);
+        }
+      });
+
+  internal::parallel_for_rows(
+      dst.rows(),
+      internal::map_algorithm_workers(dst.rows(), dst.cols(), threads),
+      [&](size_t beg, size_t end, int) {
+        std::vector<const uint8_t *> rows(row_taps.taps);
+        for (size_t r = beg; r < end; r++) {
+          for (size_t k = 0; k < row_taps.taps; k++) {
+            rows[k] =
+                mid.data() + (row_taps.first[r] - row_beg + k) * mid_pitch;
+          }
+          vertical_row(rows.data(), row_taps.weights_of(r), row_taps.taps,
+                       static_cast<uint8_t *>(dst.row(r)), mid_pitch);
+        }
+      });
+}
+
+namespace {
+// sRGB bytes to linear light in 16 bits, as int32 for the gathers
+struct linear_tables {
+  static constexpr size_t encode_size = 1 << 14;
+  // Offset into decode for alpha bytes. Alpha is not gamma encoded, so the
+  // upper half only scales it to 16 bits.
+  static constexpr int32_t alpha_offset = 256;
+  int32_t decode[512];
+  uint8_t encode[encode_size];
+
+  linear_tables() noexcept {
+    for (int i = 0; i < 256; i++) {
+      const double c = i / 255.0;
+      const double linear =
+          (c <= 0.04045) ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+      this->decode[i] = int32_t(std::lround(linear * 65535));
+      this->decode[alpha_offset + i] = i * 257;
+    }
+    for (size_t i = 0; i < encode_size; i++) {
+      const double linear = double(i) / (encode_size - 1);
+      const double c = (linear <= 0.0031308)
+                           ? linear * 12.92
+                           : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+      this->encode[i] = uint8_t(std::lround(c * 255));
+    }
+  }
+};
+
+const linear_tables &srgb_tables() noexcept {
+  static const linear_tables tables;
+  return tables;
+}
+
+// acc[j] += decode[row[j]] for j in [begin, bytes), where the 4th byte of
+// each pixel is looked up as alpha if has_alpha
+void accumulate_linear_scalar(const uint8_t *row, const int32_t *decode,
+                              uint32_t *acc, size_t begin, size_t bytes,
+                              bool has_alpha) noexcept {
+  for (size_t j = begin; j < bytes; j++) {
+    const bool alpha = has_alpha && (j % 4 == 3);
+    acc[j] +=
+        uint32_t(decode[row[j] + (alpha ? linear_tables::alpha_offset : 0)]);
+  }
+}
+
+#ifdef FRACTALUTILS_IMAGE_RESAMPLE_X86
+__attribute__((target("avx2"))) size_t accumulate_linear_avx2(
+    const uint8_t *row, const int32_t *decode, uint32_t *acc, size_t bytes,
+    bool has_alpha) noexcept {
+  // 8 bytes are 2 whole pixels of 4 channels
+  const int32_t a = has_alpha ? linear_tables::alpha_offset : 0;
+  const __m256i offset = _mm256_setr_epi32(0, 0, 0, a, 0, 0, 0, a);
+  size_t j = 0;
+  for (; j + 8 <= bytes; j += 8) {
+    const __m256i idx = _mm256_add_epi32(
+        _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + j))),
+        offset);
+    __m256i *dst = reinterpret_cast<__m256i *>(acc + j);
+    _mm256_storeu_si256(
+        dst, _mm256_add_epi32(_mm256_loadu_si256(dst),
+                              _mm256_i32gather_epi32(decode, idx, 4)));
+  }
+  return j;
+}
+#endif
+
+void accumulate_linear(const uint8_t *row, const int32_t *decode,
+                       uint32_t *acc, size_t bytes, bool has_alpha) noexcept {
+  size_t j = 0;
+#ifdef FRACTALUTILS_IMAGE_RESAMPLE_X86
+  if (cpu_has_avx2()) {
+    j = accumulate_linear_avx2(row, decode, acc, bytes, has_alpha);
+  }
+#endif
+  accumulate_linear_scalar(row, decode, acc, j, bytes, has_alpha);
+}
+
+void check_downsample(constant_strided_view src, strided_view dst,
+                      int factor) noexcept {
+  assert(factor >= 1 && factor <= max_downsample_factor);
+  assert(src.element_bytes() == dst.element_bytes());
+  assert(dst.rows() == src.rows() / factor);
+  assert(dst.cols() == src.cols() / factor);
+}
+}  // namespace
+
+void fractal_utils::downsample_u8(constant_strided_view src, strided_view dst,
+                                  int factor, int threads) noexcept {
+  check_downsample(src, dst, factor);
+  if (dst.rows() == 0 || dst.cols() == 0) {
+    return;
+  }
+  const linear_tables &tables = srgb_tables();
+  const size_t f = size_t(factor);
+  const size_t channels = src.element_bytes();
+  // the 4th byte of u8c4 is alpha
+  const bool has_alpha = (channels == 4);
+  // bytes of src covered by the blocks of a row
+  const size_t src_bytes = dst.cols() * f * channels;
+  // the mean of f * f samples of up to 65535, to an index of encode
+  const float to_index =
+      float(linear_tables::encode_size - 1) / (65535.0f * float(f * f));
+  // the same for alpha, to a byte
+  const uint32_t alpha_divisor = uint32_t(f * f) * 257;
+
+  internal::parallel_for_rows(
+      dst.rows(),
+      internal::map_algorithm_workers(dst.rows(), src.cols(), threads),
+      [&](size_t beg, size_t end, int) {
+        std::vector<uint32_t> acc(src_bytes);
+        for (size_t r = beg; r < end; r++) {
+          std::fill(acc.begin(), acc.end(), 0);
+          for (size_t dy = 0; dy < f; dy++) {
+            accumulate_linear(
+                static_cast<const uint8_t *>(src.row(r * f + dy)),
+                tables.decode, acc.data(), src_bytes, has_alpha);
+          }
+          auto *d = static_cast<uint8_t *>(dst.row(r));
+          for (size_t c = 0; c < dst.cols(); c++) {
+            for (size_t k = 0; k < channels; k++) {
+              uint32_t sum = 0;
+              for (size_t dx = 0; dx < f; dx++) {
+                sum += acc[(c * f + dx) * channels + k];
+              }
+              if (has_alpha && k == 3) {
+                d[c * channels + k] =
+                    uint8_t((sum + alpha_divisor / 2) / alpha_divisor);
+                continue;
+              }
+              const size_t index = size_t(float(sum) * to_index + 0.5f);
+              d[c * channels + k] = tables.encode[std::min(
+                  index, linear_tables::encode_size - 1)];
+            }
+          }
+        }
+      });
+}
+
+void fractal_utils::downsample_float(constant_strided_view src,
+                                     strided_view dst, int factor,
+                                     int threads) noexcept {
+  check_downsample(src, dst, factor);
+  assert(src.element_bytes() % sizeof(float) == 0);
+  if (dst.rows() == 0 || dst.cols() == 0) {
+    return;
+  }
+  const size_t f = size_t(factor);
+  const size_t channels = src.element_bytes() / sizeof(float);
+  const size_t src_floats = dst.cols() * f * channels;
+  const float scale = 1.0f / float(f * f);
+
+  internal::parallel_for_rows(
+      dst.rows(),
+      internal::map_algorithm_workers(dst.rows(), src.cols(), threads),
+      [&](size_t beg, size_t end, int) {
+        std::vector<float> acc(src_floats);
+        for (size_t r = beg; r < end; r++) {
+          std::fill(acc.begin(), acc.end(), 0.0f);
+          for (size_t dy = 0; dy < f; dy++) {
+            const auto *s = static_cast<const float *>(src.row(r * f + dy));
+            // contiguous, vectorised by the compiler
+            for (size_t j = 0; j < src_floats; j++) {
+              acc[j] += s[j];
+            }
+          }
+          auto *d = static_cast<float *>(dst.row(r));
+          for (size_t c = 0; c < dst.cols(); c++) {
+            for (size_t k = 0; k < channels; k++) {
+              float sum = 0;
+              for (size_t dx = 0; dx < f; dx++) {
+                sum += acc[(c * f + dx) * channels + k];
+              }
+              d[c * channels + k] = sum * scale;
+            }
+          }
+        }
+      });
+}
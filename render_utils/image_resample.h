@@ -0,0 +1,75 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_RENDERUTILS_IMAGERESAMPLE_H
+#define FRACTALUTILS_RENDERUTILS_IMAGERESAMPLE_H
+
+#include <stdint.h>
+
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+enum class resample_filter : uint8_t {
+  // average of the covered source pixels, nearest neighbour when enlarging
+  area,
+  // triangle filter, widened when shrinking
+  bilinear,
+  // Keys cubic with a = -0.5
+  bicubic,
+  // windowed sinc with 3 lobes, the sharpest of these
+  lanczos3,
+};
+
+// Resize an 8 bit image of 1 to 4 channels per pixel (u8c1 to u8c4) to the
+// shape of dst by bilinear interpolation, with pixel centres aligned. Both
+// must have the same element bytes. src is usually a crop of a larger frame.
+// threads <= 0 means all hardware threads.
+void resize_bilinear_u8(constant_strided_view src, strided_view dst,
+                        int threads = 1) noexcept;
+
+// Resize like resize_bilinear_u8, with a separable filter whose support grows
+// with the shrink factor, so shrinking does not alias. Weights are 14 bit
+// fixed point; the vertical pass runs 16 bytes at a time with AVX2 when the
+// cpu has it, and gives the same result as the scalar path.
+void resize_u8(constant_strided_view src, strided_view dst,
+               resample_filter filter, int threads = 1) noexcept;
+
+// The largest factor accepted by downsample_u8 and downsample_float.
+constexpr int max_downsample_factor = 8;
+
+// Average each factor x factor block of src into one pixel of dst, for
+// anti-aliasing a supersampled render. dst must have src.rows() / factor
+// rows and src.cols() / factor cols; leftover rows and cols of src are
+// ignored. 8 bit channels are treated as sRGB and averaged in linear light,
+// so thin bright details keep their brightness instead of darkening; the
+// alpha byte of u8c4 is averaged as it is. Rows of the block are accumulated
+// with AVX2 when the cpu has it.
+void downsample_u8(constant_strided_view src, strided_view dst, int factor,
+                   int threads = 1) noexcept;
+// Same for maps of float channels (element bytes a multiple of 4), averaged
+// as they are.
+void downsample_float(constant_strided_view src, strided_view dst, int factor,
+                      int threads = 1) noexcept;
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_RENDERUTILS_IMAGERESAMPLE_H
@@ -19,4 +19,202 @@ This file is part of FractalUtils.
     github:https://github.com/ToKiNoBug
 */
 
-#include "render_utils.h"
\ No newline at end of file
+#include "render_utils.h"
+
+#include <stdint.h>
+
+#include "color_cvt.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define FRACTALUTILS_RENDER_UTILS_X86
+#include <immintrin.h>
+#endif
+
+using namespace fractal_utils;
+
+namespace {
+// round to the nearest 8 bit value, NaN goes to 0
+inline uint32_t to_u8(float c) noexcept {
+  float x = c * 255.0f + 0.5f;
+  x = (x > 0.0f) ? x : 0.0f;
+  x = (x < 255.0f) ? x : 255.0f;
+  return uint32_t(x);
+}
+
+inline pixel_ARGB hsv_to_argb(float H, float S, float V) noexcept {
+  float R, G, B;
+  hsv_to_rgb_branchless(H, S, V, R, G, B);
+  return 0xFF000000U | (to_u8(R) << 16) | (to_u8(G) << 8) | to_u8(B);
+}
+
+#ifdef FRACTALUTILS_RENDER_UTILS_X86
+// Every step mirrors internal::hsv_channel, so the results are identical.
+__attribute__((target("avx2"))) inline __m256 hsv_channel_avx2(
+    float n, __m256 h6, __m256 V, __m256 VS) noexcept {
+  __m256 k = _mm256_add_ps(_mm256_set1_ps(n), h6);
+  const __m256 turns =
+      _mm256_floor_ps(_mm256_mul_ps(k, _mm256_set1_ps(1.0f / 6.0f)));
+  k = _mm256_sub_ps(k, _mm256_mul_ps(_mm256_set1_ps(6.0f), turns));
+  __m256 t = _mm256_sub_ps(_mm256_set1_ps(4.0f), k);
+  t = _mm256_min_ps(k, t);
+  t = _mm256_min_ps(t, _mm256_set1_ps(1.0f));
+  t = _mm256_max_ps(t, _mm256_setzero_ps());
+  return _mm256_sub_ps(V, _mm256_mul_ps(VS, t));
+}
+
+__attribute__((target("avx2"))) inline void hsv_to_rgb_avx2(
+    const float *H, const float *S, const float *V, __m256 &R, __m256 &G,
+    __m256 &B) noexcept {
+  const __m256 h6 = _mm256_div_ps(_mm256_loadu_ps(H), _mm256_set1_ps(60.0f));
+  const __m256 v = _mm256_loadu_ps(V);
+  const __m256 vs = _mm256_mul_ps(v, _mm256_loadu_ps(S));
+  R = hsv_channel_avx2(5.0f, h6, v, vs);
+  G = hsv_channel_avx2(3.0f, h6, v, vs);
+  B = hsv_channel_avx2(1.0f, h6, v, vs);
+}
+
+__attribute__((target("avx2"))) inline __m256i to_u8_avx2(__m256 c) noexcept {
+  __m256 x = _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)),
+                           _mm256_set1_ps(0.5f));
+  x = _mm256_max_ps(x, _mm256_setzero_ps());
+  x = _mm256_min_ps(x, _mm256_set1_ps(255.0f));
+  return _mm256_cvttps_epi32(x);
+}
+
+__attribute__((target("avx2"))) inline __m256i hsv_to_argb_avx2(
+    const float *H, const float *S, const float *V) noexcept {
+  __m256 R, G, B;
+  hsv_to_rgb_avx2(H, S, V, R, G, B);
+  __m256i px = _mm256_set1_epi32(int(0xFF000000U));
+  px = _mm256_or_si256(px, _mm256_slli_epi32(to_u8_avx2(R), 16));
+  px = _mm256_or_si256(px, _mm256_slli_epi32(to_u8_avx2(G), 8));
+  return _mm256_or_si256(px, to_u8_avx2(B));
+}
+
+__attribute__((target("avx2"))) size_t hsv_to_rgb_many_avx2(
+    const float *H, const float *S, const float *V, size_t pixel_num,
+    float *R, float *G, float *B) noexcept {
+  size_t i = 0;
+  for (; i + 8 <= pixel_num; i += 8) {
+    __m256 r, g, b;
+    hsv_to_rgb_avx2(H + i, S + i, V + i, r, g, b);
+    _mm256_storeu_ps(R + i, r);
+    _mm256_storeu_ps(G + i, g);
+    _mm256_storeu_ps(B + i, b);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t hsv_to_u8c4_many_avx2(
+    const float *H, const float *S, const float *V, size_t pixel_num,
+    pixel_ARGB *dest) noexcept {
+  size_t i = 0;
+  for (; i + 8 <= pixel_num; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i),
+                        hsv_to_argb_avx2(H + i, S + i, V + i));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t hsv_to_u8c3_many_avx2(
+    const float *H, const float *S, const float *V, size_t pixel_num,
+    pixel_RGB *dest) noexcept {
+  // R, G, B of each ARGB word to the front of each 128 bit lane
+  const __m256i pack = _mm256_setr_epi8(
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,  //
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  uint8_t *out = reinterpret_cast<uint8_t *>(dest);
+  size_t i = 0;
+  // Each half stores 16 bytes of which 12 are pixels, so keep 2 pixels of
+  // room after the last group of 8 for the 4 bytes of padding.
+  for (; i + 10 <= pixel_num; i += 8) {
+    const __m256i px =
+        _mm256_shuffle_epi8(hsv_to_argb_avx2(H + i, S + i, V + i), pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i),
+                     _mm256_castsi256_si128(px));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i + 12),
+                     _mm256_extracti128_si256(px, 1));
+  }
+  return i;
+}
+
+bool cpu_has_avx2() noexcept {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+#endif
+}  // namespace
+
+void fractal_utils::hsv_to_rgb_many(const float *H, const float *S,
+                                    const float *V, size_t pixel_num,
+                                    float *R, float *G, float *B) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_RENDER_UTILS_X86
+  if (cpu_has_avx2()) {
+    i = hsv_to_rgb_many_avx2(H, S, V, pixel_num, R, G, B);
+  }
+#endif
+  for (; i < pixel_num; i++) {
+    hsv_to_rgb_branchless(H[i], S[i], V[i], R[i], G[i], B[i]);
+  }
+}
+
+void fractal_utils::hsv_to_u8c3_many(const float *H, const float *S,
+                                     const float *V, size_t pixel_num,
+                                     pixel_RGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_RENDER_UTILS_X86
+  if (cpu_has_avx2()) {
+    i = hsv_to_u8c3_many_avx2(H, S, V, pixel_num, dest);
+  }
+#endif
+  for (; i < pixel_num; i++) {
+    dest[i] = pixel_RGB{hsv_to_argb(H[i], S[i], V[i])};
+  }
+}
+
+void fractal_utils::hsv_to_u8c4_many(const float *H, const float *S,
+                                     const float *V, size_t pixel_num,
+                                     pixel_ARGB *dest) noexcept {
+  size_t i = 0;
+#ifdef FRACTALUTILS_RENDER_UTILS_X86
+  if (cpu_has_avx2()) {
+    i = hsv_to_u8c4_many_avx2(H, S, V, pixel_num, dest);
+  }
+#endif
+  for (; i < pixel_num; i++) {
+    dest[i] = hsv_to_argb(H[i], S[i], V[i]);
+  }
+}
+
+namespace {
+void check_hsv_maps(constant_view H, constant_view S, constant_view V,
+                    map_view img, size_t pixel_bytes) noexcept {
+  assert(H.element_bytes() == sizeof(float));
+  assert(S.element_bytes() == sizeof(float));
+  assert(V.element_bytes() == sizeof(float));
+  assert(img.element_bytes() == pixel_bytes);
+  assert(H.rows() == img.rows() && H.cols() == img.cols());
+  assert(S.rows() == img.rows() && S.cols() == img.cols());
+  assert(V.rows() == img.rows() && V.cols() == img.cols());
+}
+}  // namespace
+
+void fractal_utils::hsv_to_u8c3(constant_view H, constant_view S,
+                                constant_view V, map_view img) noexcept {
+  check_hsv_maps(H, S, V, img, sizeof(pixel_RGB));
+  hsv_to_u8c3_many(static_cast<const float *>(H.data()),
+                   static_cast<const float *>(S.data()),
+                   static_cast<const float *>(V.data()), img.size(),
+                   static_cast<pixel_RGB *>(img.data()));
+}
+
+void fractal_utils::hsv_to_u8c4(constant_view H, constant_view S,
+                                constant_view V, map_view img) noexcept {
+  check_hsv_maps(H, S, V, img, sizeof(pixel_ARGB));
+  hsv_to_u8c4_many(static_cast<const float *>(H.data()),
+                   static_cast<const float *>(S.data()),
+                   static_cast<const float *>(V.data()), img.size(),
+                   static_cast<pixel_ARGB *>(img.data()));
+}
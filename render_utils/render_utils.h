@@ -24,8 +24,11 @@ This file is part of FractalUtils.
 
 #include "fractal_colors.h"
 #include "fractal_map.h"
+#include "map_algorithms.h"
 #include "unique_map.h"
+#include <cassert>
 #include <functional>
+#include <span>
 
 namespace fractal_utils {
 
@@ -60,7 +63,7 @@ void render_AB(constant_view mat_A, constant_view mat_B, map_view mat_img,
 
   assert(bool(options.fun_color));
 
-  if (!options.fun_counter) {
+  if (options.fun_counter) {
     for (size_t r = options.row_beg; r < options.row_end; r++) {
       for (size_t c = options.col_beg; c < options.col_end; c++) {
         options.fun_counter(mat_A.at<A>(r, c), mat_B.at<B>(r, c));
@@ -84,6 +87,117 @@ void render_AB(const fractal_map &mat_A, const fractal_map &mat_B,
                            map_view{mat_img}, options);
 }
 
+// The region rendered by render_AB_inline and render_AB_fused.
+struct render_AB_range {
+  size_t row_beg;
+  size_t row_end;
+  size_t col_beg;
+  size_t col_end;
+};
+
+namespace internal {
+template <typename A, typename B, typename pixel_t>
+void check_render_AB(constant_view mat_A, constant_view mat_B,
+                     map_view mat_img, const render_AB_range &range) noexcept {
+  assert(mat_A.element_bytes() == sizeof(A));
+  assert(mat_B.element_bytes() == sizeof(B));
+  assert(mat_img.element_bytes() == sizeof(pixel_t));
+
+  assert(mat_A.rows() == mat_B.rows());
+  assert(mat_B.rows() == mat_img.rows());
+  assert(mat_A.cols() == mat_B.cols());
+  assert(mat_B.cols() == mat_img.cols());
+
+  assert(range.row_beg < range.row_end);
+  assert(range.row_end <= mat_A.rows());
+  assert(range.col_beg < range.col_end);
+  assert(range.col_end <= mat_A.cols());
+}
+}  // namespace internal
+
+// Like render_AB, but fun_color is any callable pixel_t(A, B) taken by value,
+// so it is inlined into a plain loop over each row. Rows are split across
+// threads (threads <= 0 means all hardware threads), so fun_color is called
+// concurrently and must not modify shared state.
+template <typename A, typename B, typename pixel_t, class color_fun_t>
+void render_AB_inline(constant_view mat_A, constant_view mat_B,
+                      map_view mat_img, const render_AB_range &range,
+                      color_fun_t fun_color, int threads = 0) noexcept {
+  internal::check_render_AB<A, B, pixel_t>(mat_A, mat_B, mat_img, range);
+  const size_t rows = range.row_end - range.row_beg;
+  const size_t cols = range.col_end - range.col_beg;
+  internal::parallel_for_rows(
+      rows, internal::map_algorithm_workers(rows, cols, threads),
+      [&](size_t beg, size_t end, int) {
+        for (size_t r = range.row_beg + beg; r < range.row_beg + end; r++) {
+          const A *__restrict a = mat_A.address<A>(r, range.col_beg);
+          const B *__restrict b = mat_B.address<B>(r, range.col_beg);
+          pixel_t *__restrict img = mat_img.address<pixel_t>(r, range.col_beg);
+          for (size_t c = 0; c < cols; c++) {
+            img[c] = fun_color(a[c], b[c]);
+          }
+        }
+      });
+}
+
+// Count and colour in a single pass over the maps: fun_counter(A, B) and then
+// fun_color(A, B) are called for each pixel. Only for colours that do not
+// depend on the final counts, such as statistics gathered alongside. Counters
+// usually keep state, so this runs on the calling thread.
+template <typename A, typename B, typename pixel_t, class counter_fun_t,
+          class color_fun_t>
+void render_AB_fused(constant_view mat_A, constant_view mat_B,
+                     map_view mat_img, const render_AB_range &range,
+                     counter_fun_t fun_counter,
+                     color_fun_t fun_color) noexcept {
+  internal::check_render_AB<A, B, pixel_t>(mat_A, mat_B, mat_img, range);
+  const size_t cols = range.col_end - range.col_beg;
+  for (size_t r = range.row_beg; r < range.row_end; r++) {
+    const A *__restrict a = mat_A.address<A>(r, range.col_beg);
+    const B *__restrict b = mat_B.address<B>(r, range.col_beg);
+    pixel_t *__restrict img = mat_img.address<pixel_t>(r, range.col_beg);
+    for (size_t c = 0; c < cols; c++) {
+      fun_counter(a[c], b[c]);
+      img[c] = fun_color(a[c], b[c]);
+    }
+  }
+}
+
+// Convert planes of H (degrees, any finite value), S and V (both in [0, 1])
+// as hsv_to_rgb_branchless does, several pixels at a time with AVX2 when the
+// cpu has it. The 8 bit versions round each channel to the nearest value and
+// write packed pixels directly, without planes of float RGB in between.
+void hsv_to_rgb_many(const float *H, const float *S, const float *V,
+                     size_t pixel_num, float *R, float *G, float *B) noexcept;
+void hsv_to_u8c3_many(const float *H, const float *S, const float *V,
+                      size_t pixel_num, pixel_RGB *dest) noexcept;
+void hsv_to_u8c4_many(const float *H, const float *S, const float *V,
+                      size_t pixel_num, pixel_ARGB *dest) noexcept;
+
+inline void hsv_to_u8c3(std::span<const float> H, std::span<const float> S,
+                        std::span<const float> V,
+                        std::span<pixel_RGB> dest) noexcept {
+  assert(H.size() == dest.size());
+  assert(S.size() == dest.size());
+  assert(V.size() == dest.size());
+  hsv_to_u8c3_many(H.data(), S.data(), V.data(), dest.size(), dest.data());
+}
+inline void hsv_to_u8c4(std::span<const float> H, std::span<const float> S,
+                        std::span<const float> V,
+                        std::span<pixel_ARGB> dest) noexcept {
+  assert(H.size() == dest.size());
+  assert(S.size() == dest.size());
+  assert(V.size() == dest.size());
+  hsv_to_u8c4_many(H.data(), S.data(), V.data(), dest.size(), dest.data());
+}
+
+// Maps of float H, S and V, and an image of pixel_RGB or pixel_ARGB of the
+// same shape.
+void hsv_to_u8c3(constant_view H, constant_view S, constant_view V,
+                 map_view img) noexcept;
+void hsv_to_u8c4(constant_view H, constant_view S, constant_view V,
+                 map_view img) noexcept;
+
 }  // namespace fractal_utils
 
 #endif  // FRACTAL_UTILS_RENDER_UTILS_RENDER_UTILS_H
\ No newline at end of file
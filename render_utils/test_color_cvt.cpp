@@ -24,14 +24,18 @@ General Public License for more details.
 #include <render_utils.h>
 #include <span>
 #include <cmath>
+#include <cstring>
 #include <fmt/format.h>
 #include <color_cvt.hpp>
+#include <vector>
 
 struct color_pair {
   std::array<float, 3> rgb;
   std::array<float, 3> hsv;
 };
 
+bool test_batch() noexcept;
+
 bool check(std::span<const float, 3> a, std::span<const float, 3> b) noexcept {
   constexpr float epsilon = 5e-3f;
   for (size_t idx = 0; idx < 3; idx++) {
@@ -69,7 +73,72 @@ int main() {
           rgb_computed[0], rgb_computed[1], rgb_computed[2]);
       err_counter++;
     }
+
+    fractal_utils::hsv_to_rgb_branchless(cp.hsv[0], cp.hsv[1], cp.hsv[2],
+                                         rgb_computed[0], rgb_computed[1],
+                                         rgb_computed[2]);
+    if (!check(cp.rgb, rgb_computed)) {
+      fmt::print(
+          "Branchless color conversion failed with hsv = [{},{},{}], "
+          "expected rgb = [{},{},{}], but the result is [{},{},{}]\n",
+          cp.hsv[0], cp.hsv[1], cp.hsv[2], cp.rgb[0], cp.rgb[1], cp.rgb[2],
+          rgb_computed[0], rgb_computed[1], rgb_computed[2]);
+      err_counter++;
+    }
+  }
+
+  if (!test_batch()) {
+    err_counter++;
   }
 
   return err_counter;
+}
+
+bool test_batch() noexcept {
+  using namespace fractal_utils;
+  // odd size for the scalar tail
+  const size_t rows = 37;
+  const size_t cols = 41;
+  fractal_map H{rows, cols, sizeof(float)};
+  fractal_map S{rows, cols, sizeof(float)};
+  fractal_map V{rows, cols, sizeof(float)};
+  for (size_t i = 0; i < H.element_count(); i++) {
+    H.at<float>(i) = float(i) * 1.7f - 720;
+    S.at<float>(i) = float(i % 101) / 100;
+    V.at<float>(i) = float(i % 97) / 96;
+  }
+
+  const size_t n = H.element_count();
+  const float *h = &H.at<float>(0);
+  const float *s = &S.at<float>(0);
+  const float *v = &V.at<float>(0);
+  std::vector<float> R(n), G(n), B(n);
+  hsv_to_rgb_many(h, s, v, n, R.data(), G.data(), B.data());
+  fractal_map img3{rows, cols, sizeof(pixel_RGB)};
+  fractal_map img4{rows, cols, sizeof(pixel_ARGB)};
+  hsv_to_u8c3(constant_view{H}, constant_view{S}, constant_view{V},
+              map_view{img3});
+  hsv_to_u8c4(constant_view{H}, constant_view{S}, constant_view{V},
+              map_view{img4});
+
+  for (size_t i = 0; i < n; i++) {
+    float r, g, b;
+    hsv_to_rgb_branchless(h[i], s[i], v[i], r, g, b);
+    if (r != R[i] || g != G[i] || b != B[i]) {
+      fmt::print("hsv_to_rgb_many differs from the scalar version at {}\n",
+                 i);
+      return false;
+    }
+    const uint8_t expected[3]{uint8_t(std::lround(r * 255)),
+                              uint8_t(std::lround(g * 255)),
+                              uint8_t(std::lround(b * 255))};
+    const pixel_ARGB argb = img4.at<pixel_ARGB>(i);
+    if (memcmp(expected, img3.at<pixel_RGB>(i).value, 3) != 0 ||
+        memcmp(pixel_RGB{argb}.value, expected, 3) != 0 ||
+        (argb >> 24) != 0xFF) {
+      fmt::print("Packed hsv conversion is wrong at {}\n", i);
+      return false;
+    }
+  }
+  return true;
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <image_resample.h>
+#include <unique_map.h>
+
+int main() {
+  using namespace fractal_utils;
+  unique_map src{97, 131, 3};
+  for (size_t r = 0; r < src.rows(); r++) {
+    for (size_t c = 0; c < src.cols(); c++) {
+      auto *px = src.address<uint8_t[3]>(r, c);
+      (*px)[0] = uint8_t(r * 2);
+      (*px)[1] = uint8_t(c);
+      (*px)[2] = uint8_t(r + c);
+    }
+  }
+
+  // the same size is an exact copy
+  unique_map same{src.rows(), src.cols(), 3};
+  resize_bilinear_u8(constant_view{src}, same);
+  if (memcmp(same.data(), src.data(), src.bytes()) != 0) {
+    fmt::print("Resizing to the same size changed the image\n");
+    return 1;
+  }
+
+  // a crop scaled up keeps the ramps in each channel monotonic
+  const constant_strided_view crop = constant_view{src}.subview(10, 20, 40, 60);
+  unique_map up{97, 131, 3};
+  resize_bilinear_u8(crop, up, 0);
+  for (size_t r = 0; r < up.rows(); r++) {
+    for (size_t c = 0; c + 1 < up.cols(); c++) {
+      const auto &a = *up.address<uint8_t[3]>(r, c);
+      const auto &b = *up.address<uint8_t[3]>(r, c + 1);
+      if (b[1] < a[1] || a[1] < 20 || b[1] > 79 || a[0] != b[0]) {
+        fmt::print("Resized crop is wrong at ({}, {})\n", r, c);
+        return 1;
+      }
+    }
+  }
+
+  const resample_filter filters[]{resample_filter::area,
+                                  resample_filter::bilinear,
+                                  resample_filter::bicubic,
+                                  resample_filter::lanczos3};
+  for (resample_filter filter : filters) {
+    // the same size is an exact copy with any filter
+    resize_u8(constant_view{src}, same, filter, 0);
+    if (memcmp(same.data(), src.data(), src.bytes()) != 0) {
+      fmt::print("Filter {} changed an image of the same size\n", int(filter));
+      return 1;
+    }
+
+    // flat stays flat, up and down, and at widths that leave a scalar tail
+    unique_map flat{53, 71, 4};
+    memset(flat.data(), 200, flat.bytes());
+    for (size_t cols : {size_t(5), size_t(23), size_t(190)}) {
+      unique_map out{37, cols, 4};
+      resize_u8(constant_view{flat}, out, filter);
+      for (size_t i = 0; i < out.bytes(); i++) {
+        if (static_cast<const uint8_t *>(out.data())[i] != 200) {
+          fmt::print("Filter {} changed a flat image\n", int(filter));
+          return 1;
+        }
+      }
+    }
+
+    // columns of 0 and 250 average out when halved
+    unique_map stripes{64, 64, 1};
+    for (size_t r = 0; r < 64; r++) {
+      for (size_t c = 0; c < 64; c++) {
+        stripes.at<uint8_t>(r, c) = (c % 2) ? 250 : 0;
+      }
+    }
+    unique_map half{32, 32, 1};
+    resize_u8(constant_view{stripes}, half, filter);
+    for (size_t r = 0; r < 32; r++) {
+      // the edges see one stripe more than the other
+      for (size_t c = 3; c + 3 < 32; c++) {
+        const int v = half.at<uint8_t>(r, c);
+        if (v < 120 || v > 130) {
+          fmt::print("Filter {} aliases when halving: {} at ({}, {})\n",
+                     int(filter), v, r, c);
+          return 1;
+        }
+      }
+    }
+  }
+
+  // every grey level survives averaging a flat block
+  for (int factor : {2, 3}) {
+    unique_map grey{size_t(factor) * 16, size_t(factor) * 16 + 1, 3};
+    unique_map small{16, 16, 3};
+    auto *g = static_cast<uint8_t *>(grey.data());
+    for (size_t r = 0; r < grey.rows(); r++) {
+      memset(g + r * grey.cols() * 3, int(r / factor) * 16 + 5,
+             grey.cols() * 3);
+    }
+    downsample_u8(constant_view{grey}, small, factor, 0);
+    for (size_t r = 0; r < 16; r++) {
+      for (size_t c = 0; c < 16 * 3; c++) {
+        if (static_cast<const uint8_t *>(small.data())[r * 48 + c] !=
+            r * 16 + 5) {
+          fmt::print("Downsampling by {} changed grey level {}\n", factor,
+                     r * 16 + 5);
+          return 1;
+        }
+      }
+    }
+  }
+
+  // black and white pixels average to mid grey in linear light, which is
+  // much brighter than 128 in sRGB. Alpha is not gamma encoded, so opaque and
+  // transparent pixels average to 128.
+  {
+    unique_map checker{34, 34, 4};
+    unique_map small{17, 17, 4};
+    for (size_t r = 0; r < 34; r++) {
+      for (size_t c = 0; c < 34; c++) {
+        checker.at<uint32_t>(r, c) = ((r + c) % 2) ? 0xFFFFFFFFU : 0;
+      }
+    }
+    downsample_u8(constant_view{checker}, small, 2);
+    for (size_t i = 0; i < small.bytes(); i++) {
+      const int v = static_cast<const uint8_t *>(small.data())[i];
+      if (i % 4 == 3) {
+        if (v != 128) {
+          fmt::print("Downsampling averaged alpha as sRGB: {}\n", v);
+          return 1;
+        }
+        continue;
+      }
+      if (v < 186 || v > 189) {
+        fmt::print("Downsampling is not gamma correct: {}\n", v);
+        return 1;
+      }
+    }
+  }
+
+  {
+    unique_map values{12, 9, sizeof(float) * 2};
+    unique_map small{3, 2, sizeof(float) * 2};
+    auto *v = static_cast<float *>(values.data());
+    for (size_t i = 0; i < values.size() * 2; i++) {
+      v[i] = float(i % 7);
+    }
+    downsample_float(constant_view{values}, small, 4);
+    for (size_t r = 0; r < 3; r++) {
+      for (size_t c = 0; c < 2; c++) {
+        for (size_t k = 0; k < 2; k++) {
+          float sum = 0;
+          for (size_t dy = 0; dy < 4; dy++) {
+            for (size_t dx = 0; dx < 4; dx++) {
+              sum += v[((r * 4 + dy) * 9 + c * 4 + dx) * 2 + k];
+            }
+          }
+          const float got = static_cast<const float *>(
+              small.data())[(r * 2 + c) * 2 + k];
+          if (std::abs(got - sum / 16) > 1e-5f) {
+            fmt::print("downsample_float is wrong at ({}, {})\n", r, c);
+            return 1;
+          }
+        }
+      }
+    }
+  }
+
+  fmt::print("test_image_resample succeeded\n");
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include <chrono>
+#include <fmt/format.h>
+#include <render_utils.h>
+
+int main() {
+  using namespace fractal_utils;
+  const size_t rows = 1080;
+  const size_t cols = 1921;
+  fractal_map mat_A{rows, cols, sizeof(uint16_t)};
+  fractal_map mat_B{rows, cols, sizeof(float)};
+  for (size_t r = 0; r < rows; r++) {
+    for (size_t c = 0; c < cols; c++) {
+      mat_A.at<uint16_t>(r, c) = uint16_t((r * 7 + c * 3) % 1000);
+      mat_B.at<float>(r, c) = float(r + c) / float(rows + cols);
+    }
+  }
+
+  const auto color = [](uint16_t a, float b) -> pixel_ARGB {
+    return 0xFF000000U | (uint32_t(a) << 8) | uint32_t(b * 255);
+  };
+  const render_AB_range range{3, rows - 5, 7, cols - 2};
+  const size_t region_size =
+      (range.row_end - range.row_beg) * (range.col_end - range.col_beg);
+
+  fractal_map img_ref{rows, cols, sizeof(pixel_ARGB)};
+  fractal_map img_inline{rows, cols, sizeof(pixel_ARGB)};
+  fractal_map img_fused{rows, cols, sizeof(pixel_ARGB)};
+  for (auto *img : {&img_ref, &img_inline, &img_fused}) {
+    for (size_t i = 0; i < img->element_count(); i++) {
+      img->at<pixel_ARGB>(i) = 0;
+    }
+  }
+
+  size_t ref_counts = 0;
+  render_AB_options<uint16_t, float, pixel_ARGB> options;
+  options.row_beg = range.row_beg;
+  options.row_end = range.row_end;
+  options.col_beg = range.col_beg;
+  options.col_end = range.col_end;
+  options.fun_counter = [&ref_counts](uint16_t, float) { ref_counts++; };
+  options.fun_color = color;
+
+  const auto t0 = std::chrono::steady_clock::now();
+  render_AB(constant_view{mat_A}, constant_view{mat_B}, map_view{img_ref},
+            options);
+  const auto t1 = std::chrono::steady_clock::now();
+  render_AB_inline<uint16_t, float, pixel_ARGB>(
+      constant_view{mat_A}, constant_view{mat_B}, map_view{img_inline}, range,
+      color);
+  const auto t2 = std::chrono::steady_clock::now();
+  size_t fused_counts = 0;
+  render_AB_fused<uint16_t, float, pixel_ARGB>(
+      constant_view{mat_A}, constant_view{mat_B}, map_view{img_fused}, range,
+      [&fused_counts](uint16_t, float) { fused_counts++; }, color);
+
+  fmt::print("render_AB {} us, render_AB_inline {} us\n",
+             std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0)
+                 .count(),
+             std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1)
+                 .count());
+
+  if (ref_counts != region_size || fused_counts != region_size) {
+    fmt::print("Counters were called {} and {} times, expected {}\n",
+               ref_counts, fused_counts, region_size);
+    return 1;
+  }
+  for (size_t i = 0; i < img_ref.element_count(); i++) {
+    if (img_ref.at<pixel_ARGB>(i) != img_inline.at<pixel_ARGB>(i) ||
+        img_ref.at<pixel_ARGB>(i) != img_fused.at<pixel_ARGB>(i)) {
+      fmt::print("Rendered images differ at {}\n", i);
+      return 1;
+    }
+  }
+
+  fmt::print("test_render_AB succeeded\n");
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include <atomic>
+#include <fmt/format.h>
+#include <tile_render_engine.h>
+#include <unique_map.h>
+
+int main() {
+  using namespace fractal_utils;
+  tile_render_engine engine{4};
+  engine.set_scratch_bytes(sizeof(uint32_t));
+
+  // odd sizes leave partial tiles on the right and at the bottom
+  unique_map img{301, 517, sizeof(uint32_t)};
+  const auto fill = [](const render_tile &tile, strided_view dst,
+                       std::span<uint8_t> scratch, int) {
+    // count the frames this tile has seen in its own scratch buffer
+    auto &frames = *reinterpret_cast<uint32_t *>(scratch.data());
+    frames++;
+    for (size_t r = 0; r < dst.rows(); r++) {
+      for (size_t c = 0; c < dst.cols(); c++) {
+        dst.at<uint32_t>(r, c) =
+            uint32_t((tile.row_beg + r) * 1000 + tile.col_beg + c) + frames;
+      }
+    }
+  };
+
+  for (uint32_t frame = 1; frame <= 3; frame++) {
+    engine.render(strided_view{img}, fill);
+    for (size_t r = 0; r < img.rows(); r++) {
+      for (size_t c = 0; c < img.cols(); c++) {
+        if (img.at<uint32_t>(r, c) != uint32_t(r * 1000 + c) + frame) {
+          fmt::print("Frame {} is wrong at ({}, {})\n", frame, r, c);
+          return 1;
+        }
+      }
+    }
+  }
+
+  const size_t tile_count = ((301 + 63) / 64) * ((517 + 63) / 64);
+  if (engine.tiles().size() != tile_count ||
+      engine.timings().size() != tile_count) {
+    fmt::print("Expected {} tiles, got {}\n", tile_count,
+               engine.tiles().size());
+    return 1;
+  }
+  for (const auto &timing : engine.timings()) {
+    if (timing.worker < 0 || timing.worker >= engine.threads()) {
+      fmt::print("Invalid worker {} in tile timings\n", timing.worker);
+      return 1;
+    }
+  }
+
+  // unbalanced tiles are stolen by idle workers
+  engine.set_tile_size(16, 16);
+  std::atomic<int> calls{0};
+  engine.render(strided_view{img}, [&calls](const render_tile &tile,
+                                            strided_view, std::span<uint8_t>,
+                                            int) {
+    calls++;
+    volatile double sink = 0;
+    const size_t work = (tile.row_beg < 32) ? 200000 : 100;
+    for (size_t i = 0; i < work; i++) {
+      sink = sink + 1;
+    }
+  });
+  if (size_t(calls) != engine.tiles().size()) {
+    fmt::print("{} tiles rendered, expected {}\n", int(calls),
+               engine.tiles().size());
+    return 1;
+  }
+
+  fmt::print("test_tile_render_engine succeeded\n");
+  return 0;
+}
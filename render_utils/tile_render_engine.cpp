@@ -0,0 +1,184 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#include "tile_render_engine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+using namespace fractal_utils;
+
+tile_render_engine::tile_render_engine(int threads) noexcept
+    : m_threads{threads} {
+  if (this->m_threads <= 0) {
+    this->m_threads = std::max(1, int(std::thread::hardware_concurrency()));
+  }
+}
+
+tile_render_engine::~tile_render_engine() {
+  {
+    std::lock_guard<std::mutex> lk{this->m_mutex};
+    this->m_stop = true;
+  }
+  this->m_start_cv.notify_all();
+  for (auto &worker : this->m_workers) {
+    worker.join();
+  }
+}
+
+void tile_render_engine::set_tile_size(size_t rows, size_t cols) noexcept {
+  assert(rows > 0 && cols > 0);
+  this->m_tile_rows = rows;
+  this->m_tile_cols = cols;
+  // retile on the next render
+  this->m_frame_rows = 0;
+  this->m_frame_cols = 0;
+}
+
+void tile_render_engine::start_workers() noexcept {
+  if (!this->m_workers.empty()) {
+    return;
+  }
+  this->m_queues.reserve(this->m_threads);
+  for (int w = 0; w < this->m_threads; w++) {
+    this->m_queues.emplace_back(std::make_unique<work_queue>());
+  }
+  this->m_workers.reserve(this->m_threads);
+  for (int w = 0; w < this->m_threads; w++) {
+    this->m_workers.emplace_back([this, w]() { this->worker_main(w); });
+  }
+}
+
+void tile_render_engine::make_tiles(size_t rows, size_t cols) noexcept {
+  if (rows == this->m_frame_rows && cols == this->m_frame_cols) {
+    return;
+  }
+  this->m_tiles.clear();
+  for (size_t r = 0; r < rows; r += this->m_tile_rows) {
+    for (size_t c = 0; c < cols; c += this->m_tile_cols) {
+      this->m_tiles.emplace_back(render_tile{
+          this->m_tiles.size(), r, std::min(r + this->m_tile_rows, rows), c,
+          std::min(c + this->m_tile_cols, cols)});
+    }
+  }
+  this->m_timings.assign(this->m_tiles.size(), tile_timing{0, 0});
+  this->m_scratch.resize(this->m_tiles.size());
+  this->m_frame_rows = rows;
+  this->m_frame_cols = cols;
+}
+
+void tile_render_engine::render(strided_view dst,
+                                const tile_fun_t &fun) noexcept {
+  if (dst.rows() == 0 || dst.cols() == 0) {
+    this->m_tiles.clear();
+    this->m_timings.clear();
+    this->m_frame_rows = 0;
+    this->m_frame_cols = 0;
+    return;
+  }
+  this->start_workers();
+  this->make_tiles(dst.rows(), dst.cols());
+  for (auto &scratch : this->m_scratch) {
+    scratch.resize(this->m_scratch_bytes);
+  }
+
+  this->m_fun = &fun;
+  this->m_dst = dst;
+  const size_t tile_count = this->m_tiles.size();
+  this->m_remaining = tile_count;
+  // Contiguous runs of tiles, so each worker starts on neighbouring memory.
+  for (int w = 0; w < this->m_threads; w++) {
+    auto &queue = *this->m_queues[w];
+    std::lock_guard<std::mutex> lk{queue.mutex};
+    for (size_t t = tile_count * w / this->m_threads;
+         t < tile_count * (w + 1) / this->m_threads; t++) {
+      queue.tiles.emplace_back(t);
+    }
+  }
+
+  std::unique_lock<std::mutex> lk{this->m_mutex};
+  this->m_generation++;
+  this->m_start_cv.notify_all();
+  this->m_done_cv.wait(lk, [this]() { return this->m_remaining == 0; });
+  this->m_fun = nullptr;
+}
+
+void tile_render_engine::worker_main(int worker) noexcept {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lk{this->m_mutex};
+      this->m_start_cv.wait(lk, [this, seen]() {
+        return this->m_stop || this->m_generation != seen;
+      });
+      if (this->m_stop) {
+        return;
+      }
+      seen = this->m_generation;
+    }
+    size_t tile;
+    while (this->take_tile(worker, tile)) {
+      this->run_tile(worker, tile);
+    }
+  }
+}
+
+bool tile_render_engine::take_tile(int worker, size_t &tile) noexcept {
+  {
+    auto &own = *this->m_queues[worker];
+    std::lock_guard<std::mutex> lk{own.mutex};
+    if (!own.tiles.empty()) {
+      tile = own.tiles.front();
+      own.tiles.pop_front();
+      return true;
+    }
+  }
+  for (int i = 1; i < this->m_threads; i++) {
+    auto &victim = *this->m_queues[(worker + i) % this->m_threads];
+    std::lock_guard<std::mutex> lk{victim.mutex};
+    if (!victim.tiles.empty()) {
+      tile = victim.tiles.back();
+      victim.tiles.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void tile_render_engine::run_tile(int worker, size_t tile) noexcept {
+  const render_tile &t = this->m_tiles[tile];
+  const auto begin = std::chrono::steady_clock::now();
+  (*this->m_fun)(t,
+                 this->m_dst.subview(t.row_beg, t.col_beg, t.rows(), t.cols()),
+                 this->m_scratch[tile], worker);
+  const auto end = std::chrono::steady_clock::now();
+  this->m_timings[tile] = tile_timing{
+      worker, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           end - begin)
+                           .count())};
+
+  if (this->m_remaining.fetch_sub(1) == 1) {
+    // lock so the wakeup can not slip in before render starts waiting
+    std::lock_guard<std::mutex> lk{this->m_mutex};
+    this->m_done_cv.notify_all();
+  }
+}
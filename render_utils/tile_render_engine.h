@@ -0,0 +1,162 @@
+/*
+ Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+    FractalUtils is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    FractalUtils is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+    Contact with me:
+    github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_RENDERUTILS_TILERENDERENGINE_H
+#define FRACTALUTILS_RENDERUTILS_TILERENDERENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "unique_map.h"
+
+namespace fractal_utils {
+
+struct render_tile {
+  // position in the order of tiles, row by row
+  size_t index;
+  size_t row_beg;
+  size_t row_end;
+  size_t col_beg;
+  size_t col_end;
+
+  [[nodiscard]] inline size_t rows() const noexcept {
+    return this->row_end - this->row_beg;
+  }
+  [[nodiscard]] inline size_t cols() const noexcept {
+    return this->col_end - this->col_beg;
+  }
+};
+
+struct tile_timing {
+  // the worker that rendered the tile
+  int worker;
+  uint64_t nanoseconds;
+};
+
+// Splits a target map into tiles and renders them on a pool of threads. Each
+// worker starts from its own share of the tiles and steals from the others
+// once it runs out, so a few slow tiles (deep zooms near the set) do not hold
+// back the frame. Threads are started by the first render and kept until the
+// engine is destroyed, and each tile keeps its scratch buffer between frames
+// of the same shape.
+class tile_render_engine {
+ public:
+  // Render one tile. dst is the part of the target covered by the tile, and
+  // scratch has scratch_bytes() bytes owned by this tile. Called concurrently
+  // for different tiles, and must not throw.
+  using tile_fun_t = std::function<void(const render_tile &tile,
+                                        strided_view dst,
+                                        std::span<uint8_t> scratch,
+                                        int worker)>;
+
+  static constexpr size_t default_tile_rows = 64;
+  static constexpr size_t default_tile_cols = 64;
+
+  // threads <= 0 means all hardware threads.
+  explicit tile_render_engine(int threads = 0) noexcept;
+  tile_render_engine(const tile_render_engine &) = delete;
+  tile_render_engine(tile_render_engine &&) = delete;
+  ~tile_render_engine();
+
+  tile_render_engine &operator=(const tile_render_engine &) = delete;
+  tile_render_engine &operator=(tile_render_engine &&) = delete;
+
+  [[nodiscard]] inline int threads() const noexcept { return this->m_threads; }
+
+  // Tile sizes and scratch bytes apply from the next render.
+  void set_tile_size(size_t rows, size_t cols) noexcept;
+  [[nodiscard]] inline size_t tile_rows() const noexcept {
+    return this->m_tile_rows;
+  }
+  [[nodiscard]] inline size_t tile_cols() const noexcept {
+    return this->m_tile_cols;
+  }
+  inline void set_scratch_bytes(size_t bytes) noexcept {
+    this->m_scratch_bytes = bytes;
+  }
+  [[nodiscard]] inline size_t scratch_bytes() const noexcept {
+    return this->m_scratch_bytes;
+  }
+
+  // Render every tile of dst and wait for all of them. Not reentrant; call it
+  // from one thread at a time.
+  void render(strided_view dst, const tile_fun_t &fun) noexcept;
+
+  // Tiles and their timings of the last render, in the same order.
+  [[nodiscard]] inline std::span<const render_tile> tiles() const noexcept {
+    return this->m_tiles;
+  }
+  [[nodiscard]] inline std::span<const tile_timing> timings() const noexcept {
+    return this->m_timings;
+  }
+
+ private:
+  struct work_queue {
+    std::mutex mutex;
+    std::deque<size_t> tiles;
+  };
+
+  int m_threads;
+  size_t m_tile_rows{default_tile_rows};
+  size_t m_tile_cols{default_tile_cols};
+  size_t m_scratch_bytes{0};
+
+  std::vector<render_tile> m_tiles;
+  std::vector<tile_timing> m_timings;
+  std::vector<std::vector<uint8_t>> m_scratch;
+  // shape of the frame that m_tiles and m_scratch were made for
+  size_t m_frame_rows{0};
+  size_t m_frame_cols{0};
+
+  // the current job, written before any of its tiles are queued
+  const tile_fun_t *m_fun{nullptr};
+  strided_view m_dst;
+
+  std::vector<std::unique_ptr<work_queue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_start_cv;
+  std::condition_variable m_done_cv;
+  uint64_t m_generation{0};
+  bool m_stop{false};
+  std::atomic<size_t> m_remaining{0};
+
+  void start_workers() noexcept;
+  void make_tiles(size_t rows, size_t cols) noexcept;
+  void worker_main(int worker) noexcept;
+  // pop from the front of the own queue, or steal from the back of another
+  [[nodiscard]] bool take_tile(int worker, size_t &tile) noexcept;
+  void run_tile(int worker, size_t tile) noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_RENDERUTILS_TILERENDERENGINE_H
@@ -0,0 +1,144 @@
+/*
+Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+FractalUtils is free software: you can redistribute it and/or modify
+                                                                    it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+                                        FractalUtils is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+   Contact with me:
+   github:https://github.com/ToKiNoBug
+*/
+
+#include "archive_prefetcher.h"
+
+#include <algorithm>
+
+using namespace fractal_utils;
+
+archive_prefetcher::archive_prefetcher(std::span<const int> archive_indices,
+                                       load_fun_t load_fun, int io_threads,
+                                       int capacity) noexcept
+    : m_tasks{archive_indices.begin(), archive_indices.end()},
+      m_load_fun{std::move(load_fun)},
+      m_capacity{size_t(std::max(capacity, 1))} {
+  const int thread_num =
+      std::min<int>(std::max(io_threads, 1), this->m_tasks.size());
+  try {
+    this->m_threads.reserve(thread_num);
+    for (int i = 0; i < thread_num; i++) {
+      this->m_threads.emplace_back([this]() { this->io_loop(); });
+    }
+  } catch (...) {
+    // run with the threads we got, or load in next() if there is none
+  }
+}
+
+archive_prefetcher::~archive_prefetcher() {
+  this->stop();
+  for (auto &thread : this->m_threads) {
+    thread.join();
+  }
+}
+
+void archive_prefetcher::stop() noexcept {
+  {
+    std::lock_guard<std::mutex> lkgd{this->m_lock};
+    this->m_stop = true;
+  }
+  this->m_space_cv.notify_all();
+  this->m_ready_cv.notify_all();
+}
+
+void archive_prefetcher::io_loop() noexcept {
+  while (true) {
+    int archive_index;
+    {
+      std::unique_lock<std::mutex> lk{this->m_lock};
+      this->m_space_cv.wait(lk, [this]() {
+        return this->m_stop || this->m_next_task >= this->m_tasks.size() ||
+               this->m_loading + this->m_ready.size() < this->m_capacity;
+      });
+      if (this->m_stop || this->m_next_task >= this->m_tasks.size()) {
+        return;
+      }
+      archive_index = this->m_tasks[this->m_next_task];
+      this->m_next_task++;
+      this->m_loading++;
+    }
+
+    item loaded;
+    loaded.archive_index = archive_index;
+    try {
+      loaded.error = this->m_load_fun(archive_index, loaded.archive);
+    } catch (...) {
+      loaded.error = "Exception thrown while loading";
+    }
+
+    {
+      std::lock_guard<std::mutex> lkgd{this->m_lock};
+      this->m_loading--;
+      try {
+        this->m_ready.emplace_back(std::move(loaded));
+      } catch (...) {
+        // the consumer must still get an item for this archive
+        this->m_stop = true;
+      }
+    }
+    this->m_ready_cv.notify_one();
+  }
+}
+
+bool archive_prefetcher::next(item &dst) noexcept {
+  std::unique_lock<std::mutex> lk{this->m_lock};
+  if (this->m_handed_out >= this->m_tasks.size()) {
+    return false;
+  }
+
+  if (this->m_threads.empty()) {
+    if (this->m_stop) {
+      return false;
+    }
+    dst.archive_index = this->m_tasks[this->m_next_task];
+    this->m_next_task++;
+    this->m_handed_out++;
+    lk.unlock();
+    dst.archive.reset();
+    try {
+      dst.error = this->m_load_fun(dst.archive_index, dst.archive);
+    } catch (...) {
+      dst.error = "Exception thrown while loading";
+    }
+    return true;
+  }
+
+  this->m_ready_cv.wait(lk, [this]() {
+    return !this->m_ready.empty() ||
+           this->m_handed_out >= this->m_tasks.size() ||
+           (this->m_stop && this->m_loading == 0);
+  });
+  if (this->m_ready.empty()) {
+    return false;
+  }
+  dst = std::move(this->m_ready.front());
+  this->m_ready.pop_front();
+  this->m_handed_out++;
+  const bool all_handed_out = this->m_handed_out >= this->m_tasks.size();
+  lk.unlock();
+  this->m_space_cv.notify_one();
+  if (all_handed_out) {
+    // wake up consumers waiting for archives that will never come
+    this->m_ready_cv.notify_all();
+  }
+  return true;
+}
@@ -0,0 +1,96 @@
+/*
+Copyright © 2022-2023  TokiNoBug
+This file is part of FractalUtils.
+
+FractalUtils is free software: you can redistribute it and/or modify
+                                                                    it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+                                        FractalUtils is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FractalUtils.  If not, see <https://www.gnu.org/licenses/>.
+
+   Contact with me:
+   github:https://github.com/ToKiNoBug
+*/
+
+#ifndef FRACTALUTILS_VIDEOUTILS_ARCHIVEPREFETCHER_H
+#define FRACTALUTILS_VIDEOUTILS_ARCHIVEPREFETCHER_H
+
+#include <any>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fractal_utils {
+
+// Loads archives on background threads ahead of the threads that consume
+// them. At most `capacity` archives are being loaded or waiting to be taken
+// at any time, which bounds the memory used. Archives are handed out in the
+// order they finish loading.
+class archive_prefetcher {
+ public:
+  struct item {
+    int archive_index{-1};
+    std::any archive;
+    // empty if loaded successfully
+    std::string error;
+  };
+  // Must be thread safe, it's called by all I/O threads concurrently.
+  using load_fun_t =
+      std::function<std::string(int archive_index, std::any &archive)>;
+
+ private:
+  std::vector<int> m_tasks;
+  load_fun_t m_load_fun;
+  size_t m_capacity;
+
+  std::mutex m_lock;
+  std::condition_variable m_ready_cv;
+  std::condition_variable m_space_cv;
+  std::deque<item> m_ready;
+  size_t m_next_task{0};
+  size_t m_loading{0};
+  size_t m_handed_out{0};
+  bool m_stop{false};
+
+  std::vector<std::thread> m_threads;
+
+ public:
+  archive_prefetcher(std::span<const int> archive_indices, load_fun_t load_fun,
+                     int io_threads, int capacity) noexcept;
+  archive_prefetcher(const archive_prefetcher &) = delete;
+  archive_prefetcher(archive_prefetcher &&) = delete;
+  ~archive_prefetcher();
+
+  // Blocks until an archive is loaded. Returns false if all archives have
+  // been handed out, or the prefetcher is stopped. Can be called from any
+  // number of threads. If no I/O thread could be started, the archive is
+  // loaded by the calling thread.
+  [[nodiscard]] bool next(item &dst) noexcept;
+
+  // Stop loading. Archives that are being loaded are dropped when finished.
+  void stop() noexcept;
+
+  [[nodiscard]] inline size_t task_count() const noexcept {
+    return this->m_tasks.size();
+  }
+
+ private:
+  void io_loop() noexcept;
+};
+
+}  // namespace fractal_utils
+
+#endif  // FRACTALUTILS_VIDEOUTILS_ARCHIVEPREFETCHER_H
@@ -35,9 +35,45 @@ using namespace fractal_utils;
 
 [[nodiscard]] bool create_required_dirs(const stdfs::path &filename) noexcept;
 
-std::string common_info_base::size_expression_4ffmpeg() const noexcept {
-  return fmt::format("{}x{}", int((double)this->cols() / this->ratio),
-                     int((double)this->rows() / this->ratio));
+namespace {
+// Sets the max active levels of OpenMP in a scope, and restores the previous
+// value when leaving it.
+class omp_levels_guard {
+ private:
+  int m_previous;
+
+ public:
+  explicit omp_levels_guard(int levels) noexcept
+      : m_previous{omp_get_max_active_levels()} {
+    omp_set_max_active_levels(levels);
+  }
+  omp_levels_guard(const omp_levels_guard &) = delete;
+  ~omp_levels_guard() { omp_set_max_active_levels(this->m_previous); }
+
+  omp_levels_guard &operator=(const omp_levels_guard &) = delete;
+};
+}  // namespace
+
+size_t common_info_base::video_rows() const noexcept {
+  return size_t(int((double)this->rows() / this->ratio));
+}
+
+size_t common_info_base::video_cols() const noexcept {
+  return size_t(int((double)this->cols() / this->ratio));
+}
+
+std::string common_info_base::size_expression_4ffmpeg(
+    int supersample) const noexcept {
+  return fmt::format("{}x{}", this->video_cols() / supersample,
+                     this->video_rows() / supersample);
+}
+
+std::string render_task_base::check_supersample() const noexcept {
+  if (this->supersample < 1 || this->supersample > max_downsample_factor) {
+    return fmt::format("Invalid supersample {}, it should be in [1, {}].",
+                       this->supersample, max_downsample_factor);
+  }
+  return {};
 }
 
 std::string video_task_base::video_config::encode_expr_4ffmpeg()
@@ -78,6 +114,19 @@ std::optional<full_task> video_executor_base::load_task(
 bool video_executor_base::check_archive(
     std::string_view filename, std::span<uint8_t> buffer,
     std::any *return_archive) const noexcept {
+  const auto &ct = this->m_task.compute;
+  if (return_archive == nullptr && ct != nullptr &&
+      ct->check_archive_by_checksum) {
+    archive_verify_stats stats;
+    if (!binary_archive::verify(filename, &stats).empty()) {
+      return false;
+    }
+    // without the index footer, a file cut at a record boundary would pass
+    if (stats.indexed && stats.segments > 0 && stats.fully_checksummed()) {
+      return true;
+    }
+  }
+
   std::any ar;
   std::string err = this->load_archive(filename, buffer, ar);
   if (!ar.has_value() || !err.empty()) {
@@ -384,11 +433,33 @@ video_executor_base::render_task_status() const noexcept {
   return ret;
 }
 
+std::unique_ptr<archive_prefetcher> video_executor_base::create_prefetcher(
+    std::span<const int> archive_indices) const noexcept {
+  const auto &rt = *this->m_task.render;
+  try {
+    return std::make_unique<archive_prefetcher>(
+        archive_indices,
+        [this](int aidx, std::any &archive) {
+          // archives outlive any buffer of the I/O thread, so load them
+          // without one
+          return this->load_archive(this->archive_filename(aidx), archive);
+        },
+        rt.prefetch_threads, rt.prefetch_archives);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
 bool video_executor_base::run_render() const noexcept {
   const auto &common = *this->m_task.common;
   const auto &ct = *this->m_task.compute;
   const auto &rt = *this->m_task.render;
 
+  if (auto err = rt.check_supersample(); !err.empty()) {
+    fmt::print("{}\n", err);
+    return false;
+  }
+
   const auto render_status = this->render_task_status();
   assert(render_status.size() == common.archive_num);
 
@@ -425,31 +496,29 @@ bool video_executor_base::run_render() const noexcept {
   const int already_rendered_archives = fully_rendered_archive_count;
 
   std::mutex lock;
-
-  omp_set_num_threads(rt.threads);
-
-#pragma omp parallel for default(shared)                                      \
-    shared(common, ct, rt, render_status, lock, fully_rendered_archive_count) \
-    schedule(dynamic)
-  for (int aidx = 0; aidx < common.archive_num; aidx++) {
-    if (render_status[aidx] == render_status::all_rendered) {
-      continue;
+  std::atomic<int> archives_in_progress{0};
+
+  // Each archive in progress gets an equal share of rt.threads, so nested
+  // teams only use cores that the outer loop leaves idle.
+  auto idle_share = [&rt, &archives_in_progress]() {
+    const int busy = std::max(int(archives_in_progress), 1);
+    return std::max(rt.threads / busy, 1);
+  };
+
+  // share is the number of threads this image may use
+  auto save_png = [&rt](const std::string &filename,
+                        constant_strided_view image, int share) {
+    const int threads = std::min(rt.png_threads, share);
+    if (threads > 1) {
+      png_encode_options opt;
+      opt.threads = threads;
+      return write_png_parallel(filename.c_str(), color_space::u8c3, image,
+                                opt);
     }
+    return write_png(filename.c_str(), color_space::u8c3, image);
+  };
 
-    thread_local std::any archive;
-    thread_local std::vector<uint8_t> buffer;
-    thread_local std::string filename;
-    thread_local unique_map image_u8c3{common.rows(), common.cols(), 3};
-    thread_local std::vector<const void *> row_ptrs;
-    thread_local std::unique_ptr<render_resource_base> render_resource =
-        this->create_render_resource();
-
-    buffer.resize(common.suggested_load_buffer_size());
-    filename.reserve(1024);
-    row_ptrs.reserve(common.cols());
-
-    this->archive_filename(aidx, filename);
-
+  auto print_progress = [&](std::string_view filename) {
     if (lock.try_lock()) {
       fmt::print(
           "[{} / {} : {}%] : Rendering {}\n", int(fully_rendered_archive_count),
@@ -458,16 +527,98 @@ bool video_executor_base::run_render() const noexcept {
           filename);
       lock.unlock();
     }
+  };
+
+  // colour an archive once, then crop and rescale each image from the cached
+  // frame
+  auto render_archive_rescaled = [&](int aidx, const std::any &archive,
+                                     std::string_view filename) -> bool {
+    thread_local unique_map image_u8c3{common.rows(), common.cols(), 3};
+    thread_local std::unique_ptr<render_resource_base> render_resource =
+        this->create_render_resource();
 
     {
-      auto err = this->load_archive(filename, buffer, archive);
-      if (!archive.has_value() || !err.empty()) {
+      auto err =
+          this->render(archive, aidx, 0, image_u8c3, render_resource.get());
+      if (!err.empty()) {
+        std::lock_guard<std::mutex> lkgd{lock};
+        fmt::print(
+            "Fatal: failed to render {} with image_idx = {}, rescale_images = "
+            "true, detail: {}\n",
+            filename, 0, err);
+        return false;
+      }
+    }
+
+    // thread_local above belongs to this thread, the images below may be
+    // processed by others
+    const constant_view frame{image_u8c3};
+    std::atomic<bool> ok{true};
+    // A nested team on the cores the outer loop leaves idle. Each image uses
+    // the output buffer of the thread that processes it.
+    const int image_threads =
+        std::max(std::min(idle_share(), rt.image_count()), 1);
+    const int png_share = std::max(idle_share() / image_threads, 1);
+#pragma omp parallel for num_threads(image_threads) schedule(dynamic) \
+    default(shared) shared(frame, ok, lock)
+    for (int iidx = 0; iidx < rt.image_count(); iidx++) {
+      thread_local unique_map image_out;
+      thread_local std::string image_filename;
+      image_out.reset(common.video_rows() / rt.supersample,
+                      common.video_cols() / rt.supersample, 3);
+      this->image_filename(aidx, iidx, image_filename);
+
+      const int skip_r =
+          skip_rows(common.rows(), common.ratio, rt.image_per_frame, iidx);
+      const int skip_c =
+          skip_cols(common.cols(), common.ratio, rt.image_per_frame, iidx);
+      const constant_strided_view crop =
+          frame.subview(skip_r, skip_c, common.rows() - 2 * skip_r,
+                        common.cols() - 2 * skip_c);
+      if (rt.supersample > 1) {
+        // average in linear light first, as without rescale_images, then
+        // only the remaining zoom is left to the filter
+        thread_local unique_map image_small;
+        image_small.reset(crop.rows() / rt.supersample,
+                          crop.cols() / rt.supersample, 3);
+        downsample_u8(crop, image_small, rt.supersample);
+        resize_u8(constant_view{image_small}, image_out, rt.rescale_filter);
+      } else {
+        resize_u8(crop, image_out, rt.rescale_filter);
+      }
+
+      if (!create_required_dirs(image_filename)) {
         std::lock_guard<std::mutex> lkgd{lock};
-        fmt::print("Fatal : failed to load {}, detail: {}.\n", filename, err);
+        fmt::print(
+            "Fatal: failed create_required_dirs for {}. archive filename= "
+            "{}, image_idx = {}, rescale_images = true\n",
+            image_filename, filename, iidx);
+        ok = false;
         continue;
       }
+      if (!save_png(image_filename, constant_view{image_out}, png_share)) {
+        std::lock_guard<std::mutex> lkgd{lock};
+        fmt::print(
+            "Fatal: failed to save {} with archive filename= {} with "
+            "image_idx = {}, rescale_images = true\n",
+            image_filename, filename, iidx);
+        ok = false;
+      }
+    }
+    return ok;
+  };
+
+  // render all images of a loaded archive
+  auto render_archive = [&](int aidx, const std::any &archive,
+                            std::string_view filename) -> bool {
+    if (rt.rescale_images) {
+      return render_archive_rescaled(aidx, archive, filename);
     }
 
+    thread_local unique_map image_u8c3{common.rows(), common.cols(), 3};
+    thread_local std::unique_ptr<render_resource_base> render_resource =
+        this->create_render_resource();
+
     const bool render_once = rt.render_once;
     if (render_once) {
       auto err =
@@ -478,14 +629,13 @@ bool video_executor_base::run_render() const noexcept {
             "Fatal: failed to render {} with image_idx = {}, render_once = {}, "
             "detail: {}\n",
             filename, 0, render_once, err);
-        continue;
+        return false;
       }
     }
 
     std::string image_filename;
     image_filename.reserve(1024);
 
-    bool fail_to_render{false};
     for (int iidx = 0; iidx < rt.image_count(); iidx++) {
       this->image_filename(aidx, iidx, image_filename);
 
@@ -504,8 +654,7 @@ bool video_executor_base::run_render() const noexcept {
               "{}, "
               "detail: {}\n",
               filename, 0, render_once, err);
-          fail_to_render = true;
-          break;
+          return false;
         }
       }
 
@@ -516,27 +665,121 @@ bool video_executor_base::run_render() const noexcept {
             "{},image_idx "
             "= {}, render_once = {}\n",
             image_filename, filename, 0, render_once);
-        fail_to_render = true;
-        break;
+        return false;
       }
 
-      if (!write_png_skipped(image_filename.c_str(), color_space::u8c3,
-                             image_u8c3, skip_r, skip_c, row_ptrs)) {
+      bool saved;
+      if (rt.supersample > 1) {
+        thread_local unique_map image_small;
+        const constant_strided_view crop = constant_view{image_u8c3}.subview(
+            skip_r, skip_c, common.rows() - 2 * skip_r,
+            common.cols() - 2 * skip_c);
+        image_small.reset(crop.rows() / rt.supersample,
+                          crop.cols() / rt.supersample, 3);
+        downsample_u8(crop, image_small, rt.supersample);
+        saved =
+            save_png(image_filename, constant_view{image_small}, idle_share());
+      } else {
+        saved = save_png(image_filename,
+                         constant_view{image_u8c3}.subview(
+                             skip_r, skip_c, common.rows() - 2 * skip_r,
+                             common.cols() - 2 * skip_c),
+                         idle_share());
+      }
+      if (!saved) {
         std::lock_guard<std::mutex> lkgd{lock};
         fmt::print(
             "Fatal: failed to save {} with archive filename= {} with image_idx "
             "= {}, render_once = {}\n",
             image_filename, filename, 0, render_once);
-        fail_to_render = true;
-        break;
+        return false;
       }
     }
+    return true;
+  };
 
-    if (fail_to_render) {
-      continue;
+  omp_set_num_threads(rt.threads);
+  // Images of an archive are processed by a nested team with
+  // rescale_images, and each image may be encoded by another one.
+  const int nested_levels =
+      1 + (rt.rescale_images ? 1 : 0) + (rt.png_threads > 1 ? 1 : 0);
+  const omp_levels_guard levels{
+      std::max(omp_get_max_active_levels(), nested_levels)};
+
+  if (rt.prefetch_archives > 0) {
+    std::vector<int> tasks;
+    for (int aidx = 0; aidx < common.archive_num; aidx++) {
+      if (render_status[aidx] != render_status::all_rendered) {
+        tasks.emplace_back(aidx);
+      }
+    }
+    auto prefetcher = this->create_prefetcher(tasks);
+    if (prefetcher == nullptr) {
+      fmt::print("Fatal : failed to create archive prefetcher.\n");
+      return false;
     }
 
-    fully_rendered_archive_count++;
+#pragma omp parallel default(shared) \
+    shared(prefetcher, lock, fully_rendered_archive_count)
+    {
+      archive_prefetcher::item item;
+      std::string filename;
+      filename.reserve(1024);
+      while (prefetcher->next(item)) {
+        this->archive_filename(item.archive_index, filename);
+        print_progress(filename);
+
+        if (!item.archive.has_value() || !item.error.empty()) {
+          std::lock_guard<std::mutex> lkgd{lock};
+          fmt::print("Fatal : failed to load {}, detail: {}.\n", filename,
+                     item.error);
+          continue;
+        }
+
+        archives_in_progress++;
+        if (render_archive(item.archive_index, item.archive, filename)) {
+          fully_rendered_archive_count++;
+        }
+        archives_in_progress--;
+        // release memory before waiting for the next archive
+        item.archive.reset();
+      }
+    }
+  } else {
+#pragma omp parallel for default(shared)                                      \
+    shared(common, ct, rt, render_status, lock, fully_rendered_archive_count) \
+    schedule(dynamic)
+    for (int aidx = 0; aidx < common.archive_num; aidx++) {
+      if (render_status[aidx] == render_status::all_rendered) {
+        continue;
+      }
+
+      thread_local std::any archive;
+      thread_local std::vector<uint8_t> buffer;
+      thread_local std::string filename;
+
+      buffer.resize(common.suggested_load_buffer_size());
+      filename.reserve(1024);
+
+      this->archive_filename(aidx, filename);
+      print_progress(filename);
+
+      {
+        auto err = this->load_archive(filename, buffer, archive);
+        if (!archive.has_value() || !err.empty()) {
+          std::lock_guard<std::mutex> lkgd{lock};
+          fmt::print("Fatal : failed to load {}, detail: {}.\n", filename,
+                     err);
+          continue;
+        }
+      }
+
+      archives_in_progress++;
+      if (render_archive(aidx, archive, filename)) {
+        fully_rendered_archive_count++;
+      }
+      archives_in_progress--;
+    }
   }
 
   if (fully_rendered_archive_count != common.archive_num) {
@@ -24,6 +24,8 @@ General Public License for more details.
 #define FRACTALUTILS_VIDEOUTILS_VIDEOUTILS_H
 
 #include "core_utils.h"
+#include "archive_prefetcher.h"
+#include "image_resample.h"
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
@@ -47,7 +49,13 @@ class common_info_base {
     return 1 << 20;
   }
 
-  [[nodiscard]] std::string size_expression_4ffmpeg() const noexcept;
+  // size of the video, rows() and cols() divided by ratio
+  [[nodiscard]] size_t video_rows() const noexcept;
+  [[nodiscard]] size_t video_cols() const noexcept;
+
+  // video_cols() x video_rows(), divided by render_task_base::supersample
+  [[nodiscard]] std::string size_expression_4ffmpeg(
+      int supersample = 1) const noexcept;
 };
 
 class compute_task_base {
@@ -60,6 +68,13 @@ class compute_task_base {
   std::string archive_suffix;
   std::string archive_extension{"bin"};
   int threads;
+  // Trust an archive if all its segments have checksums and they match,
+  // instead of loading it and calling error_of_archive. Only useful if
+  // save_archive writes checksums and an index footer
+  // (archive_save_options::write_checksum and write_index), the footer is
+  // what shows that no segment is missing. Other archives are still checked
+  // by loading them.
+  bool check_archive_by_checksum{false};
 };
 
 class render_task_base {
@@ -68,7 +83,32 @@ class render_task_base {
   int image_per_frame;
   int extra_image_num;
   int threads{4};
+  // Number of archives loaded ahead by background threads while others are
+  // rendered, 0 disables prefetching. Prefetched archives are loaded without
+  // a buffer, so they own their data.
+  int prefetch_archives{0};
+  int prefetch_threads{2};
   bool render_once;
+  // Colour each archive once into a cached frame, then crop every image from
+  // it and rescale the crop to video_rows() x video_cols(). The images of an
+  // archive are processed in parallel by the threads that other archives
+  // leave idle. Overrides render_once; images are written at the size of the
+  // video instead of the size of their crop.
+  bool rescale_images{false};
+  // filter used by rescale_images
+  resample_filter rescale_filter{resample_filter::lanczos3};
+  // Archives are computed at supersample times the resolution of the video
+  // in each direction. Images are averaged down by this factor in linear
+  // light before they are written, and the video is smaller by the same
+  // factor. With rescale_images, each crop is averaged down first and then
+  // rescaled by rescale_filter. 1 disables it, at most
+  // max_downsample_factor.
+  int supersample{1};
+  // Threads used to encode each image. Above 1, images are written by
+  // write_png_parallel, which helps when frames are large and there are
+  // fewer archives left than cores. An encoder only gets the threads that
+  // the archives still being rendered leave idle.
+  int png_threads{1};
   std::string image_prefix;
   std::string image_suffix;
   std::string image_extension{"png"};
@@ -76,6 +116,9 @@ class render_task_base {
   [[nodiscard]] inline int image_count() const noexcept {
     return this->image_per_frame + this->extra_image_num;
   }
+  // Returns an error message if supersample is not in
+  // [1, max_downsample_factor].
+  [[nodiscard]] std::string check_supersample() const noexcept;
 };
 
 class video_task_base {
@@ -245,6 +288,11 @@ class video_executor_base {
       std::string_view filename, std::span<uint8_t> buffer,
       std::any &archive) const noexcept = 0;
 
+  // Loads the given archives in background, with the prefetch settings of the
+  // render task.
+  [[nodiscard]] virtual std::unique_ptr<archive_prefetcher> create_prefetcher(
+      std::span<const int> archive_indices) const noexcept;
+
   [[nodiscard]] virtual bool make_temp_video(int aidx,
                                              bool dry_run) const noexcept;
   [[nodiscard]] virtual bool make_temp_extra_video(int aidx,
@@ -41,6 +41,11 @@ bool video_executor_base::make_video(bool dry_run) const noexcept {
   const auto &ct = *this->m_task.compute;
   const auto &rt = *this->m_task.render;
   const auto &vt = *this->m_task.video;
+  // the size of every temp video depends on it
+  if (auto err = rt.check_supersample(); !err.empty()) {
+    fmt::print("{}\n", err);
+    return false;
+  }
   omp_set_num_threads(vt.threads);
 
   const auto render_status_vec = this->render_task_status();
@@ -175,8 +180,8 @@ bool video_executor_base::make_temp_video(int aidx,
       "{} -vf "
       "\"scale={}\" {} -y {}",
       vt.ffmpeg_exe, fps, image_filename_expr, fps,
-      common.size_expression_4ffmpeg(), vt.temp_config.encode_expr_4ffmpeg(),
-      out_filename);
+      common.size_expression_4ffmpeg(rt.supersample),
+      vt.temp_config.encode_expr_4ffmpeg(), out_filename);
 
   return !run_command(command, dry_run);
 }
@@ -215,8 +220,8 @@ bool video_executor_base::make_temp_extra_video(int aidx,
       "{} -vf "
       "\"scale={}\" {} -y {}",
       vt.ffmpeg_exe, fps, fps, image_filename_expr, rt.extra_image_num,
-      common.size_expression_4ffmpeg(), vt.temp_config.encode_expr_4ffmpeg(),
-      out_filename);
+      common.size_expression_4ffmpeg(rt.supersample),
+      vt.temp_config.encode_expr_4ffmpeg(), out_filename);
 
   return !run_command(command, dry_run);
 }
@@ -312,7 +317,7 @@ bool video_executor_base::make_second_temp_video(int aidx,
   const std::string i1_expr = fmt::format("-i {}", temp_extra_filename);
   const std::string i2_expr =
       fmt::format("-f lavfi -i nullsrc=size={}:r={}:duration=1",
-                  common.size_expression_4ffmpeg(), fps);
+                  common.size_expression_4ffmpeg(rt.supersample), fps);
 
   const std::string filter_expr = fmt::format(
       "[2]{}[alpha];[1][alpha]alphamerge[extra_a];[0][extra_a]overlay[out]",
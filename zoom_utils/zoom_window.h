@@ -33,6 +33,7 @@ General Public License for more details.
 #include <QTranslator>
 
 #include "scalable_label.h"
+#include "tile_render_engine.h"
 
 namespace fractal_utils {
 
@@ -95,6 +96,9 @@ class zoom_window : public QMainWindow {
   language_t m_current_lang{language_t::en_US};
   QTranslator m_translator_zoom_window;
 
+  // shared by every render, so its threads and scratch buffers are reused
+  mutable tile_render_engine m_render_engine;
+
  protected:
   virtual void compute_current() & noexcept;
   virtual void render_current() & noexcept;
@@ -115,6 +119,11 @@ class zoom_window : public QMainWindow {
                        std::any &archive) const noexcept = 0;
   virtual void render(std::any &archive, const wind_base &wind,
                       map_view image_u8c3) const noexcept = 0;
+  // Implementations of render can split image_u8c3 into tiles with this
+  // engine to use all cores instead of the GUI thread alone.
+  [[nodiscard]] tile_render_engine &render_engine() const noexcept {
+    return this->m_render_engine;
+  }
   virtual QString export_frame(QString filename, const wind_base &wind,
                                constant_view image_u8c3,
                                std::any &custom) const noexcept;